@@ -0,0 +1,215 @@
+#include "config.h"
+#include "empathy-avatar-cache.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+/* Decoded avatars, shared by all the widgets displaying the same avatar at
+ * the same size: the roster, the contact lists, the chat windows and the
+ * notifications. An avatar is identified by a token changing with its image,
+ * such as its file along with the file's modification time.
+ *
+ * The least recently used pixbufs are dropped once they take more than the
+ * size given to empathy_avatar_cache_new(). */
+
+/* Size of the default cache, in bytes of pixels */
+#define DEFAULT_MAX_SIZE (16 * 1024 * 1024)
+
+typedef struct
+{
+  gchar *key;
+  GdkPixbuf *pixbuf;
+  gsize size;
+} CacheEntry;
+
+struct _EmpathyAvatarCache
+{
+  /* (gchar *) key -> GList link of the CacheEntry in lru */
+  GHashTable *entries;
+  /* queue of (CacheEntry *), the most recently used first */
+  GQueue *lru;
+  gsize size;
+  gsize max_size;
+
+  guint hits;
+  guint misses;
+};
+
+static gchar *
+cache_key (const gchar *token,
+    gint width,
+    gint height,
+    gboolean rounded)
+{
+  return g_strdup_printf ("%s\n%dx%d%s", token, width, height,
+      rounded ? "r" : "");
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_free (entry->key);
+  g_object_unref (entry->pixbuf);
+  g_slice_free (CacheEntry, entry);
+}
+
+static void
+avatar_cache_remove_link (EmpathyAvatarCache *self,
+    GList *link)
+{
+  CacheEntry *entry = link->data;
+
+  g_hash_table_remove (self->entries, entry->key);
+  g_queue_delete_link (self->lru, link);
+
+  self->size -= entry->size;
+  cache_entry_free (entry);
+}
+
+EmpathyAvatarCache *
+empathy_avatar_cache_new (gsize max_size)
+{
+  EmpathyAvatarCache *self = g_slice_new0 (EmpathyAvatarCache);
+
+  /* The keys are owned by the entries */
+  self->entries = g_hash_table_new (g_str_hash, g_str_equal);
+  self->lru = g_queue_new ();
+  self->max_size = max_size;
+
+  return self;
+}
+
+void
+empathy_avatar_cache_free (EmpathyAvatarCache *self)
+{
+  g_hash_table_unref (self->entries);
+  g_queue_free_full (self->lru, (GDestroyNotify) cache_entry_free);
+
+  g_slice_free (EmpathyAvatarCache, self);
+}
+
+/**
+ * empathy_avatar_cache_get_default:
+ *
+ * Returns: (transfer none): the cache shared by the whole process
+ */
+EmpathyAvatarCache *
+empathy_avatar_cache_get_default (void)
+{
+  static EmpathyAvatarCache *cache = NULL;
+
+  if (cache == NULL)
+    cache = empathy_avatar_cache_new (DEFAULT_MAX_SIZE);
+
+  return cache;
+}
+
+/**
+ * empathy_avatar_cache_lookup:
+ * @self: an #EmpathyAvatarCache
+ * @token: the token of the avatar
+ * @width: the width the avatar was requested at
+ * @height: the height the avatar was requested at
+ * @rounded: whether the corners of the avatar were rounded
+ *
+ * Returns: (transfer full): the pixbuf, which must not be modified, or %NULL
+ *   if it is not in the cache
+ */
+GdkPixbuf *
+empathy_avatar_cache_lookup (EmpathyAvatarCache *self,
+    const gchar *token,
+    gint width,
+    gint height,
+    gboolean rounded)
+{
+  CacheEntry *entry;
+  GList *link;
+  gchar *key;
+
+  g_return_val_if_fail (token != NULL, NULL);
+
+  key = cache_key (token, width, height, rounded);
+  link = g_hash_table_lookup (self->entries, key);
+  g_free (key);
+
+  if (link == NULL)
+    {
+      self->misses++;
+      return NULL;
+    }
+
+  self->hits++;
+
+  /* Most recently used */
+  g_queue_unlink (self->lru, link);
+  g_queue_push_head_link (self->lru, link);
+
+  entry = link->data;
+  return g_object_ref (entry->pixbuf);
+}
+
+void
+empathy_avatar_cache_insert (EmpathyAvatarCache *self,
+    const gchar *token,
+    gint width,
+    gint height,
+    gboolean rounded,
+    GdkPixbuf *pixbuf)
+{
+  CacheEntry *entry;
+  GList *link;
+
+  g_return_if_fail (token != NULL);
+  g_return_if_fail (GDK_IS_PIXBUF (pixbuf));
+
+  entry = g_slice_new (CacheEntry);
+  entry->key = cache_key (token, width, height, rounded);
+  entry->pixbuf = g_object_ref (pixbuf);
+  entry->size = gdk_pixbuf_get_rowstride (pixbuf) *
+    gdk_pixbuf_get_height (pixbuf);
+
+  /* Loaded twice at the same time */
+  link = g_hash_table_lookup (self->entries, entry->key);
+  if (link != NULL)
+    avatar_cache_remove_link (self, link);
+
+  if (entry->size > self->max_size)
+    {
+      DEBUG ("Avatar %s doesn't fit in the cache", token);
+      cache_entry_free (entry);
+      return;
+    }
+
+  g_queue_push_head (self->lru, entry);
+  g_hash_table_insert (self->entries, entry->key,
+      g_queue_peek_head_link (self->lru));
+  self->size += entry->size;
+
+  while (self->size > self->max_size)
+    avatar_cache_remove_link (self, g_queue_peek_tail_link (self->lru));
+}
+
+/* Returns the number of bytes of pixels in the cache */
+gsize
+empathy_avatar_cache_get_size (EmpathyAvatarCache *self)
+{
+  return self->size;
+}
+
+/**
+ * empathy_avatar_cache_get_stats:
+ * @self: an #EmpathyAvatarCache
+ * @hits: (out) (allow-none): the number of lookups which found their pixbuf
+ * @misses: (out) (allow-none): the number of lookups which didn't
+ */
+void
+empathy_avatar_cache_get_stats (EmpathyAvatarCache *self,
+    guint *hits,
+    guint *misses)
+{
+  if (hits != NULL)
+    *hits = self->hits;
+
+  if (misses != NULL)
+    *misses = self->misses;
+}
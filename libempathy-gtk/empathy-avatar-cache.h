@@ -0,0 +1,37 @@
+#ifndef __EMPATHY_AVATAR_CACHE_H__
+#define __EMPATHY_AVATAR_CACHE_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyAvatarCache EmpathyAvatarCache;
+
+EmpathyAvatarCache * empathy_avatar_cache_new (gsize max_size);
+
+void empathy_avatar_cache_free (EmpathyAvatarCache *self);
+
+EmpathyAvatarCache * empathy_avatar_cache_get_default (void);
+
+GdkPixbuf * empathy_avatar_cache_lookup (EmpathyAvatarCache *self,
+    const gchar *token,
+    gint width,
+    gint height,
+    gboolean rounded);
+
+void empathy_avatar_cache_insert (EmpathyAvatarCache *self,
+    const gchar *token,
+    gint width,
+    gint height,
+    gboolean rounded,
+    GdkPixbuf *pixbuf);
+
+gsize empathy_avatar_cache_get_size (EmpathyAvatarCache *self);
+
+void empathy_avatar_cache_get_stats (EmpathyAvatarCache *self,
+    guint *hits,
+    guint *misses);
+
+G_END_DECLS
+
+#endif /* #ifndef __EMPATHY_AVATAR_CACHE_H__*/
@@ -40,6 +40,7 @@
 
 #include "empathy-client-factory.h"
 #include "empathy-gsettings.h"
+#include "empathy-highlight-matcher.h"
 #include "empathy-individual-information-dialog.h"
 #include "empathy-individual-store-channel.h"
 #include "empathy-individual-view.h"
@@ -57,6 +58,18 @@
 
 #define IS_ENTER(v) (v == GDK_KEY_Return || v == GDK_KEY_ISO_Enter || v == GDK_KEY_KP_Enter)
 #define COMPOSING_STOP_TIMEOUT 5
+/* Insertions longer than this are spell checked in the background */
+#define SPELL_CHECK_SYNC_MAX_LEN 64
+/* Number of words re-tagged per main loop iteration */
+#define SPELL_CHECK_CHUNK_WORDS 256
+/* Number of log events shown when opening a chat */
+#define HISTORY_FIRST_PAGE_SIZE 20
+/* Number of log events fetched each time the user scrolls close to the top */
+#define HISTORY_PAGE_SIZE 50
+/* Membership changes are gathered for this long (in ms) before being shown */
+#define MEMBER_EVENTS_DELAY 500
+/* Above this many membership lines per second they are shown as summaries */
+#define MEMBER_EVENTS_MAX_PER_SECOND 10
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyChat)
 struct _EmpathyChatPriv {
@@ -74,23 +87,43 @@ struct _EmpathyChatPriv {
 
 	TplLogManager     *log_manager;
 	TplLogWalker      *log_walker;
-	/* Are we watching for scrolling movements? */
-	gboolean           watch_scroll;
-	/* Maximum page size of the chat->view. */
-	guint              max_page_size;
-	/* The offset from the lower edge of the chat->view before it
-	 * expanded to fit in the newly fetched logs. This is to
-	 * restore the chat->view to the page it was on before the
-	 * latest batch of logs were inserted. */
-	guint              scroll_offset;
+	TplEntity         *log_target;
+	/* When the view pruned its oldest messages, the timestamp and token
+	 * of the oldest message still displayed. log_walker then only returns
+	 * events older than that, so pruned messages can be shown again
+	 * when scrolling back. 0 if nothing has been pruned. */
+	gint64             log_walker_before;
+	gchar             *log_walker_before_token;
+	/* TRUE once log_walker went past the oldest message still displayed,
+	 * the next events sharing its timestamp were pruned */
+	gboolean           log_walker_before_seen;
+	/* TRUE if the view was pruned while log_walker was fetching, the
+	 * walker is created again once the fetch is done */
+	gboolean           log_walker_stale;
+	/* TRUE while fetching history requested by scrolling back */
+	gboolean           fetching_history;
+	/* Tokens and ChatLogKey of the pending messages, so chat_log_filter()
+	 * can skip them. Built on the first event of each fetch. */
+	GHashTable        *pending_tokens;
+	GHashTable        *pending_keys;
 
 	TpAccountManager  *account_manager;
 	GList             *input_history;
 	GList             *input_history_current;
 	GList             *compositors;
-	GCompletion       *completion;
+	/* ChatCompletionItem sorted by key, built on first completion then
+	 * kept up to date with the members of the chat */
+	GArray            *completion_items;
+	gboolean           completion_ready;
 	guint              composing_stop_timeout_id;
 	guint              block_events_timeout_id;
+	/* ChatMemberEvent waiting to be shown by chat_flush_member_events() */
+	GPtrArray         *member_events;
+	guint              member_events_flush_id;
+	/* Start of the current one second window (monotonic time) and number
+	 * of membership lines shown in it */
+	gint64             member_events_window;
+	guint              member_events_shown;
 	TpHandleType       handle_type;
 	gint               contacts_width;
 	gboolean           has_input_vscroll;
@@ -107,10 +140,19 @@ struct _EmpathyChatPriv {
 
 	/* Source func ID for update_misspelled_words () */
 	guint              update_misspelled_words_id;
+	/* TRUE if the text between the "spell-dirty-start" and
+	 * "spell-dirty-end" marks still has to be spell checked */
+	gboolean           spell_dirty;
+	/* Source func ID for chat_spell_check_dirty_cb () */
+	guint              spell_check_id;
+	/* Set while words of the dirty range are checked in a thread */
+	GCancellable      *spell_cancellable;
 	/* Source func ID for save_paned_pos_timeout () */
 	guint              save_paned_pos_id;
 	/* Source func ID for chat_contacts_visible_timeout_cb () */
 	guint              contacts_visible_id;
+	/* Source func ID for chat_hibernate_timeout_cb () */
+	guint              hibernate_id;
 
 	GtkWidget         *widget;
 	GtkWidget         *hpaned;
@@ -157,9 +199,10 @@ struct _EmpathyChatPriv {
 	 * event, because it will be a notify event. Instead we track it here */
 	GdkEventType       most_recent_event_type;
 
-	/* A regex matching our own current nickname in the room, or %NULL if
-	 * !empathy_chat_is_room (). */
-	GRegex            *highlight_regex;
+	/* Matches our own current nickname in the room and the highlight
+	 * keywords, or %NULL if !empathy_chat_is_room (). Shared with the
+	 * other rooms of the account where we have the same nickname. */
+	EmpathyHighlightMatcher *highlight_matcher;
 
 	/* TRUE if empathy_chat_is_room () and there are unread highlighted messages.
 	 * Cleared by empathy_chat_messages_read (). */
@@ -198,11 +241,19 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 G_DEFINE_TYPE (EmpathyChat, empathy_chat, GTK_TYPE_BOX);
 
-#if 0
-/* FIXME: We need to figure out how to fill backlog automatically with WebKit2 */
-static gboolean chat_scrollable_connect (gpointer user_data);
-#endif
 static gboolean update_misspelled_words (gpointer data);
+static void chat_flush_member_events (EmpathyChat *chat,
+				      gboolean     force);
+
+/* Status events are shown after the membership changes which came before
+ * them, see chat_flush_member_events() */
+static void
+chat_append_event (EmpathyChat *chat,
+		   const gchar *str)
+{
+	chat_flush_member_events (chat, TRUE);
+	empathy_theme_adium_append_event (chat->view, str);
+}
 
 static void
 chat_get_property (GObject    *object,
@@ -728,7 +779,7 @@ chat_command_msg_cb (GObject *source,
 		DEBUG ("Failed to get channel: %s", error->message);
 		g_error_free (error);
 
-		empathy_theme_adium_append_event (data->chat->view,
+		chat_append_event (data->chat,
 			_("Failed to open private chat"));
 		goto OUT;
 	}
@@ -786,13 +837,13 @@ chat_command_topic (EmpathyChat *chat,
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 
 	if (!empathy_tp_chat_supports_subject (priv->tp_chat)) {
-		empathy_theme_adium_append_event (chat->view,
+		chat_append_event (chat,
 			_("Topic not supported on this conversation"));
 		return;
 	}
 
 	if (!empathy_tp_chat_can_set_subject (priv->tp_chat)) {
-		empathy_theme_adium_append_event (chat->view,
+		chat_append_event (chat,
 			_("You are not allowed to change the topic"));
 		return;
 	}
@@ -964,7 +1015,7 @@ whois_got_contact_cb (GObject *source,
 		EMPATHY_CLIENT_FACTORY (source), result, NULL);
 
 	if (contact == NULL) {
-		empathy_theme_adium_append_event (chat->view, _("Invalid contact ID"));
+		chat_append_event (chat, _("Invalid contact ID"));
 		goto out;
 	}
 
@@ -1108,7 +1159,7 @@ chat_command_show_help (EmpathyChat     *chat,
 	}
 
 	str = g_strdup_printf (_("Usage: %s"), _(item->help));
-	empathy_theme_adium_append_event (chat->view, str);
+	chat_append_event (chat, str);
 	g_free (str);
 }
 
@@ -1130,7 +1181,7 @@ chat_command_help (EmpathyChat *chat,
 			if (commands[i].help == NULL) {
 				continue;
 			}
-			empathy_theme_adium_append_event (chat->view,
+			chat_append_event (chat,
 				_(commands[i].help));
 		}
 		return;
@@ -1151,7 +1202,7 @@ chat_command_help (EmpathyChat *chat,
 		}
 	}
 
-	empathy_theme_adium_append_event (chat->view,
+	chat_append_event (chat,
 		_("Unknown command"));
 }
 
@@ -1277,7 +1328,7 @@ chat_send (EmpathyChat  *chat,
 		}
 
 		if (!second_slash) {
-			empathy_theme_adium_append_event (chat->view,
+			chat_append_event (chat,
 				_("Unknown command; see /help for the available"
 				  " commands"));
 			return;
@@ -1378,46 +1429,25 @@ out:
 	g_object_unref (contact);
 }
 
-static GRegex *
-get_highlight_regex_for (const gchar *name)
-{
-	GRegex *regex;
-	gchar *name_esc, *pattern;
-	GError *error = NULL;
-
-	name_esc = g_regex_escape_string (name, -1);
-	pattern = g_strdup_printf ("\\b%s\\b", name_esc);
-	regex = g_regex_new (pattern, G_REGEX_CASELESS | G_REGEX_OPTIMIZE, 0,
-		&error);
-
-	if (regex == NULL) {
-		DEBUG ("couldn't compile regex /%s/: %s", pattern,
-			error->message);
-
-		g_error_free (error);
-	}
-
-	g_free (pattern);
-	g_free (name_esc);
-
-	return regex;
-}
-
 /* Called when priv->self_contact changes, or priv->self_contact:alias changes.
  * Only connected if empathy_chat_is_room() is TRUE, for obvious-ish reasons.
+ * Also called when priv->account:nickname changes.
  */
 static void
 chat_self_contact_alias_changed_cb (EmpathyChat *chat)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 
-	tp_clear_pointer (&priv->highlight_regex, g_regex_unref);
+	tp_clear_pointer (&priv->highlight_matcher,
+			  empathy_highlight_matcher_unref);
 
-	if (priv->self_contact != NULL) {
+	if (priv->self_contact != NULL && priv->account != NULL) {
 		const gchar *alias = empathy_contact_get_alias (priv->self_contact);
 
 		g_return_if_fail (alias != NULL);
-		priv->highlight_regex = get_highlight_regex_for (alias);
+		priv->highlight_matcher =
+			empathy_highlight_matcher_dup_for_account (priv->account,
+								   alias);
 	}
 }
 
@@ -1449,11 +1479,11 @@ chat_should_highlight (EmpathyChat *chat,
 		return FALSE;
 	}
 
-	if (priv->highlight_regex == NULL) {
+	if (priv->highlight_matcher == NULL) {
 		return FALSE;
 	}
 
-	return g_regex_match (priv->highlight_regex, msg, 0, NULL);
+	return empathy_highlight_matcher_match (priv->highlight_matcher, msg);
 }
 
 static void
@@ -1464,6 +1494,9 @@ chat_message_received (EmpathyChat *chat,
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 	EmpathyContact  *sender;
 
+	/* Keep membership changes in order with the conversation */
+	chat_flush_member_events (chat, TRUE);
+
 	sender = empathy_message_get_sender (message);
 
 	if (empathy_message_is_edit (message)) {
@@ -1570,10 +1603,12 @@ append_balance_error (EmpathyChat *chat,
 		g_free (markup_error);
 	}
 
+	chat_flush_member_events (chat, TRUE);
+
 	if (str_markup != NULL)
 		empathy_theme_adium_append_event_markup (chat->view, str_markup, str);
 	else
-		empathy_theme_adium_append_event (chat->view, str);
+		chat_append_event (chat, str);
 
 	g_free (str);
 	g_free (str_markup);
@@ -1629,7 +1664,7 @@ chat_send_error_cb (EmpathyTpChat          *tp_chat,
 			str = g_strdup_printf (_("Error sending message: %s"), error);
 	}
 
-	empathy_theme_adium_append_event (chat->view, str);
+	chat_append_event (chat, str);
 	g_free (str);
 }
 
@@ -1709,7 +1744,7 @@ chat_subject_changed_cb (EmpathyChat *chat)
 			}
 
 			if (str != NULL) {
-				empathy_theme_adium_append_event (EMPATHY_CHAT (chat)->view, str);
+				chat_append_event (EMPATHY_CHAT (chat), str);
 				g_free (str);
 			}
 		}
@@ -1774,6 +1809,207 @@ chat_input_text_get_word_from_iter (GtkTextIter   *iter,
 	return TRUE;
 }
 
+static void chat_spell_check_dirty (EmpathyChat *chat,
+				    gboolean     use_thread);
+
+static gboolean
+chat_spell_check_dirty_cb (gpointer data)
+{
+	EmpathyChat *chat = EMPATHY_CHAT (data);
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	priv->spell_check_id = 0;
+	chat_spell_check_dirty (chat, TRUE);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+chat_spell_words_checked_cb (GObject      *source,
+			     GAsyncResult *result,
+			     gpointer      user_data)
+{
+	EmpathyChat *chat;
+	EmpathyChatPriv *priv;
+	GError *error = NULL;
+
+	if (!empathy_spell_check_words_finish (result, &error)) {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			/* The chat may be gone */
+			g_error_free (error);
+			return;
+		}
+
+		DEBUG ("Failed to check words: %s", error->message);
+		g_error_free (error);
+	}
+
+	chat = EMPATHY_CHAT (user_data);
+	priv = GET_PRIV (chat);
+	tp_clear_object (&priv->spell_cancellable);
+
+	/* The verdicts are cached now, anything still unknown (pushed out of
+	 * the cache in the meantime) is checked right away */
+	chat_spell_check_dirty (chat, FALSE);
+}
+
+/* Re-tag the words of the dirty range, a chunk at a time. Words that were
+ * never checked are sent to a thread if @use_thread, and the range is
+ * re-tagged from the first of them once they are done. */
+static void
+chat_spell_check_dirty (EmpathyChat *chat,
+			gboolean     use_thread)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GtkTextBuffer *buffer;
+	GtkTextMark *start_mark;
+	GtkTextIter iter, end, pos, first_unknown;
+	GHashTable *unknown;
+	guint n_words = 0;
+
+	if (!priv->spell_dirty || priv->spell_cancellable != NULL)
+		return;
+
+	buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (chat->input_text_view));
+	start_mark = gtk_text_buffer_get_mark (buffer, "spell-dirty-start");
+	gtk_text_buffer_get_iter_at_mark (buffer, &iter, start_mark);
+	gtk_text_buffer_get_iter_at_mark (buffer, &end,
+		gtk_text_buffer_get_mark (buffer, "spell-dirty-end"));
+	gtk_text_buffer_get_iter_at_mark (buffer, &pos,
+		gtk_text_buffer_get_insert (buffer));
+
+	unknown = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	first_unknown = iter;
+
+	do {
+		GtkTextIter start, word_end;
+		gboolean correct;
+		gchar *str;
+
+		if (!chat_input_text_get_word_from_iter (&iter, &start, &word_end))
+			continue;
+
+		n_words++;
+		str = gtk_text_buffer_get_text (buffer, &start, &word_end, FALSE);
+
+		if (gtk_text_iter_in_range (&pos, &start, &word_end) ||
+				gtk_text_iter_equal (&pos, &word_end)) {
+			correct = TRUE;
+		} else if (!empathy_spell_check_cached (str, &correct)) {
+			if (use_thread) {
+				if (g_hash_table_size (unknown) == 0)
+					first_unknown = start;
+
+				g_hash_table_add (unknown, str);
+				continue;
+			}
+
+			correct = empathy_spell_check (str);
+		}
+
+		if (correct) {
+			gtk_text_buffer_remove_tag_by_name (buffer, "misspelled", &start, &word_end);
+		} else {
+			gtk_text_buffer_apply_tag_by_name (buffer, "misspelled", &start, &word_end);
+		}
+
+		g_free (str);
+
+	} while (n_words < SPELL_CHECK_CHUNK_WORDS &&
+		 gtk_text_iter_forward_word_end (&iter) &&
+		 gtk_text_iter_compare (&iter, &end) <= 0);
+
+	if (g_hash_table_size (unknown) > 0) {
+		GPtrArray *words;
+		GHashTableIter hash_iter;
+		gpointer word;
+
+		/* Everything before the first unknown word is up to date */
+		gtk_text_buffer_move_mark (buffer, start_mark, &first_unknown);
+
+		words = g_ptr_array_new ();
+		g_hash_table_iter_init (&hash_iter, unknown);
+		while (g_hash_table_iter_next (&hash_iter, &word, NULL))
+			g_ptr_array_add (words, word);
+		g_ptr_array_add (words, NULL);
+
+		priv->spell_cancellable = g_cancellable_new ();
+		empathy_spell_check_words_async (
+			(const gchar * const *) words->pdata,
+			priv->spell_cancellable, chat_spell_words_checked_cb,
+			chat);
+
+		g_ptr_array_unref (words);
+	} else if (n_words == SPELL_CHECK_CHUNK_WORDS &&
+		   gtk_text_iter_compare (&iter, &end) < 0) {
+		gtk_text_buffer_move_mark (buffer, start_mark, &iter);
+
+		if (priv->spell_check_id == 0)
+			priv->spell_check_id = g_idle_add (
+				chat_spell_check_dirty_cb, chat);
+	} else {
+		priv->spell_dirty = FALSE;
+	}
+
+	g_hash_table_unref (unknown);
+}
+
+static void
+chat_spell_cancel (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	if (priv->spell_cancellable != NULL) {
+		g_cancellable_cancel (priv->spell_cancellable);
+		tp_clear_object (&priv->spell_cancellable);
+	}
+
+	if (priv->spell_check_id != 0) {
+		g_source_remove (priv->spell_check_id);
+		priv->spell_check_id = 0;
+	}
+
+	priv->spell_dirty = FALSE;
+}
+
+/* Add [@start, @end] to the range re-tagged by chat_spell_check_dirty () */
+static void
+chat_spell_mark_dirty (EmpathyChat *chat,
+		       GtkTextIter *start,
+		       GtkTextIter *end)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GtkTextBuffer *buffer;
+	GtkTextMark *start_mark, *end_mark;
+
+	if (!priv->spell_checking_enabled)
+		return;
+
+	buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (chat->input_text_view));
+	start_mark = gtk_text_buffer_get_mark (buffer, "spell-dirty-start");
+	end_mark = gtk_text_buffer_get_mark (buffer, "spell-dirty-end");
+
+	if (priv->spell_dirty) {
+		GtkTextIter dirty_start, dirty_end;
+
+		gtk_text_buffer_get_iter_at_mark (buffer, &dirty_start, start_mark);
+		gtk_text_buffer_get_iter_at_mark (buffer, &dirty_end, end_mark);
+
+		if (gtk_text_iter_compare (&dirty_start, start) < 0)
+			start = &dirty_start;
+		if (gtk_text_iter_compare (&dirty_end, end) > 0)
+			end = &dirty_end;
+	}
+
+	gtk_text_buffer_move_mark (buffer, start_mark, start);
+	gtk_text_buffer_move_mark (buffer, end_mark, end);
+	priv->spell_dirty = TRUE;
+
+	if (priv->spell_check_id == 0 && priv->spell_cancellable == NULL)
+		priv->spell_check_id = g_idle_add (chat_spell_check_dirty_cb,
+						   chat);
+}
+
 static void
 chat_input_text_buffer_insert_text_cb (GtkTextBuffer *buffer,
                                        GtkTextIter   *location,
@@ -1790,6 +2026,12 @@ chat_input_text_buffer_insert_text_cb (GtkTextBuffer *buffer,
 	gtk_text_buffer_remove_tag_by_name (buffer, "misspelled",
 					    &iter, location);
 
+	/* Don't block typing on big pastes */
+	if (len > SPELL_CHECK_SYNC_MAX_LEN) {
+		chat_spell_mark_dirty (chat, &iter, location);
+		return;
+	}
+
 	gtk_text_buffer_get_iter_at_mark (buffer, &pos, gtk_text_buffer_get_insert (buffer));
 
 	do {
@@ -1888,6 +2130,259 @@ empathy_isspace_cb (gunichar c,
 	return g_unichar_isspace (c);
 }
 
+typedef struct {
+	gchar          *key; /* Normalized and casefolded alias */
+	EmpathyContact *contact;
+} ChatCompletionItem;
+
+static gchar *
+chat_completion_key_new (const gchar *str)
+{
+	gchar *tmp, *key;
+
+	tmp = g_utf8_normalize (str, -1, G_NORMALIZE_DEFAULT);
+	key = g_utf8_casefold (tmp, -1);
+	g_free (tmp);
+
+	return key;
+}
+
+/* Returns the index of the first item whose key is >= key */
+static guint
+chat_completion_lower_bound (EmpathyChat *chat,
+			     const gchar *key)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	guint            low = 0;
+	guint            high = priv->completion_items->len;
+
+	while (low < high) {
+		guint mid = (low + high) / 2;
+		ChatCompletionItem *item = &g_array_index (priv->completion_items,
+							   ChatCompletionItem,
+							   mid);
+
+		if (strcmp (item->key, key) < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+static void chat_completion_alias_changed_cb (EmpathyContact *contact,
+					      GParamSpec     *pspec,
+					      EmpathyChat    *chat);
+
+static void
+chat_completion_remove (EmpathyChat    *chat,
+			EmpathyContact *contact)
+{
+	EmpathyChatPriv    *priv = GET_PRIV (chat);
+	ChatCompletionItem *item = NULL;
+	gchar              *key;
+	guint               i;
+
+	if (!priv->completion_ready) {
+		return;
+	}
+
+	key = chat_completion_key_new (empathy_contact_get_alias (contact));
+
+	for (i = chat_completion_lower_bound (chat, key);
+	     i < priv->completion_items->len; i++) {
+		item = &g_array_index (priv->completion_items,
+				       ChatCompletionItem, i);
+		if (item->contact == contact || strcmp (item->key, key) != 0) {
+			break;
+		}
+	}
+
+	/* The alias changed since the contact was indexed */
+	if (i == priv->completion_items->len || item->contact != contact) {
+		for (i = 0; i < priv->completion_items->len; i++) {
+			item = &g_array_index (priv->completion_items,
+					       ChatCompletionItem, i);
+			if (item->contact == contact) {
+				break;
+			}
+		}
+	}
+
+	g_free (key);
+
+	if (i == priv->completion_items->len) {
+		return;
+	}
+
+	g_signal_handlers_disconnect_by_func (contact,
+					      chat_completion_alias_changed_cb,
+					      chat);
+	g_free (item->key);
+	g_object_unref (item->contact);
+	g_array_remove_index (priv->completion_items, i);
+}
+
+static void
+chat_completion_add (EmpathyChat    *chat,
+		     EmpathyContact *contact)
+{
+	EmpathyChatPriv    *priv = GET_PRIV (chat);
+	ChatCompletionItem  item;
+
+	if (!priv->completion_ready) {
+		return;
+	}
+
+	/* Don't index the same contact twice */
+	chat_completion_remove (chat, contact);
+
+	item.key = chat_completion_key_new (empathy_contact_get_alias (contact));
+	item.contact = g_object_ref (contact);
+	g_array_insert_val (priv->completion_items,
+			    chat_completion_lower_bound (chat, item.key),
+			    item);
+
+	g_signal_connect (contact, "notify::alias",
+			  G_CALLBACK (chat_completion_alias_changed_cb),
+			  chat);
+}
+
+static void
+chat_completion_alias_changed_cb (EmpathyContact *contact,
+				  GParamSpec     *pspec,
+				  EmpathyChat    *chat)
+{
+	chat_completion_add (chat, contact);
+}
+
+static void
+chat_completion_clear (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	guint            i;
+
+	for (i = 0; i < priv->completion_items->len; i++) {
+		ChatCompletionItem *item = &g_array_index (priv->completion_items,
+							   ChatCompletionItem,
+							   i);
+
+		g_signal_handlers_disconnect_by_func (item->contact,
+						      chat_completion_alias_changed_cb,
+						      chat);
+		g_free (item->key);
+		g_object_unref (item->contact);
+	}
+
+	g_array_set_size (priv->completion_items, 0);
+	priv->completion_ready = FALSE;
+}
+
+static gint
+chat_completion_item_compare (gconstpointer a,
+			      gconstpointer b)
+{
+	const ChatCompletionItem *item_a = a;
+	const ChatCompletionItem *item_b = b;
+
+	return strcmp (item_a->key, item_b->key);
+}
+
+static void
+chat_completion_ensure (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GList           *members, *l;
+
+	if (priv->completion_ready || priv->tp_chat == NULL) {
+		return;
+	}
+
+	members = empathy_tp_chat_get_members (priv->tp_chat);
+	for (l = members; l != NULL; l = l->next) {
+		ChatCompletionItem item;
+
+		item.key = chat_completion_key_new (
+			empathy_contact_get_alias (l->data));
+		/* Steal the reference */
+		item.contact = l->data;
+		g_array_append_val (priv->completion_items, item);
+
+		g_signal_connect (item.contact, "notify::alias",
+				  G_CALLBACK (chat_completion_alias_changed_cb),
+				  chat);
+	}
+	g_list_free (members);
+
+	g_array_sort (priv->completion_items, chat_completion_item_compare);
+	priv->completion_ready = TRUE;
+}
+
+/* Returns the members whose alias starts with prefix, ignoring case. If
+ * there is any, completed is set to prefix followed by the longest common
+ * part of their aliases after it, like GCompletion does. */
+static GList *
+chat_completion_complete (EmpathyChat  *chat,
+			  const gchar  *prefix,
+			  gchar       **completed)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GList           *list = NULL;
+	gchar           *key;
+	const gchar     *common = NULL;
+	gsize            common_len = 0;
+	gsize            prefix_len = strlen (prefix);
+	guint            i;
+
+	*completed = NULL;
+
+	chat_completion_ensure (chat);
+
+	key = chat_completion_key_new (prefix);
+
+	for (i = chat_completion_lower_bound (chat, key);
+	     i < priv->completion_items->len; i++) {
+		ChatCompletionItem *item = &g_array_index (priv->completion_items,
+							   ChatCompletionItem,
+							   i);
+		const gchar        *alias;
+
+		if (!g_str_has_prefix (item->key, key)) {
+			break;
+		}
+
+		alias = empathy_contact_get_alias (item->contact);
+		alias += MIN (prefix_len, strlen (alias));
+		if (common == NULL) {
+			common = alias;
+			common_len = strlen (alias);
+		} else {
+			gsize j;
+
+			for (j = 0; j < common_len && common[j] == alias[j]; j++);
+			common_len = j;
+		}
+
+		list = g_list_prepend (list, item->contact);
+	}
+
+	g_free (key);
+
+	if (common != NULL) {
+		/* Don't cut an UTF-8 character */
+		while (common_len > 0 &&
+		       (common[common_len] & 0xc0) == 0x80) {
+			common_len--;
+		}
+		*completed = g_strdup_printf ("%s%.*s", prefix,
+					      (int) common_len, common);
+	}
+
+	return g_list_reverse (list);
+}
+
 static gboolean
 chat_input_key_press_event_cb (GtkWidget   *widget,
 			       GdkEventKey *event,
@@ -1979,7 +2474,7 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 		GtkTextBuffer *buffer;
 		GtkTextIter    start, current;
 		gchar         *nick, *completed;
-		GList         *list, *completed_list;
+		GList         *completed_list;
 		gboolean       is_start_of_buffer;
 
 		buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (EMPATHY_CHAT (chat)->input_text_view));
@@ -1992,13 +2487,9 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 		}
 		is_start_of_buffer = gtk_text_iter_is_start (&start);
 
-		list = empathy_tp_chat_get_members (priv->tp_chat);
-		g_completion_add_items (priv->completion, list);
-
 		nick = gtk_text_buffer_get_text (buffer, &start, &current, FALSE);
-		completed_list = g_completion_complete (priv->completion,
-							nick,
-							&completed);
+		completed_list = chat_completion_complete (chat, nick,
+							   &completed);
 
 		g_free (nick);
 
@@ -2032,7 +2523,7 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 					g_string_append (message, empathy_contact_get_alias (l->data));
 					g_string_append (message, " - ");
 				 }
-				 empathy_theme_adium_append_event (chat->view, message->str);
+				 chat_append_event (chat, message->str);
 				 g_string_free (message, TRUE);
 			}
 
@@ -2057,10 +2548,7 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 			g_free (completed);
 		}
 
-		g_completion_clear_items (priv->completion);
-
-		g_list_foreach (list, (GFunc) g_object_unref, NULL);
-		g_list_free (list);
+		g_list_free (completed_list);
 
 		return TRUE;
 	}
@@ -2499,73 +2987,162 @@ chat_input_populate_popup_cb (GtkTextView *view,
 }
 
 
-static gboolean
-chat_log_filter (TplEvent *event,
-		 gpointer user_data)
-{
-	EmpathyChat *chat = EMPATHY_CHAT (user_data);
-	EmpathyChatPriv *priv = GET_PRIV (chat);
-	EmpathyMessage *message;
-	const GList *pending;
-	bool retval = FALSE;
+/* What empathy_message_equal() compares */
+typedef struct {
+	gint64 timestamp;
+	guint body_hash;
+	gchar *body;
+} ChatLogKey;
 
-	g_return_val_if_fail (TPL_IS_EVENT (event), FALSE);
-	g_return_val_if_fail (EMPATHY_IS_CHAT (chat), FALSE);
+static guint
+chat_log_key_hash (gconstpointer key)
+{
+	const ChatLogKey *k = key;
 
-	pending = empathy_tp_chat_get_pending_messages (priv->tp_chat);
-	message = empathy_message_from_tpl_log_event (event);
+	return k->body_hash ^ g_int64_hash (&k->timestamp);
+}
 
-	for (; pending; pending = g_list_next (pending)) {
-		if (empathy_message_equal (message, pending->data))
-			goto out;
-	}
+static gboolean
+chat_log_key_equal (gconstpointer a,
+		    gconstpointer b)
+{
+	const ChatLogKey *k1 = a;
+	const ChatLogKey *k2 = b;
 
-	retval = TRUE;
+	return k1->timestamp == k2->timestamp &&
+	       k1->body_hash == k2->body_hash &&
+	       !tp_strdiff (k1->body, k2->body);
+}
 
-out:
-	g_object_unref (message);
-	return retval;
+static void
+chat_log_key_free (ChatLogKey *key)
+{
+	g_free (key->body);
+	g_slice_free (ChatLogKey, key);
 }
 
 static void
-show_pending_messages (EmpathyChat *chat) {
+chat_ensure_pending_index (EmpathyChat *chat)
+{
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	const GList *messages, *l;
+	const GList *l;
 
-	g_return_if_fail (EMPATHY_IS_CHAT (chat));
-	g_return_if_fail (chat->view != NULL);
-	g_return_if_fail (priv->tp_chat != NULL);
+	if (priv->pending_keys != NULL)
+		return;
 
-	messages = empathy_tp_chat_get_pending_messages (priv->tp_chat);
+	priv->pending_tokens = g_hash_table_new_full (g_str_hash, g_str_equal,
+						      g_free, NULL);
+	priv->pending_keys = g_hash_table_new_full (chat_log_key_hash,
+						    chat_log_key_equal,
+						    (GDestroyNotify) chat_log_key_free,
+						    NULL);
 
-	for (l = messages; l != NULL ; l = g_list_next (l)) {
-		EmpathyMessage *message = EMPATHY_MESSAGE (l->data);
-		chat_message_received (chat, message, TRUE);
+	if (priv->tp_chat == NULL)
+		return;
+
+	l = empathy_tp_chat_get_pending_messages (priv->tp_chat);
+	for (; l != NULL; l = g_list_next (l)) {
+		EmpathyMessage *message = l->data;
+		const gchar *token = empathy_message_get_token (message);
+		const gchar *body = empathy_message_get_body (message);
+		ChatLogKey *key;
+
+		if (!tp_str_empty (token))
+			g_hash_table_add (priv->pending_tokens,
+					  g_strdup (token));
+
+		key = g_slice_new (ChatLogKey);
+		key->timestamp = empathy_message_get_timestamp (message);
+		key->body = g_strdup (body);
+		key->body_hash = body != NULL ? g_str_hash (body) : 0;
+		g_hash_table_add (priv->pending_keys, key);
 	}
 }
 
-#if 0
-/* FIXME: We need to figure out how to fill backlog automatically with WebKit2 */
+static void
+chat_clear_pending_index (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	tp_clear_pointer (&priv->pending_tokens, g_hash_table_unref);
+	tp_clear_pointer (&priv->pending_keys, g_hash_table_unref);
+}
+
 static gboolean
-chat_scrollable_set_value (gpointer user_data)
+chat_log_filter (TplEvent *event,
+		 gpointer user_data)
 {
 	EmpathyChat *chat = EMPATHY_CHAT (user_data);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	GtkAdjustment *adjustment;
-	guint upper;
+	TplTextEvent *text_event;
+	const gchar *token;
+	ChatLogKey key;
 
-	adjustment = gtk_scrollable_get_vadjustment (
-	    GTK_SCROLLABLE (chat->view));
+	g_return_val_if_fail (TPL_IS_EVENT (event), FALSE);
+	g_return_val_if_fail (EMPATHY_IS_CHAT (chat), FALSE);
 
-	/* Set the chat->view's adjustment back to the value it had
-	 * before it grew as a result of new logs being inserted.
-	 */
-	upper  = (guint) gtk_adjustment_get_upper (adjustment);
-	gtk_adjustment_set_value (adjustment, upper - priv->scroll_offset);
+	/* Only text events are walked, see chat_create_log_walker() */
+	if (!TPL_IS_TEXT_EVENT (event))
+		return TRUE;
 
-	return G_SOURCE_REMOVE;
+	text_event = TPL_TEXT_EVENT (event);
+	token = tpl_text_event_get_message_token (text_event);
+
+	/* Still displayed in the view. Events are walked from the newest, so
+	 * the ones sharing the timestamp of the oldest message displayed are
+	 * displayed too until we reach that message. */
+	if (priv->log_walker_before != 0 && !priv->log_walker_before_seen) {
+		gint64 timestamp = tpl_event_get_timestamp (event);
+
+		if (timestamp > priv->log_walker_before)
+			return FALSE;
+
+		if (timestamp == priv->log_walker_before) {
+			if (!tp_str_empty (token) &&
+			    !tp_strdiff (token, priv->log_walker_before_token))
+				priv->log_walker_before_seen = TRUE;
+
+			return FALSE;
+		}
+
+		priv->log_walker_before_seen = TRUE;
+	}
+
+	chat_ensure_pending_index (chat);
+
+	/* Skip the messages which will be shown as pending. The timestamp is
+	 * the one empathy_message_from_tpl_log_event() would use. */
+	if (!tp_str_empty (token) &&
+	    g_hash_table_contains (priv->pending_tokens, token))
+		return FALSE;
+
+	if (tp_str_empty (tpl_text_event_get_supersedes_token (text_event)))
+		key.timestamp = tpl_event_get_timestamp (event);
+	else
+		key.timestamp = tpl_text_event_get_edit_timestamp (text_event);
+
+	key.body = (gchar *) tpl_text_event_get_message (text_event);
+	key.body_hash = key.body != NULL ? g_str_hash (key.body) : 0;
+
+	return !g_hash_table_contains (priv->pending_keys, &key);
+}
+
+static void
+show_pending_messages (EmpathyChat *chat) {
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	const GList *messages, *l;
+
+	g_return_if_fail (EMPATHY_IS_CHAT (chat));
+	g_return_if_fail (chat->view != NULL);
+	g_return_if_fail (priv->tp_chat != NULL);
+
+	messages = empathy_tp_chat_get_pending_messages (priv->tp_chat);
+
+	for (l = messages; l != NULL ; l = g_list_next (l)) {
+		EmpathyMessage *message = EMPATHY_MESSAGE (l->data);
+		chat_message_received (chat, message, TRUE);
+	}
 }
-#endif
 
 static void
 got_filtered_messages_cb (GObject *walker,
@@ -2578,15 +3155,31 @@ got_filtered_messages_cb (GObject *walker,
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 	GError *error = NULL;
 
+	/* The next fetch indexes the pending messages again */
+	chat_clear_pending_index (chat);
+
 	if (!tpl_log_walker_get_events_finish (TPL_LOG_WALKER (walker),
 		result, &messages, &error)) {
 		DEBUG ("%s. Aborting.", error->message);
-		empathy_theme_adium_append_event (chat->view,
+		chat_append_event (chat,
 			_("Failed to retrieve recent logs"));
 		g_error_free (error);
 		goto out;
 	}
 
+	if (priv->log_walker_stale) {
+		/* The view was pruned meanwhile, these messages are older
+		 * than the ones we'll fetch again */
+		DEBUG ("Dropping %u events fetched before pruning",
+		       g_list_length (messages));
+		g_list_free_full (messages, g_object_unref);
+		goto out;
+	}
+
+	/* Prepend the whole page at once, keeping the messages the user is
+	 * reading where they are */
+	empathy_theme_adium_begin_prepend (chat->view);
+
 	for (l = g_list_last (messages); l; l = g_list_previous (l)) {
 		EmpathyMessage *message;
 
@@ -2627,7 +3220,22 @@ got_filtered_messages_cb (GObject *walker,
 	}
 	g_list_free (messages);
 
+	empathy_theme_adium_end_prepend (chat->view);
+
 out:
+	if (priv->log_walker_stale) {
+		priv->log_walker_stale = FALSE;
+		chat_create_log_walker (chat);
+	}
+
+	if (priv->fetching_history) {
+		/* The user is reading history, don't touch the
+		 * scrolling or the pending messages */
+		priv->fetching_history = FALSE;
+		g_object_unref (chat);
+		return;
+	}
+
 	/* FIXME: See Bug#610994, we are forcing the ACK of the queue. See comments
 	 * about it in EmpathyChatPriv definition */
 	priv->retrieving_backlogs = FALSE;
@@ -2636,41 +3244,6 @@ out:
 	/* Turn back on scrolling */
 	empathy_theme_adium_scroll (chat->view, TRUE);
 
-#if 0
-	/* FIXME: We need to figure out how to fill backlog automatically with WebKit2 */
-	/* We start watching the scrolling movements only after the first
-	 * batch of logs have been fetched. Otherwise, if the
-	 * chat->view's page size is too small the scrollbar might hit
-	 * the upper edge and trigger another batch of logs to be
-	 * fetched.
-	 */
-	if (G_UNLIKELY (!priv->watch_scroll &&
-			!tpl_log_walker_is_end (priv->log_walker))) {
-		priv->watch_scroll = TRUE;
-		g_idle_add_full (G_PRIORITY_LOW, chat_scrollable_connect,
-		    g_object_ref (chat), g_object_unref);
-	}
-	else {
-		GtkAdjustment *adjustment;
-		guint upper;
-		guint value;
-
-		/* The chat->view's adjustment won't change unless we
-		 * return to the main loop. Save the current offset
-		 * from the lower edge (or the upper value of the
-		 * adjustment) so that we can restore it later once the
-		 * adjustment grows.
-		 */
-		adjustment = gtk_scrollable_get_vadjustment (
-		    GTK_SCROLLABLE (chat->view));
-		upper = (guint) gtk_adjustment_get_upper (adjustment);
-		value = (guint) gtk_adjustment_get_value (adjustment);
-		priv->scroll_offset = upper - value;
-
-		g_idle_add_full (G_PRIORITY_LOW, chat_scrollable_set_value,
-		    g_object_ref (chat), g_object_unref);
-	}
-#endif
 	g_object_unref (chat);
 }
 
@@ -2686,127 +3259,73 @@ chat_add_logs (EmpathyChat *chat)
 	/* Turn off scrolling temporarily */
 	empathy_theme_adium_scroll (chat->view, FALSE);
 
-	tpl_log_walker_get_events_async (priv->log_walker, 5,
+	/* Older pages are fetched when scrolling up, see
+	 * chat_view_near_top_cb() */
+	priv->retrieving_backlogs = TRUE;
+	tpl_log_walker_get_events_async (priv->log_walker,
+	    HISTORY_FIRST_PAGE_SIZE,
 	    got_filtered_messages_cb, g_object_ref (chat));
 
 	return G_SOURCE_REMOVE;
 }
 
-#if 0
-/* FIXME: We need to figure out how to fill backlog automatically with WebKit2 */
 static void
-chat_schedule_logs (EmpathyChat *chat)
+chat_create_log_walker (EmpathyChat *chat)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 
-	if (priv->retrieving_backlogs)
-		return;
-
-	priv->retrieving_backlogs = TRUE;
-	g_timeout_add_full (G_PRIORITY_LOW, 500, /* ms */
-	    (GSourceFunc) chat_add_logs, g_object_ref (chat), g_object_unref);
+	tp_clear_object (&priv->log_walker);
+	priv->log_walker_before_seen = FALSE;
+	priv->log_walker = tpl_log_manager_walk_filtered_events (priv->log_manager,
+		priv->account, priv->log_target, TPL_EVENT_MASK_TEXT,
+		chat_log_filter, chat);
 }
 
 static void
-chat_view_adjustment_changed_cb (GtkAdjustment *adjustment,
-				 gpointer user_data)
+chat_view_pruned_cb (EmpathyThemeAdium *view,
+		     gint64             first_timestamp,
+		     const gchar       *first_token,
+		     EmpathyChat       *chat)
 {
-	EmpathyChat *chat = EMPATHY_CHAT (user_data);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	guint page_size;
 
-	if (tpl_log_walker_is_end (priv->log_walker)) {
-		g_signal_handlers_disconnect_by_func (adjustment,
-		    chat_view_adjustment_changed_cb, user_data);
-		return;
-	}
+	priv->log_walker_before = first_timestamp;
+	g_free (priv->log_walker_before_token);
+	priv->log_walker_before_token = g_strdup (first_token);
 
-	page_size = (guint) gtk_adjustment_get_page_size (adjustment);
-	if (page_size <= priv->max_page_size)
+	/* Don't mix the results of the walker being fetched with the new
+	 * one, see got_filtered_messages_cb() */
+	if (priv->retrieving_backlogs || priv->fetching_history) {
+		priv->log_walker_stale = TRUE;
 		return;
+	}
 
-	/* We need to fetch more logs if the page size of the view
-	 * increases, so that there is no empty space at the top.
-	 */
-	if (G_LIKELY (priv->max_page_size != 0))
-		chat_schedule_logs (chat);
-
-	priv->max_page_size = page_size;
+	/* Walk the logs again from the newest event, skipping everything
+	 * still in the view */
+	chat_create_log_walker (chat);
 }
 
 static void
-chat_view_adjustment_value_changed_cb (GtkAdjustment *adjustment,
-				       gpointer user_data)
+chat_view_near_top_cb (EmpathyThemeAdium *view,
+		       EmpathyChat       *chat)
 {
-	EmpathyChat *chat = EMPATHY_CHAT (user_data);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	guint lower;
-	guint value;
 
-	if (tpl_log_walker_is_end (priv->log_walker)) {
-		g_signal_handlers_disconnect_by_func (adjustment,
-		    chat_view_adjustment_value_changed_cb, user_data);
+	/* Rooms don't show their logs when opened, only bring back
+	 * messages pruned from the view */
+	if (priv->handle_type == TP_HANDLE_TYPE_ROOM &&
+	    priv->log_walker_before == 0)
 		return;
-	}
 
-	lower = (guint) gtk_adjustment_get_lower (adjustment);
-	value = (guint) gtk_adjustment_get_value (adjustment);
-	if (value != lower)
+	if (priv->retrieving_backlogs || priv->fetching_history)
 		return;
 
-	/* Request for more logs to be fetched if the user hit the
-	 * upper edge of the chat->view.
-	 */
-	chat_schedule_logs (chat);
-}
-
-static gboolean
-chat_scrollable_connect (gpointer user_data)
-{
-	EmpathyChat *chat = EMPATHY_CHAT (user_data);
-	GtkAdjustment *adjustment;
-
-	adjustment = gtk_scrollable_get_vadjustment (
-	    GTK_SCROLLABLE (chat->view));
-
-	g_signal_connect (adjustment, "changed",
-	    G_CALLBACK (chat_view_adjustment_changed_cb), chat);
-	g_signal_connect (adjustment, "value-changed",
-	    G_CALLBACK (chat_view_adjustment_value_changed_cb), chat);
-
-	return G_SOURCE_REMOVE;
-}
-#endif
-
-static gint
-chat_contacts_completion_func (const gchar *s1,
-			       const gchar *s2,
-			       gsize        n)
-{
-	gchar *tmp, *nick1, *nick2;
-	gint   ret;
-
-	if (s1 == s2) {
-		return 0;
-	}
-	if (!s1 || !s2) {
-		return s1 ? -1 : +1;
-	}
-
-	tmp = g_utf8_normalize (s1, -1, G_NORMALIZE_DEFAULT);
-	nick1 = g_utf8_casefold (tmp, -1);
-	g_free (tmp);
-
-	tmp = g_utf8_normalize (s2, -1, G_NORMALIZE_DEFAULT);
-	nick2 = g_utf8_casefold (tmp, -1);
-	g_free (tmp);
-
-	ret = strncmp (nick1, nick2, n);
-
-	g_free (nick1);
-	g_free (nick2);
+	if (tpl_log_walker_is_end (priv->log_walker))
+		return;
 
-	return ret;
+	priv->fetching_history = TRUE;
+	tpl_log_walker_get_events_async (priv->log_walker, HISTORY_PAGE_SIZE,
+	    got_filtered_messages_cb, g_object_ref (chat));
 }
 
 static gchar *
@@ -2815,83 +3334,493 @@ build_part_message (guint           reason,
 		    EmpathyContact *actor,
 		    const gchar    *message)
 {
-	GString *s = g_string_new ("");
 	const gchar *actor_name = NULL;
 
 	if (actor != NULL) {
 		actor_name = empathy_contact_get_alias (actor);
 	}
 
-	/* Having an actor only really makes sense for a few actions... */
+	if (TPAW_STR_EMPTY (message)) {
+		message = NULL;
+	}
+
+	/* The message in parentheses is the one given by the user leaving
+	 * the room, or by the one kicking or banning them.
+	 * Having an actor only really makes sense for a few actions... */
 	switch (reason) {
 	case TP_CHANNEL_GROUP_CHANGE_REASON_OFFLINE:
-		g_string_append_printf (s, _("%s has disconnected"), name);
-		break;
+		if (message != NULL) {
+			return g_strdup_printf (_("%s has disconnected (%s)"),
+						name, message);
+		}
+		return g_strdup_printf (_("%s has disconnected"), name);
 	case TP_CHANNEL_GROUP_CHANGE_REASON_KICKED:
-		if (actor_name != NULL) {
+		if (actor_name != NULL && message != NULL) {
+			/* translators: reverse the order of the first two
+			 * arguments if the kicked should come before the kicker
+			 * in your locale.
+			 */
+			return g_strdup_printf (_("%1$s was kicked by %2$s (%3$s)"),
+						name, actor_name, message);
+		} else if (actor_name != NULL) {
 			/* translators: reverse the order of these arguments
 			 * if the kicked should come before the kicker in your locale.
 			 */
-			g_string_append_printf (s, _("%1$s was kicked by %2$s"),
-				name, actor_name);
-		} else {
-			g_string_append_printf (s, _("%s was kicked"), name);
+			return g_strdup_printf (_("%1$s was kicked by %2$s"),
+						name, actor_name);
+		} else if (message != NULL) {
+			return g_strdup_printf (_("%s was kicked (%s)"),
+						name, message);
 		}
-		break;
+		return g_strdup_printf (_("%s was kicked"), name);
 	case TP_CHANNEL_GROUP_CHANGE_REASON_BANNED:
-		if (actor_name != NULL) {
+		if (actor_name != NULL && message != NULL) {
+			/* translators: reverse the order of the first two
+			 * arguments if the banned should come before the banner
+			 * in your locale.
+			 */
+			return g_strdup_printf (_("%1$s was banned by %2$s (%3$s)"),
+						name, actor_name, message);
+		} else if (actor_name != NULL) {
 			/* translators: reverse the order of these arguments
 			 * if the banned should come before the banner in your locale.
 			 */
-			g_string_append_printf (s, _("%1$s was banned by %2$s"),
-				name, actor_name);
-		} else {
-			g_string_append_printf (s, _("%s was banned"), name);
+			return g_strdup_printf (_("%1$s was banned by %2$s"),
+						name, actor_name);
+		} else if (message != NULL) {
+			return g_strdup_printf (_("%s was banned (%s)"),
+						name, message);
 		}
-		break;
+		return g_strdup_printf (_("%s was banned"), name);
 	default:
-		g_string_append_printf (s, _("%s has left the room"), name);
+		if (message != NULL) {
+			return g_strdup_printf (_("%s has left the room (%s)"),
+						name, message);
+		}
+		return g_strdup_printf (_("%s has left the room"), name);
 	}
+}
 
-	if (!TPAW_STR_EMPTY (message)) {
-		/* Note to translators: this string is appended to
-		 * notifications like "foo has left the room", with the message
-		 * given by the user living the room. If this poses a problem,
-		 * please let us know. :-)
-		 */
-		g_string_append_printf (s, _(" (%s)"), message);
+typedef enum {
+	CHAT_MEMBER_JOINED,
+	CHAT_MEMBER_LEFT,
+	CHAT_MEMBER_RENAMED,
+} ChatMemberEventType;
+
+typedef struct {
+	ChatMemberEventType type;
+	/* Alias of the member, the old one for renames */
+	gchar *name;
+	/* New alias, for renames only */
+	gchar *new_name;
+	guint reason;
+	EmpathyContact *actor;
+	gchar *message;
+} ChatMemberEvent;
+
+typedef struct {
+	guint reason;
+	const gchar *message;
+	const ChatMemberEvent *first;
+	guint count;
+} ChatMemberGroup;
+
+static void
+chat_member_event_free (ChatMemberEvent *event)
+{
+	g_free (event->name);
+	g_free (event->new_name);
+	g_free (event->message);
+	if (event->actor != NULL) {
+		g_object_unref (event->actor);
+	}
+	g_slice_free (ChatMemberEvent, event);
+}
+
+static gchar *
+chat_member_event_to_string (const ChatMemberEvent *event)
+{
+	switch (event->type) {
+	case CHAT_MEMBER_JOINED:
+		return g_strdup_printf (_("%s has joined the room"),
+					event->name);
+	case CHAT_MEMBER_RENAMED:
+		return g_strdup_printf (_("%s is now known as %s"),
+					event->name, event->new_name);
+	case CHAT_MEMBER_LEFT:
+	default:
+		return build_part_message (event->reason, event->name,
+					   event->actor, event->message);
+	}
+}
+
+/* Netsplit quit messages are the names of the two servers which lost
+ * their link, like "irc.example.net hub.example.net" */
+static gboolean
+chat_is_netsplit_message (const gchar *message)
+{
+	const gchar *space;
+
+	if (TPAW_STR_EMPTY (message)) {
+		return FALSE;
+	}
+
+	space = strchr (message, ' ');
+	if (space == NULL || space == message || space[1] == '\0') {
+		return FALSE;
+	}
+
+	return strchr (space + 1, ' ') == NULL &&
+	       memchr (message, '.', space - message) != NULL &&
+	       strchr (space + 1, '.') != NULL;
+}
+
+static gchar *
+chat_member_group_to_string (const ChatMemberGroup *group)
+{
+	const gchar *message = group->message;
+	guint count = group->count;
+
+	if (count == 1) {
+		return chat_member_event_to_string (group->first);
+	}
+
+	if (chat_is_netsplit_message (message)) {
+		/* Only people disconnecting are in a netsplit */
+		return g_strdup_printf (ngettext (
+			"%u person has disconnected (netsplit)",
+			"%u people have disconnected (netsplit)",
+			count), count);
+	}
+
+	if (TPAW_STR_EMPTY (message)) {
+		message = NULL;
 	}
 
-	return g_string_free (s, FALSE);
+	/* The message in parentheses is the one they all left with */
+	switch (group->reason) {
+	case TP_CHANNEL_GROUP_CHANGE_REASON_OFFLINE:
+		if (message != NULL) {
+			return g_strdup_printf (ngettext (
+				"%u person has disconnected (%s)",
+				"%u people have disconnected (%s)",
+				count), count, message);
+		}
+		return g_strdup_printf (ngettext (
+			"%u person has disconnected",
+			"%u people have disconnected",
+			count), count);
+	case TP_CHANNEL_GROUP_CHANGE_REASON_KICKED:
+		if (message != NULL) {
+			return g_strdup_printf (ngettext (
+				"%u person was kicked (%s)",
+				"%u people were kicked (%s)",
+				count), count, message);
+		}
+		return g_strdup_printf (ngettext (
+			"%u person was kicked",
+			"%u people were kicked",
+			count), count);
+	case TP_CHANNEL_GROUP_CHANGE_REASON_BANNED:
+		if (message != NULL) {
+			return g_strdup_printf (ngettext (
+				"%u person was banned (%s)",
+				"%u people were banned (%s)",
+				count), count, message);
+		}
+		return g_strdup_printf (ngettext (
+			"%u person was banned",
+			"%u people were banned",
+			count), count);
+	default:
+		if (message != NULL) {
+			return g_strdup_printf (ngettext (
+				"%u person has left the room (%s)",
+				"%u people have left the room (%s)",
+				count), count, message);
+		}
+		return g_strdup_printf (ngettext (
+			"%u person has left the room",
+			"%u people have left the room",
+			count), count);
+	}
+}
+
+/* Show one summary line per kind of change instead of one line per member:
+ * joins, parts grouped by reason and message, then renames. At most
+ * @max_lines lines are shown, a single one if there are too few for that. */
+static void
+chat_append_member_summaries (EmpathyChat *chat,
+			      GPtrArray   *events,
+			      guint        max_lines)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GArray *groups;
+	const ChatMemberEvent *first_joined = NULL;
+	const ChatMemberEvent *first_renamed = NULL;
+	guint n_joined = 0;
+	guint n_renamed = 0;
+	guint max_groups;
+	gchar *str;
+	guint i, j;
+
+	for (i = 0; i < events->len; i++) {
+		const ChatMemberEvent *event = g_ptr_array_index (events, i);
+
+		if (event->type == CHAT_MEMBER_JOINED) {
+			if (n_joined++ == 0)
+				first_joined = event;
+		} else if (event->type == CHAT_MEMBER_RENAMED) {
+			if (n_renamed++ == 0)
+				first_renamed = event;
+		}
+	}
+
+	/* The parts need one line as well */
+	if (max_lines < (n_joined > 0) + (n_renamed > 0) +
+			(n_joined + n_renamed < events->len)) {
+		str = g_strdup_printf (ngettext ("%u membership change",
+						 "%u membership changes",
+						 events->len),
+				       events->len);
+		empathy_theme_adium_append_event (chat->view, str);
+		g_free (str);
+
+		priv->member_events_shown++;
+		return;
+	}
+
+	max_groups = max_lines - (n_joined > 0) - (n_renamed > 0);
+	groups = g_array_new (FALSE, FALSE, sizeof (ChatMemberGroup));
+
+	for (i = 0; i < events->len; i++) {
+		const ChatMemberEvent *event = g_ptr_array_index (events, i);
+		ChatMemberGroup *group = NULL;
+
+		if (event->type != CHAT_MEMBER_LEFT) {
+			continue;
+		}
+
+		for (j = 0; j < groups->len; j++) {
+			ChatMemberGroup *g = &g_array_index (groups,
+							     ChatMemberGroup, j);
+
+			if (g->reason == event->reason &&
+			    !tp_strdiff (g->message, event->message)) {
+				group = g;
+				break;
+			}
+		}
+
+		/* Quit messages are free text; past a few distinct ones
+		 * they all end up in the last group. */
+		if (group == NULL && groups->len == max_groups) {
+			group = &g_array_index (groups, ChatMemberGroup,
+						groups->len - 1);
+			group->reason = TP_CHANNEL_GROUP_CHANGE_REASON_NONE;
+			group->message = NULL;
+		}
+
+		if (group == NULL) {
+			ChatMemberGroup g = { event->reason, event->message,
+					      event, 0 };
+
+			g_array_append_val (groups, g);
+			group = &g_array_index (groups, ChatMemberGroup,
+						groups->len - 1);
+		}
+
+		group->count++;
+	}
+
+	if (n_joined == 1) {
+		str = chat_member_event_to_string (first_joined);
+		empathy_theme_adium_append_event (chat->view, str);
+		g_free (str);
+	} else if (n_joined > 1) {
+		str = g_strdup_printf (ngettext ("%u person has joined the room",
+						 "%u people have joined the room",
+						 n_joined),
+				       n_joined);
+		empathy_theme_adium_append_event (chat->view, str);
+		g_free (str);
+	}
+
+	for (i = 0; i < groups->len; i++) {
+		str = chat_member_group_to_string (
+			&g_array_index (groups, ChatMemberGroup, i));
+		empathy_theme_adium_append_event (chat->view, str);
+		g_free (str);
+	}
+
+	if (n_renamed == 1) {
+		str = chat_member_event_to_string (first_renamed);
+		empathy_theme_adium_append_event (chat->view, str);
+		g_free (str);
+	} else if (n_renamed > 1) {
+		str = g_strdup_printf (ngettext ("%u person changed their nickname",
+						 "%u people changed their nickname",
+						 n_renamed),
+				       n_renamed);
+		empathy_theme_adium_append_event (chat->view, str);
+		g_free (str);
+	}
+
+	priv->member_events_shown += (n_joined > 0) + groups->len +
+				     (n_renamed > 0);
+
+	g_array_unref (groups);
+}
+
+static gboolean
+chat_member_events_flush_cb (gpointer user_data)
+{
+	EmpathyChat *chat = user_data;
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	priv->member_events_flush_id = 0;
+	chat_flush_member_events (chat, FALSE);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Show the membership changes gathered so far. Each one gets its own line
+ * as long as we stay below MEMBER_EVENTS_MAX_PER_SECOND lines per second,
+ * otherwise they are summarized in the lines left. Unless @force is set,
+ * nothing is shown once the ceiling is reached; the changes keep piling up
+ * until the next window and are summarized together. */
+static void
+chat_flush_member_events (EmpathyChat *chat,
+			  gboolean     force)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GPtrArray *events;
+	gint64 now;
+	guint budget;
+	guint i;
+
+	if (priv->member_events->len == 0) {
+		return;
+	}
+
+	now = g_get_monotonic_time ();
+	if (now - priv->member_events_window >= G_USEC_PER_SEC) {
+		priv->member_events_window = now;
+		priv->member_events_shown = 0;
+	}
+
+	budget = MEMBER_EVENTS_MAX_PER_SECOND -
+		 MIN (priv->member_events_shown, MEMBER_EVENTS_MAX_PER_SECOND);
+
+	if (budget == 0 && !force) {
+		gint64 wait;
+
+		wait = priv->member_events_window + G_USEC_PER_SEC - now;
+		priv->member_events_flush_id = g_timeout_add (
+			wait / 1000 + 1, chat_member_events_flush_cb, chat);
+		return;
+	}
+
+	if (priv->member_events_flush_id != 0) {
+		g_source_remove (priv->member_events_flush_id);
+		priv->member_events_flush_id = 0;
+	}
+
+	/* Keeping them in order with the rest of the conversation is worth
+	 * going one line over the ceiling */
+	budget = MAX (budget, 1);
+
+	/* Swap the queue first, a handler could add more changes */
+	events = priv->member_events;
+	priv->member_events = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) chat_member_event_free);
+
+	if (events->len <= budget) {
+		for (i = 0; i < events->len; i++) {
+			gchar *str;
+
+			str = chat_member_event_to_string (
+				g_ptr_array_index (events, i));
+			empathy_theme_adium_append_event (chat->view, str);
+			g_free (str);
+		}
+		priv->member_events_shown += events->len;
+	} else {
+		DEBUG ("Summarizing %u membership changes", events->len);
+		chat_append_member_summaries (chat, events, budget);
+	}
+
+	g_ptr_array_unref (events);
+}
+
+static void
+chat_queue_member_event (EmpathyChat         *chat,
+			 ChatMemberEventType  type,
+			 EmpathyContact      *contact,
+			 EmpathyContact      *new_contact,
+			 guint                reason,
+			 EmpathyContact      *actor,
+			 const gchar         *message)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	ChatMemberEvent *event;
+
+	event = g_slice_new0 (ChatMemberEvent);
+	event->type = type;
+	event->name = g_strdup (empathy_contact_get_alias (contact));
+	if (new_contact != NULL) {
+		event->new_name = g_strdup (
+			empathy_contact_get_alias (new_contact));
+	}
+	event->reason = reason;
+	if (actor != NULL) {
+		event->actor = g_object_ref (actor);
+	}
+	event->message = g_strdup (message);
+
+	g_ptr_array_add (priv->member_events, event);
+
+	if (priv->member_events_flush_id == 0) {
+		priv->member_events_flush_id = g_timeout_add (
+			MEMBER_EVENTS_DELAY, chat_member_events_flush_cb, chat);
+	}
 }
 
 static void
 chat_members_changed_cb (EmpathyTpChat  *tp_chat,
-			 EmpathyContact *contact,
+			 GPtrArray      *added,
+			 GPtrArray      *removed,
 			 EmpathyContact *actor,
 			 guint           reason,
 			 gchar          *message,
-			 gboolean        is_member,
 			 EmpathyChat    *chat)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	const gchar *name = empathy_contact_get_alias (contact);
-	gchar *str;
+	guint i;
 
 	g_return_if_fail (TP_CHANNEL_GROUP_CHANGE_REASON_RENAMED != reason);
 
+	for (i = 0; i < removed->len; i++) {
+		chat_completion_remove (chat, g_ptr_array_index (removed, i));
+	}
+	for (i = 0; i < added->len; i++) {
+		chat_completion_add (chat, g_ptr_array_index (added, i));
+	}
+
 	if (priv->block_events_timeout_id != 0)
 		return;
 
-	if (is_member) {
-		str = g_strdup_printf (_("%s has joined the room"),
-				       name);
-	} else {
-		str = build_part_message (reason, name, actor, message);
+	for (i = 0; i < removed->len; i++) {
+		chat_queue_member_event (chat, CHAT_MEMBER_LEFT,
+					 g_ptr_array_index (removed, i), NULL,
+					 reason, actor, message);
 	}
 
-	empathy_theme_adium_append_event (chat->view, str);
-	g_free (str);
+	for (i = 0; i < added->len; i++) {
+		chat_queue_member_event (chat, CHAT_MEMBER_JOINED,
+					 g_ptr_array_index (added, i), NULL,
+					 reason, NULL, NULL);
+	}
 }
 
 static void
@@ -2906,14 +3835,13 @@ chat_member_renamed_cb (EmpathyTpChat  *tp_chat,
 
 	g_return_if_fail (TP_CHANNEL_GROUP_CHANGE_REASON_RENAMED == reason);
 
-	if (priv->block_events_timeout_id == 0) {
-		gchar *str;
+	chat_completion_remove (chat, old_contact);
+	chat_completion_add (chat, new_contact);
 
-		str = g_strdup_printf (_("%s is now known as %s"),
-				       empathy_contact_get_alias (old_contact),
-				       empathy_contact_get_alias (new_contact));
-		empathy_theme_adium_append_event (chat->view, str);
-		g_free (str);
+	if (priv->block_events_timeout_id == 0) {
+		chat_queue_member_event (chat, CHAT_MEMBER_RENAMED,
+					 old_contact, new_contact,
+					 reason, NULL, NULL);
 	}
 
 }
@@ -3096,7 +4024,10 @@ chat_invalidated_cb (EmpathyTpChat *tp_chat,
 	priv->tp_chat = NULL;
 	g_object_notify (G_OBJECT (chat), "tp-chat");
 
-	empathy_theme_adium_append_event (chat->view, _("Disconnected"));
+	/* Built again from the members of the next channel */
+	chat_completion_clear (chat);
+
+	chat_append_event (chat, _("Disconnected"));
 	gtk_widget_set_sensitive (chat->input_text_view, FALSE);
 
 	chat_update_contacts_visibility (chat, FALSE);
@@ -3110,15 +4041,12 @@ update_misspelled_words (gpointer data)
 	EmpathyChat *chat = EMPATHY_CHAT (data);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 	GtkTextBuffer *buffer;
-	GtkTextIter iter;
-	gint length;
+	GtkTextIter start, end;
 
 	buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (chat->input_text_view));
 
-	gtk_text_buffer_get_end_iter (buffer, &iter);
-	length = gtk_text_iter_get_offset (&iter);
-	chat_input_text_buffer_insert_text_cb (buffer, &iter,
-					       NULL, length, chat);
+	gtk_text_buffer_get_bounds (buffer, &start, &end);
+	chat_spell_mark_dirty (chat, &start, &end);
 
 	priv->update_misspelled_words_id = 0;
 
@@ -3183,6 +4111,10 @@ conf_spell_checking_cb (GSettings *gsettings_chat,
 	                                          gtk_text_buffer_get_insert (buffer));
 		gtk_text_buffer_create_mark (buffer, "previous-cursor-position",
 					     &iter, TRUE);
+		gtk_text_buffer_create_mark (buffer, "spell-dirty-start",
+					     &iter, TRUE);
+		gtk_text_buffer_create_mark (buffer, "spell-dirty-end",
+					     &iter, FALSE);
 
 		/* Mark misspelled words in the existing buffer.
 		 * Need to do so in idle so the spell checker is updated. */
@@ -3205,6 +4137,12 @@ conf_spell_checking_cb (GSettings *gsettings_chat,
 
 		gtk_text_buffer_delete_mark_by_name (buffer,
 						     "previous-cursor-position");
+
+		chat_spell_cancel (chat);
+		gtk_text_buffer_delete_mark_by_name (buffer,
+						     "spell-dirty-start");
+		gtk_text_buffer_delete_mark_by_name (buffer,
+						     "spell-dirty-end");
 	}
 
 	priv->spell_checking_enabled = spell_checker;
@@ -3288,6 +4226,12 @@ chat_create_ui (EmpathyChat *chat)
 	g_signal_connect (chat->view, "focus_in_event",
 			  G_CALLBACK (chat_text_view_focus_in_event_cb),
 			  chat);
+	g_signal_connect (chat->view, "pruned",
+			  G_CALLBACK (chat_view_pruned_cb),
+			  chat);
+	g_signal_connect (chat->view, "near-top",
+			  G_CALLBACK (chat_view_near_top_cb),
+			  chat);
 	if (GTK_IS_SCROLLABLE (chat->view))
 	  {
 	    gtk_container_add (GTK_CONTAINER (priv->scrolled_window_chat),
@@ -3383,9 +4327,14 @@ chat_finalize (GObject *object)
 	if (priv->update_misspelled_words_id != 0)
 		g_source_remove (priv->update_misspelled_words_id);
 
+	chat_spell_cancel (chat);
+
 	if (priv->save_paned_pos_id != 0)
 		g_source_remove (priv->save_paned_pos_id);
 
+	if (priv->hibernate_id != 0)
+		g_source_remove (priv->hibernate_id);
+
 	if (priv->contacts_visible_id != 0)
 		g_source_remove (priv->contacts_visible_id);
 
@@ -3403,6 +4352,8 @@ chat_finalize (GObject *object)
 	g_object_unref (priv->account_manager);
 	g_object_unref (priv->log_manager);
 	g_object_unref (priv->log_walker);
+	g_free (priv->log_walker_before_token);
+	tp_clear_object (&priv->log_target);
 
 	if (priv->tp_chat) {
 		g_signal_handlers_disconnect_by_func (priv->tp_chat,
@@ -3431,6 +4382,9 @@ chat_finalize (GObject *object)
 		g_object_unref (priv->tp_chat);
 	}
 	if (priv->account) {
+		g_signal_handlers_disconnect_by_func (priv->account,
+						      chat_self_contact_alias_changed_cb,
+						      chat);
 		g_object_unref (priv->account);
 	}
 	if (priv->self_contact) {
@@ -3447,12 +4401,20 @@ chat_finalize (GObject *object)
 		g_source_remove (priv->block_events_timeout_id);
 	}
 
+	if (priv->member_events_flush_id != 0) {
+		g_source_remove (priv->member_events_flush_id);
+	}
+	g_ptr_array_unref (priv->member_events);
+
 	g_free (priv->id);
 	g_free (priv->name);
 	g_free (priv->subject);
-	g_completion_free (priv->completion);
+	chat_completion_clear (EMPATHY_CHAT (object));
+	chat_clear_pending_index (chat);
+	g_array_unref (priv->completion_items);
 
-	tp_clear_pointer (&priv->highlight_regex, g_regex_unref);
+	tp_clear_pointer (&priv->highlight_matcher,
+			  empathy_highlight_matcher_unref);
 
 	G_OBJECT_CLASS (empathy_chat_parent_class)->finalize (object);
 }
@@ -3462,7 +4424,6 @@ chat_constructed (GObject *object)
 {
 	EmpathyChat *chat = EMPATHY_CHAT (object);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	TplEntity *target;
 
 	if (priv->tp_chat != NULL) {
 		TpChannel *channel = TP_CHANNEL (priv->tp_chat);
@@ -3482,29 +4443,86 @@ chat_constructed (GObject *object)
 	 * empathy_chat_set_tp_chat() so we don't have to care about them here.
 	 */
 	if (priv->handle_type == TP_HANDLE_TYPE_ROOM)
-		target = tpl_entity_new_from_room_id (priv->id);
+		priv->log_target = tpl_entity_new_from_room_id (priv->id);
 	else
-		target = tpl_entity_new (priv->id, TPL_ENTITY_CONTACT, NULL, NULL);
+		priv->log_target = tpl_entity_new (priv->id, TPL_ENTITY_CONTACT, NULL, NULL);
 
-	priv->log_walker = tpl_log_manager_walk_filtered_events (priv->log_manager, priv->account, target,
-								 TPL_EVENT_MASK_TEXT, chat_log_filter, chat);
-	g_object_unref (target);
+	chat_create_log_walker (chat);
 
 	if (priv->handle_type != TP_HANDLE_TYPE_ROOM) {
 		chat_add_logs (chat);
 	}
 }
 
+static gboolean
+chat_hibernate_timeout_cb (gpointer data)
+{
+	EmpathyChat *chat = EMPATHY_CHAT (data);
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	priv->hibernate_id = 0;
+	empathy_theme_adium_hibernate (chat->view);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+chat_map (GtkWidget *widget)
+{
+	EmpathyChat *chat = EMPATHY_CHAT (widget);
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	if (priv->hibernate_id != 0) {
+		g_source_remove (priv->hibernate_id);
+		priv->hibernate_id = 0;
+	}
+
+	empathy_theme_adium_thaw (chat->view);
+	empathy_theme_adium_wake (chat->view);
+
+	GTK_WIDGET_CLASS (empathy_chat_parent_class)->map (widget);
+}
+
+/* Unmapped when switching to another tab: stop rendering incoming messages
+ * until the tab is shown again, and if that lasts, release the memory used
+ * by the view */
+static void
+chat_unmap (GtkWidget *widget)
+{
+	EmpathyChat *chat = EMPATHY_CHAT (widget);
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	guint timeout;
+
+	GTK_WIDGET_CLASS (empathy_chat_parent_class)->unmap (widget);
+
+	if (gtk_widget_in_destruction (widget))
+		return;
+
+	empathy_theme_adium_freeze (chat->view);
+
+	timeout = g_settings_get_uint (priv->gsettings_chat,
+				       EMPATHY_PREFS_CHAT_HIBERNATE_TIMEOUT);
+
+	if (timeout != 0 && priv->hibernate_id == 0) {
+		priv->hibernate_id = g_timeout_add_seconds (timeout,
+			chat_hibernate_timeout_cb, chat);
+	}
+}
+
 static void
 empathy_chat_class_init (EmpathyChatClass *klass)
 {
 	GObjectClass   *object_class = G_OBJECT_CLASS (klass);
+	GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
 
 	object_class->finalize = chat_finalize;
 	object_class->get_property = chat_get_property;
 	object_class->set_property = chat_set_property;
 	object_class->constructed = chat_constructed;
 
+	widget_class->map = chat_map;
+	widget_class->unmap = chat_unmap;
+
 	g_object_class_install_property (object_class,
 					 PROP_TP_CHAT,
 					 g_param_spec_object ("tp-chat",
@@ -3693,10 +4711,12 @@ empathy_chat_init (EmpathyChat *chat)
 	 * "joined" messages. */
 	priv->block_events_timeout_id =
 		g_timeout_add_seconds (1, chat_block_events_timeout_cb, chat);
+	priv->member_events = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) chat_member_event_free);
 
 	/* Add nick name completion */
-	priv->completion = g_completion_new ((GCompletionFunc) empathy_contact_get_alias);
-	g_completion_set_compare (priv->completion, chat_contacts_completion_func);
+	priv->completion_items = g_array_new (FALSE, FALSE,
+					      sizeof (ChatCompletionItem));
 
 	/* Create UI early so by the time empathy_chat_set_tp_chat() is called
 	 * (construct property) the view will already exists to receive pending
@@ -4149,12 +5169,24 @@ empathy_chat_set_tp_chat (EmpathyChat   *chat,
 	}
 
 	if (priv->account) {
+		g_signal_handlers_disconnect_by_func (priv->account,
+						      chat_self_contact_alias_changed_cb,
+						      chat);
 		g_object_unref (priv->account);
 	}
 
 	priv->tp_chat = g_object_ref (tp_chat);
 	priv->account = g_object_ref (empathy_tp_chat_get_account (priv->tp_chat));
 
+	/* Nicks are completed from the members of this channel only, see
+	 * chat_completion_ensure() */
+	chat_completion_clear (chat);
+
+	/* The highlight matcher also matches the account's nickname */
+	g_signal_connect_swapped (priv->account, "notify::nickname",
+				  G_CALLBACK (chat_self_contact_alias_changed_cb),
+				  chat);
+
 	g_signal_connect (tp_chat, "invalidated",
 			  G_CALLBACK (chat_invalidated_cb),
 			  chat);
@@ -4173,7 +5205,7 @@ empathy_chat_set_tp_chat (EmpathyChat   *chat,
 	g_signal_connect (tp_chat, "contact-chat-state-changed",
 			  G_CALLBACK (chat_state_changed_cb),
 			  chat);
-	g_signal_connect (tp_chat, "members-changed",
+	g_signal_connect (tp_chat, "members-changed-batch",
 			  G_CALLBACK (chat_members_changed_cb),
 			  chat);
 	g_signal_connect (tp_chat, "member-renamed",
@@ -4211,7 +5243,7 @@ empathy_chat_set_tp_chat (EmpathyChat   *chat,
 	if (chat->input_text_view) {
 		gtk_widget_set_sensitive (chat->input_text_view, TRUE);
 		if (priv->block_events_timeout_id == 0) {
-			empathy_theme_adium_append_event (chat->view, _("Connected"));
+			chat_append_event (chat, _("Connected"));
 		}
 	}
 
@@ -4529,9 +5561,11 @@ empathy_chat_messages_read (EmpathyChat *self)
 	if (priv->retrieving_backlogs)
 		return;
 
+	/* Only ack what we have shown, messages the channel got since then
+	 * are still unread */
 	if (priv->tp_chat != NULL) {
-		tp_text_channel_ack_all_pending_messages_async (
-			TP_TEXT_CHANNEL (priv->tp_chat), NULL, NULL);
+		empathy_tp_chat_acknowledge_messages_up_to (priv->tp_chat,
+							    NULL);
 	}
 
 	priv->highlighted = FALSE;
@@ -0,0 +1,436 @@
+#include "config.h"
+#include "empathy-highlight-matcher.h"
+
+#include <string.h>
+
+#include "empathy-gsettings.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_CHAT
+#include "empathy-debug.h"
+
+/* All the words to highlight (our nicks and the user's keywords) are
+ * case folded and compiled into one Aho-Corasick automaton, so a message
+ * is scanned once whatever the number of words. A word only matches on
+ * word boundaries, like the \bword\b regex this replaces. */
+
+typedef struct
+{
+  guint16 dict;       /* Next state on the failure chain ending a word */
+  guint16 depth;      /* Length in bytes of the prefix for this state */
+  gboolean is_word;   /* A word ends here */
+  gboolean word_start; /* Its first character is a word character */
+  gboolean word_end;   /* Its last character is a word character */
+} HighlightState;
+
+typedef struct
+{
+  guint16 classes[256]; /* byte -> class, 0 for unused bytes */
+  guint n_classes;
+  guint n_states;
+  guint16 *delta;      /* n_states * n_classes transitions */
+  HighlightState *states;
+} HighlightAutomaton;
+
+struct _EmpathyHighlightMatcher
+{
+  gint ref_count;
+
+  /* Key in the per-account cache, NULL if not cached */
+  gchar *key;
+  GPtrArray *names;
+  /* Built lazily from names and the keywords setting */
+  HighlightAutomaton *automaton;
+};
+
+/* (account path, self alias, account nickname) -> EmpathyHighlightMatcher,
+ * not owned. Created with the first cached matcher and destroyed, along
+ * with the settings, with the last one. */
+static GHashTable *matchers = NULL;
+static GSettings *gsettings_chat = NULL;
+static gchar **keywords = NULL;
+
+static gboolean
+highlight_is_word_char (gunichar c)
+{
+  return g_unichar_isalnum (c) || c == '_';
+}
+
+static void
+highlight_automaton_free (HighlightAutomaton *automaton)
+{
+  if (automaton == NULL)
+    return;
+
+  g_free (automaton->delta);
+  g_free (automaton->states);
+  g_slice_free (HighlightAutomaton, automaton);
+}
+
+static HighlightAutomaton *
+highlight_automaton_new (GPtrArray *words)
+{
+  HighlightAutomaton *automaton;
+  guint16 *fail, *queue;
+  guint max_states = 1;
+  guint head = 0, tail = 0;
+  guint i, c;
+
+  automaton = g_slice_new0 (HighlightAutomaton);
+
+  automaton->n_classes = 1;
+  for (i = 0; i < words->len; i++)
+    {
+      const guchar *p;
+
+      for (p = g_ptr_array_index (words, i); *p != '\0'; p++)
+        {
+          if (automaton->classes[*p] == 0)
+            automaton->classes[*p] = automaton->n_classes++;
+
+          max_states++;
+        }
+    }
+
+  /* Words are nicks and keywords, this can't be exceeded in practice;
+   * words beyond it are ignored. */
+  max_states = MIN (max_states, G_MAXUINT16);
+
+  automaton->delta = g_new0 (guint16, max_states * automaton->n_classes);
+  automaton->states = g_new0 (HighlightState, max_states);
+  automaton->n_states = 1;
+
+  for (i = 0; i < words->len; i++)
+    {
+      const gchar *word = g_ptr_array_index (words, i);
+      const guchar *p;
+      guint state = 0;
+
+      if (automaton->n_states + strlen (word) > max_states)
+        break;
+
+      for (p = (const guchar *) word; *p != '\0'; p++)
+        {
+          guint16 *next;
+
+          next = &automaton->delta[state * automaton->n_classes +
+              automaton->classes[*p]];
+          if (*next == 0)
+            {
+              *next = automaton->n_states++;
+              automaton->states[*next].depth =
+                automaton->states[state].depth + 1;
+            }
+          state = *next;
+        }
+
+      automaton->states[state].is_word = TRUE;
+      automaton->states[state].word_start =
+        highlight_is_word_char (g_utf8_get_char (word));
+      automaton->states[state].word_end = highlight_is_word_char (
+          g_utf8_get_char (g_utf8_find_prev_char (word, (gchar *) p)));
+    }
+
+  /* Failure links, breadth-first, and completion of the goto function */
+  fail = g_new0 (guint16, automaton->n_states);
+  queue = g_new (guint16, automaton->n_states);
+
+  for (c = 1; c < automaton->n_classes; c++)
+    {
+      if (automaton->delta[c] != 0)
+        queue[tail++] = automaton->delta[c];
+    }
+
+  while (head < tail)
+    {
+      guint16 state = queue[head++];
+      guint16 *row = &automaton->delta[state * automaton->n_classes];
+      guint16 *fail_row = &automaton->delta[fail[state] * automaton->n_classes];
+
+      for (c = 1; c < automaton->n_classes; c++)
+        {
+          guint16 next = row[c];
+
+          if (next == 0)
+            {
+              row[c] = fail_row[c];
+              continue;
+            }
+
+          fail[next] = fail_row[c];
+          if (automaton->states[fail[next]].is_word)
+            automaton->states[next].dict = fail[next];
+          else
+            automaton->states[next].dict = automaton->states[fail[next]].dict;
+
+          queue[tail++] = next;
+        }
+    }
+
+  g_free (queue);
+  g_free (fail);
+
+  return automaton;
+}
+
+static void
+highlight_add_word (GPtrArray *words,
+    const gchar *word)
+{
+  gchar *folded;
+  guint i;
+
+  if (tp_str_empty (word))
+    return;
+
+  folded = g_utf8_casefold (word, -1);
+
+  for (i = 0; i < words->len; i++)
+    {
+      if (!tp_strdiff (g_ptr_array_index (words, i), folded))
+        {
+          g_free (folded);
+          return;
+        }
+    }
+
+  g_ptr_array_add (words, folded);
+}
+
+static HighlightAutomaton *
+highlight_matcher_get_automaton (EmpathyHighlightMatcher *self)
+{
+  GPtrArray *words;
+  guint i;
+
+  if (self->automaton != NULL)
+    return self->automaton;
+
+  words = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 0; i < self->names->len; i++)
+    highlight_add_word (words, g_ptr_array_index (self->names, i));
+
+  /* Only cached matchers follow the keywords setting */
+  if (self->key != NULL && keywords != NULL)
+    {
+      for (i = 0; keywords[i] != NULL; i++)
+        highlight_add_word (words, keywords[i]);
+    }
+
+  DEBUG ("Compiling %u words to highlight", words->len);
+
+  self->automaton = highlight_automaton_new (words);
+  g_ptr_array_unref (words);
+
+  return self->automaton;
+}
+
+static EmpathyHighlightMatcher *
+highlight_matcher_new (const gchar *key,
+    const gchar * const *words)
+{
+  EmpathyHighlightMatcher *self;
+  guint i;
+
+  self = g_slice_new0 (EmpathyHighlightMatcher);
+  self->ref_count = 1;
+  self->key = g_strdup (key);
+  self->names = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 0; words != NULL && words[i] != NULL; i++)
+    g_ptr_array_add (self->names, g_strdup (words[i]));
+
+  return self;
+}
+
+/**
+ * empathy_highlight_matcher_new:
+ * @words: a %NULL-terminated array of words to highlight
+ *
+ * Returns: a new #EmpathyHighlightMatcher matching @words only
+ */
+EmpathyHighlightMatcher *
+empathy_highlight_matcher_new (const gchar * const *words)
+{
+  return highlight_matcher_new (NULL, words);
+}
+
+static void
+highlight_keywords_changed_cb (GSettings *settings,
+    const gchar *key,
+    gpointer user_data)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_strfreev (keywords);
+  keywords = g_settings_get_strv (settings, EMPATHY_PREFS_CHAT_HIGHLIGHT_KEYWORDS);
+
+  /* Recompiled on next use */
+  g_hash_table_iter_init (&iter, matchers);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      EmpathyHighlightMatcher *self = value;
+
+      tp_clear_pointer (&self->automaton, highlight_automaton_free);
+    }
+}
+
+/**
+ * empathy_highlight_matcher_dup_for_account:
+ * @account: a #TpAccount
+ * @self_alias: our alias in the chat
+ *
+ * Returns a matcher for our alias, the nickname of @account and the
+ * keywords configured by the user. It is shared by all the chats of
+ * @account where we have the same alias. Callers have to get a new
+ * matcher when the nickname of @account changes.
+ *
+ * Returns: (transfer full): an #EmpathyHighlightMatcher
+ */
+EmpathyHighlightMatcher *
+empathy_highlight_matcher_dup_for_account (TpAccount *account,
+    const gchar *self_alias)
+{
+  EmpathyHighlightMatcher *self;
+  const gchar *words[3];
+  const gchar *nickname;
+  gchar *key;
+
+  g_return_val_if_fail (TP_IS_ACCOUNT (account), NULL);
+  g_return_val_if_fail (self_alias != NULL, NULL);
+
+  if (matchers == NULL)
+    {
+      matchers = g_hash_table_new (g_str_hash, g_str_equal);
+
+      gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
+      keywords = g_settings_get_strv (gsettings_chat,
+          EMPATHY_PREFS_CHAT_HIGHLIGHT_KEYWORDS);
+      g_signal_connect (gsettings_chat,
+          "changed::" EMPATHY_PREFS_CHAT_HIGHLIGHT_KEYWORDS,
+          G_CALLBACK (highlight_keywords_changed_cb), NULL);
+    }
+
+  nickname = tp_account_get_nickname (account);
+  key = g_strdup_printf ("%s\n%s\n%s", tp_proxy_get_object_path (account),
+      self_alias, nickname != NULL ? nickname : "");
+
+  self = g_hash_table_lookup (matchers, key);
+  if (self != NULL)
+    {
+      g_free (key);
+      return empathy_highlight_matcher_ref (self);
+    }
+
+  words[0] = self_alias;
+  words[1] = nickname;
+  words[2] = NULL;
+
+  self = highlight_matcher_new (key, words);
+  g_hash_table_insert (matchers, self->key, self);
+  g_free (key);
+
+  return self;
+}
+
+EmpathyHighlightMatcher *
+empathy_highlight_matcher_ref (EmpathyHighlightMatcher *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+empathy_highlight_matcher_unref (EmpathyHighlightMatcher *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      if (self->key != NULL)
+        {
+          g_hash_table_remove (matchers, self->key);
+
+          if (g_hash_table_size (matchers) == 0)
+            {
+              tp_clear_pointer (&matchers, g_hash_table_unref);
+              g_signal_handlers_disconnect_by_func (gsettings_chat,
+                  highlight_keywords_changed_cb, NULL);
+              g_clear_object (&gsettings_chat);
+              tp_clear_pointer (&keywords, g_strfreev);
+            }
+        }
+
+      g_free (self->key);
+      g_ptr_array_unref (self->names);
+      highlight_automaton_free (self->automaton);
+      g_slice_free (EmpathyHighlightMatcher, self);
+    }
+}
+
+/**
+ * empathy_highlight_matcher_match:
+ * @self: an #EmpathyHighlightMatcher
+ * @text: the body of a message
+ *
+ * Returns: %TRUE if one of the words of @self appears in @text
+ */
+gboolean
+empathy_highlight_matcher_match (EmpathyHighlightMatcher *self,
+    const gchar *text)
+{
+  HighlightAutomaton *automaton;
+  gchar *folded;
+  const guchar *p;
+  guint state = 0;
+  gboolean found = FALSE;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (text != NULL, FALSE);
+
+  automaton = highlight_matcher_get_automaton (self);
+  if (automaton->n_states == 1)
+    return FALSE;
+
+  folded = g_utf8_casefold (text, -1);
+
+  for (p = (const guchar *) folded; *p != '\0' && !found; p++)
+    {
+      const HighlightState *s;
+      guint o;
+
+      state = automaton->delta[state * automaton->n_classes +
+          automaton->classes[*p]];
+      s = &automaton->states[state];
+
+      /* Every word ending here, checking word boundaries */
+      for (o = s->is_word ? state : s->dict;
+           o != 0;
+           o = automaton->states[o].dict)
+        {
+          const HighlightState *w = &automaton->states[o];
+          const gchar *start = (const gchar *) p + 1 - w->depth;
+          const gchar *end = (const gchar *) p + 1;
+
+          if (w->word_start && start > folded &&
+              highlight_is_word_char (g_utf8_get_char (
+                  g_utf8_find_prev_char (folded, start))))
+            continue;
+
+          if (w->word_end && *end != '\0' &&
+              highlight_is_word_char (g_utf8_get_char (end)))
+            continue;
+
+          found = TRUE;
+          break;
+        }
+    }
+
+  g_free (folded);
+
+  return found;
+}
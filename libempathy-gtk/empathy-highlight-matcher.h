@@ -0,0 +1,27 @@
+#ifndef __EMPATHY_HIGHLIGHT_MATCHER_H__
+#define __EMPATHY_HIGHLIGHT_MATCHER_H__
+
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyHighlightMatcher EmpathyHighlightMatcher;
+
+EmpathyHighlightMatcher * empathy_highlight_matcher_new (
+    const gchar * const *words);
+
+EmpathyHighlightMatcher * empathy_highlight_matcher_dup_for_account (
+    TpAccount *account,
+    const gchar *self_alias);
+
+EmpathyHighlightMatcher * empathy_highlight_matcher_ref (
+    EmpathyHighlightMatcher *self);
+
+void empathy_highlight_matcher_unref (EmpathyHighlightMatcher *self);
+
+gboolean empathy_highlight_matcher_match (EmpathyHighlightMatcher *self,
+    const gchar *text);
+
+G_END_DECLS
+
+#endif /* #ifndef __EMPATHY_HIGHLIGHT_MATCHER_H__*/
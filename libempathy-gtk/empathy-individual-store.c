@@ -1106,9 +1106,7 @@ individual_store_contact_sort (FolksIndividual *individual_a,
   g_return_val_if_fail (individual_a != NULL || individual_b != NULL, 0);
 
   /* alias */
-  ret_val = g_utf8_collate (
-      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual_a)),
-      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual_b)));
+  ret_val = empathy_individual_compare_alias (individual_a, individual_b);
 
   if (ret_val != 0)
     goto out;
@@ -1139,8 +1137,7 @@ individual_store_contact_sort (FolksIndividual *individual_a,
     }
 
   /* identifier */
-  ret_val = g_utf8_collate (folks_individual_get_id (individual_a),
-      folks_individual_get_id (individual_b));
+  ret_val = empathy_individual_compare_id (individual_a, individual_b);
 
 out:
   tp_clear_object (&contact_a);
@@ -1157,25 +1154,27 @@ individual_store_state_sort_func (GtkTreeModel *model,
 {
   gint ret_val;
   FolksIndividual *individual_a, *individual_b;
-  gchar *name_a, *name_b;
+  gchar *name_a = NULL, *name_b = NULL;
   gboolean is_separator_a, is_separator_b;
   gboolean fake_group_a, fake_group_b;
-  FolksPresenceType folks_presence_type_a, folks_presence_type_b;
-  TpConnectionPresenceType tp_presence_a, tp_presence_b;
 
   gtk_tree_model_get (model, iter_a,
-      EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_a,
       EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual_a,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, &is_separator_a,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, &fake_group_a, -1);
   gtk_tree_model_get (model, iter_b,
-      EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_b,
       EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual_b,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, &is_separator_b,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, &fake_group_b, -1);
 
   if (individual_a == NULL || individual_b == NULL)
     {
+      /* Only groups and separators need their name */
+      gtk_tree_model_get (model, iter_a,
+          EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_a, -1);
+      gtk_tree_model_get (model, iter_b,
+          EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_b, -1);
+
       ret_val = compare_separator_and_groups (is_separator_a, is_separator_b,
           name_a, name_b, individual_a, individual_b, fake_group_a,
           fake_group_b);
@@ -1185,17 +1184,7 @@ individual_store_state_sort_func (GtkTreeModel *model,
   /* If we managed to get this far, we can start looking at
    * the presences.
    */
-  folks_presence_type_a =
-      folks_presence_details_get_presence_type (
-          FOLKS_PRESENCE_DETAILS (individual_a));
-  folks_presence_type_b =
-      folks_presence_details_get_presence_type (
-          FOLKS_PRESENCE_DETAILS (individual_b));
-  tp_presence_a = empathy_folks_presence_type_to_tp (folks_presence_type_a);
-  tp_presence_b = empathy_folks_presence_type_to_tp (folks_presence_type_b);
-
-  ret_val = -tp_connection_presence_type_cmp_availability (tp_presence_a,
-      tp_presence_b);
+  ret_val = empathy_individual_compare_presence (individual_a, individual_b);
 
   if (ret_val == 0)
     {
@@ -1218,28 +1207,36 @@ individual_store_name_sort_func (GtkTreeModel *model,
     GtkTreeIter *iter_b,
     gpointer user_data)
 {
-  gchar *name_a, *name_b;
+  gchar *name_a = NULL, *name_b = NULL;
   FolksIndividual *individual_a, *individual_b;
   gboolean is_separator_a = FALSE, is_separator_b = FALSE;
   gint ret_val;
   gboolean fake_group_a, fake_group_b;
 
   gtk_tree_model_get (model, iter_a,
-      EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_a,
       EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual_a,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, &is_separator_a,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, &fake_group_a, -1);
   gtk_tree_model_get (model, iter_b,
-      EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_b,
       EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual_b,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, &is_separator_b,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, &fake_group_b, -1);
 
   if (individual_a == NULL || individual_b == NULL)
-    ret_val = compare_separator_and_groups (is_separator_a, is_separator_b,
-        name_a, name_b, individual_a, individual_b, fake_group_a, fake_group_b);
+    {
+      gtk_tree_model_get (model, iter_a,
+          EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_a, -1);
+      gtk_tree_model_get (model, iter_b,
+          EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_b, -1);
+
+      ret_val = compare_separator_and_groups (is_separator_a, is_separator_b,
+          name_a, name_b, individual_a, individual_b, fake_group_a,
+          fake_group_b);
+    }
   else
-    ret_val = individual_store_contact_sort (individual_a, individual_b);
+    {
+      ret_val = individual_store_contact_sort (individual_a, individual_b);
+    }
 
   tp_clear_object (&individual_a);
   tp_clear_object (&individual_b);
@@ -1290,7 +1290,7 @@ log_window_append_chat_message (TplEvent *event,
   GtkTreeIter iter, parent;
   gchar *pretty_date, *alias, *body;
   GDateTime *date;
-  TpawStringParser *parsers;
+  const EmpathyStringScanner *scanner;
   GString *msg;
 
   date = g_date_time_new_from_unix_local (
@@ -1304,13 +1304,12 @@ log_window_append_chat_message (TplEvent *event,
       tpl_entity_get_alias (tpl_event_get_sender (event)), -1);
 
   /* escape the text */
-  parsers = empathy_webkit_get_string_parser (
+  scanner = empathy_webkit_get_string_scanner (
       g_settings_get_boolean (log_window->priv->gsettings_chat,
         EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
   msg = g_string_new ("");
 
-  tpaw_string_parser_substr (empathy_message_get_body (message), -1,
-      parsers, msg);
+  empathy_string_scan (scanner, empathy_message_get_body (message), -1, msg);
 
   if (tpl_text_event_get_message_type (TPL_TEXT_EVENT (event))
       == TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION)
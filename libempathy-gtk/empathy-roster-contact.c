@@ -12,6 +12,9 @@ G_DEFINE_TYPE (EmpathyRosterContact, empathy_roster_contact, GTK_TYPE_LIST_BOX_R
 
 #define AVATAR_SIZE 48
 
+/* Height of a row without its widgets: the avatar and its padding */
+#define UNBOUND_HEIGHT (AVATAR_SIZE + 8)
+
 enum
 {
   PROP_INDIVIDIUAL = 1,
@@ -31,6 +34,20 @@ enum
 static guint signals[LAST_SIGNAL];
 */
 
+/* The widgets displaying a contact, see empathy_roster_contact_bind() */
+typedef struct
+{
+  GtkWidget *avatar;
+  GtkWidget *first_line_alig;
+  GtkWidget *alias;
+  GtkWidget *presence_msg;
+  GtkWidget *most_recent_msg;
+  GtkWidget *presence_icon;
+  GtkWidget *phone_icon;
+} ContactWidgets;
+
+static GQuark contact_widgets_quark = 0;
+
 struct _EmpathyRosterContactPriv
 {
   FolksIndividual *individual;
@@ -40,13 +57,9 @@ struct _EmpathyRosterContactPriv
   TplLogManager *log_manager;
   TplEvent *most_recent_event;
 
-  GtkWidget *avatar;
-  GtkWidget *first_line_alig;
-  GtkWidget *alias;
-  GtkWidget *presence_msg;
-  GtkWidget *most_recent_msg;
-  GtkWidget *presence_icon;
-  GtkWidget *phone_icon;
+  /* The child of the row (owned) and its widgets, NULL if unbound */
+  GtkWidget *content;
+  ContactWidgets *widgets;
 
   /* If not NULL, used instead of the individual's presence icon */
   gchar *event_icon;
@@ -150,14 +163,20 @@ avatar_loaded_cb (GObject *source,
   pixbuf = empathy_pixbuf_avatar_from_individual_scaled_finish (
       FOLKS_INDIVIDUAL (source), result, NULL);
 
+  /* The row may have been unbound in the meantime */
+  if (self->priv->widgets == NULL)
+    goto unbound;
+
   if (pixbuf == NULL)
     {
       pixbuf = tpaw_pixbuf_from_icon_name_sized (
           TPAW_IMAGE_AVATAR_DEFAULT, AVATAR_SIZE);
     }
 
-  gtk_image_set_from_pixbuf (GTK_IMAGE (self->priv->avatar), pixbuf);
-  g_object_unref (pixbuf);
+  gtk_image_set_from_pixbuf (GTK_IMAGE (self->priv->widgets->avatar), pixbuf);
+
+unbound:
+  g_clear_object (&pixbuf);
 
   g_object_unref (self);
 
@@ -168,22 +187,27 @@ out:
 static void
 update_most_recent_msg (EmpathyRosterContact *self)
 {
+  ContactWidgets *widgets = self->priv->widgets;
   const gchar* msg = get_most_recent_message (self);
 
+  if (widgets == NULL)
+    return;
+
   if (tp_str_empty (msg))
     {
-      gtk_alignment_set (GTK_ALIGNMENT (self->priv->first_line_alig),
+      gtk_alignment_set (GTK_ALIGNMENT (widgets->first_line_alig),
           0, 0.5, 1, 1);
-      gtk_widget_hide (self->priv->most_recent_msg);
+      gtk_widget_hide (widgets->most_recent_msg);
     }
   else
     {
       gchar *tmp = g_strdup (msg);
       if (strchr(tmp, '\n')) strchr(tmp, '\n')[0] = 0;
-      gtk_label_set_text (GTK_LABEL (self->priv->most_recent_msg), tmp);
-      gtk_alignment_set (GTK_ALIGNMENT (self->priv->first_line_alig),
+      gtk_label_set_text (GTK_LABEL (widgets->most_recent_msg), tmp);
+      gtk_alignment_set (GTK_ALIGNMENT (widgets->first_line_alig),
           0, 0.75, 1, 1);
-      gtk_misc_set_alignment (GTK_MISC (self->priv->most_recent_msg), 0, 0.25);
+      gtk_misc_set_alignment (GTK_MISC (widgets->most_recent_msg), 0, 0.25);
+      gtk_widget_show (widgets->most_recent_msg);
       g_free (tmp);
     }
 }
@@ -191,6 +215,10 @@ update_most_recent_msg (EmpathyRosterContact *self)
 static void
 update_avatar (EmpathyRosterContact *self)
 {
+  /* Loaded when the row is bound */
+  if (self->priv->widgets == NULL)
+    return;
+
   empathy_pixbuf_avatar_from_individual_scaled_async (self->priv->individual,
       AVATAR_SIZE, AVATAR_SIZE, NULL, avatar_loaded_cb,
       tp_weak_ref_new (self, NULL, NULL));
@@ -207,7 +235,9 @@ avatar_changed_cb (FolksIndividual *individual,
 static void
 update_alias (EmpathyRosterContact *self)
 {
-  gtk_label_set_text (GTK_LABEL (self->priv->alias), get_alias (self));
+  if (self->priv->widgets != NULL)
+    gtk_label_set_text (GTK_LABEL (self->priv->widgets->alias),
+        get_alias (self));
 
   g_object_notify (G_OBJECT (self), "alias");
 }
@@ -223,19 +253,23 @@ alias_changed_cb (FolksIndividual *individual,
 static void
 update_presence_msg (EmpathyRosterContact *self)
 {
+  ContactWidgets *widgets = self->priv->widgets;
   const gchar *msg;
   GStrv types;
 
+  if (widgets == NULL)
+    return;
+
   msg = folks_presence_details_get_presence_message (
       FOLKS_PRESENCE_DETAILS (self->priv->individual));
 
   if (tp_str_empty (msg))
     {
       /* Just display the alias in the center of the row */
-      gtk_alignment_set (GTK_ALIGNMENT (self->priv->first_line_alig),
+      gtk_alignment_set (GTK_ALIGNMENT (widgets->first_line_alig),
           0, 0.5, 1, 1);
 
-      gtk_widget_hide (self->priv->presence_msg);
+      gtk_widget_hide (widgets->presence_msg);
     }
   else
     {
@@ -250,25 +284,25 @@ update_presence_msg (EmpathyRosterContact *self)
           /* Add a prefix explaining that something goes wrong when trying to
            * fetch contact's presence. */
           tmp = g_strdup_printf (_("Server cannot find contact: %s"), msg);
-          gtk_label_set_text (GTK_LABEL (self->priv->presence_msg), tmp);
+          gtk_label_set_text (GTK_LABEL (widgets->presence_msg), tmp);
 
           g_free (tmp);
         }
       else
         {
-          gtk_label_set_text (GTK_LABEL (self->priv->presence_msg), msg);
+          gtk_label_set_text (GTK_LABEL (widgets->presence_msg), msg);
         }
 
-      gtk_alignment_set (GTK_ALIGNMENT (self->priv->first_line_alig),
+      gtk_alignment_set (GTK_ALIGNMENT (widgets->first_line_alig),
           0, 0.75, 1, 1);
-      gtk_misc_set_alignment (GTK_MISC (self->priv->presence_msg), 0, 0.25);
+      gtk_misc_set_alignment (GTK_MISC (widgets->presence_msg), 0, 0.25);
 
-      gtk_widget_show (self->priv->presence_msg);
+      gtk_widget_show (widgets->presence_msg);
     }
 
   types = (GStrv) empathy_individual_get_client_types (self->priv->individual);
 
-  gtk_widget_set_visible (self->priv->phone_icon,
+  gtk_widget_set_visible (widgets->phone_icon,
       empathy_client_types_contains_mobile_device (types));
 }
 
@@ -285,13 +319,16 @@ update_presence_icon (EmpathyRosterContact *self)
 {
   const gchar *icon;
 
+  if (self->priv->widgets == NULL)
+    return;
+
   if (self->priv->event_icon == NULL)
     icon = empathy_icon_name_for_individual (self->priv->individual);
   else
     icon = self->priv->event_icon;
 
-  gtk_image_set_from_icon_name (GTK_IMAGE (self->priv->presence_icon), icon,
-      GTK_ICON_SIZE_MENU);
+  gtk_image_set_from_icon_name (GTK_IMAGE (self->priv->widgets->presence_icon),
+      icon, GTK_ICON_SIZE_MENU);
 }
 
 static void
@@ -425,6 +462,8 @@ empathy_roster_contact_dispose (GObject *object)
       ((GObjectClass *) empathy_roster_contact_parent_class)->dispose;
 
   g_clear_object (&self->priv->individual);
+  g_clear_object (&self->priv->content);
+  self->priv->widgets = NULL;
 
   if (chain_up != NULL)
     chain_up (object);
@@ -488,18 +527,25 @@ empathy_roster_contact_class_init (
       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
   g_object_class_install_property (oclass, PROP_MOST_RECENT_EVENT, spec);
 
+  contact_widgets_quark = g_quark_from_static_string (
+      "empathy-roster-contact-widgets");
+
   g_type_class_add_private (klass, sizeof (EmpathyRosterContactPriv));
 }
 
 static void
-empathy_roster_contact_init (EmpathyRosterContact *self)
+contact_widgets_free (gpointer data)
 {
+  g_slice_free (ContactWidgets, data);
+}
+
+static GtkWidget *
+contact_widgets_new (void)
+{
+  ContactWidgets *widgets = g_slice_new (ContactWidgets);
   GtkWidget *alig, *main_box, *box, *first_line_box;
   GtkStyleContext *context;
 
-  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
-      EMPATHY_TYPE_ROSTER_CONTACT, EmpathyRosterContactPriv);
-
   alig = gtk_alignment_new (0.5, 0.5, 1, 1);
   gtk_widget_show (alig);
   gtk_alignment_set_padding (GTK_ALIGNMENT (alig), 4, 4, 4, 12);
@@ -507,37 +553,37 @@ empathy_roster_contact_init (EmpathyRosterContact *self)
   main_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
 
   /* Avatar */
-  self->priv->avatar = gtk_image_new ();
+  widgets->avatar = gtk_image_new ();
 
-  gtk_widget_set_size_request (self->priv->avatar, AVATAR_SIZE, AVATAR_SIZE);
+  gtk_widget_set_size_request (widgets->avatar, AVATAR_SIZE, AVATAR_SIZE);
 
-  gtk_box_pack_start (GTK_BOX (main_box), self->priv->avatar, FALSE, FALSE, 0);
-  gtk_widget_show (self->priv->avatar);
+  gtk_box_pack_start (GTK_BOX (main_box), widgets->avatar, FALSE, FALSE, 0);
+  gtk_widget_show (widgets->avatar);
 
   box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
 
   /* Alias and phone icon */
-  self->priv->first_line_alig = gtk_alignment_new (0, 0.5, 1, 1);
+  widgets->first_line_alig = gtk_alignment_new (0, 0.5, 1, 1);
   first_line_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
 
-  self->priv->alias = gtk_label_new (NULL);
-  gtk_label_set_ellipsize (GTK_LABEL (self->priv->alias), PANGO_ELLIPSIZE_END);
-  gtk_box_pack_start (GTK_BOX (first_line_box), self->priv->alias,
+  widgets->alias = gtk_label_new (NULL);
+  gtk_label_set_ellipsize (GTK_LABEL (widgets->alias), PANGO_ELLIPSIZE_END);
+  gtk_box_pack_start (GTK_BOX (first_line_box), widgets->alias,
       FALSE, FALSE, 0);
-  gtk_misc_set_alignment (GTK_MISC (self->priv->alias), 0, 0.5);
-  gtk_widget_show (self->priv->alias);
+  gtk_misc_set_alignment (GTK_MISC (widgets->alias), 0, 0.5);
+  gtk_widget_show (widgets->alias);
 
-  self->priv->phone_icon = gtk_image_new_from_icon_name ("phone-symbolic",
+  widgets->phone_icon = gtk_image_new_from_icon_name ("phone-symbolic",
       GTK_ICON_SIZE_MENU);
-  gtk_misc_set_alignment (GTK_MISC (self->priv->phone_icon), 0, 0.5);
-  gtk_box_pack_start (GTK_BOX (first_line_box), self->priv->phone_icon,
+  gtk_misc_set_alignment (GTK_MISC (widgets->phone_icon), 0, 0.5);
+  gtk_box_pack_start (GTK_BOX (first_line_box), widgets->phone_icon,
       TRUE, TRUE, 0);
 
-  gtk_container_add (GTK_CONTAINER (self->priv->first_line_alig),
+  gtk_container_add (GTK_CONTAINER (widgets->first_line_alig),
       first_line_box);
-  gtk_widget_show (self->priv->first_line_alig);
+  gtk_widget_show (widgets->first_line_alig);
 
-  gtk_box_pack_start (GTK_BOX (box), self->priv->first_line_alig,
+  gtk_box_pack_start (GTK_BOX (box), widgets->first_line_alig,
       TRUE, TRUE, 0);
   gtk_widget_show (first_line_box);
 
@@ -545,42 +591,81 @@ empathy_roster_contact_init (EmpathyRosterContact *self)
   gtk_widget_show (box);
 
   /* Presence */
-  self->priv->presence_msg = gtk_label_new (NULL);
-  gtk_label_set_ellipsize (GTK_LABEL (self->priv->presence_msg),
+  widgets->presence_msg = gtk_label_new (NULL);
+  gtk_label_set_ellipsize (GTK_LABEL (widgets->presence_msg),
       PANGO_ELLIPSIZE_END);
   /*
-  gtk_box_pack_start (GTK_BOX (box), self->priv->presence_msg, TRUE, TRUE, 0);
-  gtk_widget_show (self->priv->presence_msg);
+  gtk_box_pack_start (GTK_BOX (box), widgets->presence_msg, TRUE, TRUE, 0);
+  gtk_widget_show (widgets->presence_msg);
   */
 
-  context = gtk_widget_get_style_context (self->priv->presence_msg);
+  context = gtk_widget_get_style_context (widgets->presence_msg);
   gtk_style_context_add_class (context, GTK_STYLE_CLASS_DIM_LABEL);
 
   /* Most recent message */
-  self->priv->most_recent_msg = gtk_label_new (NULL);
-  gtk_label_set_ellipsize (GTK_LABEL (self->priv->most_recent_msg),
+  widgets->most_recent_msg = gtk_label_new (NULL);
+  gtk_label_set_ellipsize (GTK_LABEL (widgets->most_recent_msg),
       PANGO_ELLIPSIZE_END);
-  gtk_box_pack_start (GTK_BOX (box), self->priv->most_recent_msg, TRUE, TRUE, 0);
-  gtk_widget_show (self->priv->most_recent_msg);
+  gtk_box_pack_start (GTK_BOX (box), widgets->most_recent_msg, TRUE, TRUE, 0);
+  gtk_widget_show (widgets->most_recent_msg);
 
-  context = gtk_widget_get_style_context (self->priv->most_recent_msg);
+  context = gtk_widget_get_style_context (widgets->most_recent_msg);
   gtk_style_context_add_class (context, GTK_STYLE_CLASS_DIM_LABEL);
 
   /* Presence icon */
-  self->priv->presence_icon = gtk_image_new ();
+  widgets->presence_icon = gtk_image_new ();
 
-  gtk_box_pack_start (GTK_BOX (main_box), self->priv->presence_icon,
+  gtk_box_pack_start (GTK_BOX (main_box), widgets->presence_icon,
       FALSE, FALSE, 0);
-  gtk_widget_show (self->priv->presence_icon);
+  gtk_widget_show (widgets->presence_icon);
 
-  gtk_container_add (GTK_CONTAINER (self), alig);
   gtk_container_add (GTK_CONTAINER (alig), main_box);
   gtk_widget_show (main_box);
+
+  g_object_set_qdata_full (G_OBJECT (alig), contact_widgets_quark, widgets,
+      contact_widgets_free);
+
+  return alig;
+}
+
+static void
+empathy_roster_contact_init (EmpathyRosterContact *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_ROSTER_CONTACT, EmpathyRosterContactPriv);
+
+  gtk_widget_set_size_request (GTK_WIDGET (self), -1, UNBOUND_HEIGHT);
 }
 
 GtkWidget *
 empathy_roster_contact_new (FolksIndividual *individual,
     const gchar *group)
+{
+  GtkWidget *self;
+
+  self = empathy_roster_contact_new_unbound (individual, group);
+  g_return_val_if_fail (self != NULL, NULL);
+
+  empathy_roster_contact_bind (EMPATHY_ROSTER_CONTACT (self), NULL);
+
+  return self;
+}
+
+/**
+ * empathy_roster_contact_new_unbound:
+ * @individual: a #FolksIndividual
+ * @group: (allow-none): the group of the row
+ *
+ * Creates a row without any child widget, taking as much space as a row
+ * displaying @individual. It's cheap enough to create one for each
+ * individual of a huge roster and only bind the visible ones, see
+ * empathy_roster_contact_bind().
+ *
+ * Returns: (transfer floating): a new #EmpathyRosterContact
+ */
+GtkWidget *
+empathy_roster_contact_new_unbound (FolksIndividual *individual,
+    const gchar *group)
 {
   g_return_val_if_fail (FOLKS_IS_INDIVIDUAL (individual), NULL);
 
@@ -590,6 +675,79 @@ empathy_roster_contact_new (FolksIndividual *individual,
       NULL);
 }
 
+/**
+ * empathy_roster_contact_bind:
+ * @self: an unbound #EmpathyRosterContact
+ * @content: (allow-none) (transfer full): widgets previously returned by
+ *   empathy_roster_contact_unbind(), or %NULL to create new ones
+ *
+ * Displays the individual of @self, in @content if not %NULL.
+ */
+void
+empathy_roster_contact_bind (EmpathyRosterContact *self,
+    GtkWidget *content)
+{
+  g_return_if_fail (self->priv->content == NULL);
+
+  if (content == NULL)
+    content = g_object_ref_sink (contact_widgets_new ());
+
+  self->priv->content = content;
+  self->priv->widgets = g_object_get_qdata (G_OBJECT (content),
+      contact_widgets_quark);
+  g_assert (self->priv->widgets != NULL);
+
+  gtk_widget_set_size_request (GTK_WIDGET (self), -1, -1);
+  gtk_container_add (GTK_CONTAINER (self), content);
+
+  update_avatar (self);
+  update_alias (self);
+  update_presence_msg (self);
+  update_presence_icon (self);
+  update_most_recent_msg (self);
+}
+
+/**
+ * empathy_roster_contact_unbind:
+ * @self: a #EmpathyRosterContact
+ *
+ * Removes the widgets displaying the individual of @self, keeping the size
+ * of the row.
+ *
+ * Returns: (transfer full): the widgets, to be recycled by
+ *   empathy_roster_contact_bind(), or %NULL if @self was not bound
+ */
+GtkWidget *
+empathy_roster_contact_unbind (EmpathyRosterContact *self)
+{
+  GtkWidget *content = self->priv->content;
+  gint height;
+
+  if (content == NULL)
+    return NULL;
+
+  height = gtk_widget_get_allocated_height (GTK_WIDGET (self));
+
+  /* Don't keep the avatar alive while the widgets are waiting to be
+   * recycled */
+  gtk_image_clear (GTK_IMAGE (self->priv->widgets->avatar));
+
+  self->priv->content = NULL;
+  self->priv->widgets = NULL;
+
+  gtk_container_remove (GTK_CONTAINER (self), content);
+  gtk_widget_set_size_request (GTK_WIDGET (self), -1,
+      height > 1 ? height : UNBOUND_HEIGHT);
+
+  return content;
+}
+
+gboolean
+empathy_roster_contact_is_bound (EmpathyRosterContact *self)
+{
+  return self->priv->content != NULL;
+}
+
 FolksIndividual *
 empathy_roster_contact_get_individual (EmpathyRosterContact *self)
 {
@@ -627,8 +785,12 @@ empathy_roster_contact_set_event_icon (EmpathyRosterContact *self,
   update_presence_icon (self);
 }
 
+/* Returns NULL if @self is not bound */
 GdkPixbuf *
 empathy_roster_contact_get_avatar_pixbuf (EmpathyRosterContact *self)
 {
-  return gtk_image_get_pixbuf (GTK_IMAGE (self->priv->avatar));
+  if (self->priv->widgets == NULL)
+    return NULL;
+
+  return gtk_image_get_pixbuf (GTK_IMAGE (self->priv->widgets->avatar));
 }
@@ -51,6 +51,16 @@ GType empathy_roster_contact_get_type (void);
 GtkWidget * empathy_roster_contact_new (FolksIndividual *individual,
     const gchar *group);
 
+GtkWidget * empathy_roster_contact_new_unbound (FolksIndividual *individual,
+    const gchar *group);
+
+void empathy_roster_contact_bind (EmpathyRosterContact *self,
+    GtkWidget *content);
+
+GtkWidget * empathy_roster_contact_unbind (EmpathyRosterContact *self);
+
+gboolean empathy_roster_contact_is_bound (EmpathyRosterContact *self);
+
 FolksIndividual * empathy_roster_contact_get_individual (EmpathyRosterContact *self);
 
 EmpathyContact * empathy_roster_contact_get_contact (EmpathyRosterContact *self);
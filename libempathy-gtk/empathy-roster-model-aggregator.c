@@ -81,6 +81,8 @@ struct _EmpathyRosterModelAggregatorPriv
 
   EmpathyRosterModelAggregatorFilterFunc filter_func;
   gpointer filter_data;
+
+  gboolean loaded;
 };
 
 static void
@@ -218,6 +220,20 @@ aggregator_individuals_changed_cb (FolksIndividualAggregator *aggregator,
     }
 }
 
+static void
+aggregator_is_quiescent_notify_cb (FolksIndividualAggregator *aggregator,
+    GParamSpec *spec,
+    EmpathyRosterModelAggregator *self)
+{
+  if (self->priv->loaded ||
+      !folks_individual_aggregator_get_is_quiescent (aggregator))
+    return;
+
+  self->priv->loaded = TRUE;
+
+  empathy_roster_model_fire_loaded (EMPATHY_ROSTER_MODEL (self));
+}
+
 static void
 empathy_roster_model_aggregator_get_property (GObject *object,
     guint property_id,
@@ -288,10 +304,15 @@ empathy_roster_model_aggregator_constructed (GObject *object)
 
   tp_g_signal_connect_object (self->priv->aggregator, "individuals-changed",
       G_CALLBACK (aggregator_individuals_changed_cb), self, 0);
+  tp_g_signal_connect_object (self->priv->aggregator, "notify::is-quiescent",
+      G_CALLBACK (aggregator_is_quiescent_notify_cb), self, 0);
 
   folks_individual_aggregator_prepare (self->priv->aggregator, NULL, NULL);
 
   populate_individuals (self);
+
+  self->priv->loaded = folks_individual_aggregator_get_is_quiescent (
+      self->priv->aggregator);
 }
 
 static void
@@ -420,10 +441,19 @@ empathy_roster_model_aggregator_dup_groups_for_individual (
   return groups_list;
 }
 
+static gboolean
+empathy_roster_model_aggregator_is_loaded (EmpathyRosterModel *model)
+{
+  EmpathyRosterModelAggregator *self = EMPATHY_ROSTER_MODEL_AGGREGATOR (model);
+
+  return self->priv->loaded;
+}
+
 static void
 roster_model_iface_init (EmpathyRosterModelInterface *iface)
 {
   iface->get_individuals = empathy_roster_model_aggregator_get_individuals;
   iface->dup_groups_for_individual =
     empathy_roster_model_aggregator_dup_groups_for_individual;
+  iface->is_loaded = empathy_roster_model_aggregator_is_loaded;
 }
@@ -238,6 +238,13 @@ favourites_changed_cb (EmpathyIndividualManager *manager,
     }
 }
 
+static void
+contacts_loaded_cb (EmpathyIndividualManager *manager,
+    EmpathyRosterModelManager *self)
+{
+  empathy_roster_model_fire_loaded (EMPATHY_ROSTER_MODEL (self));
+}
+
 static void
 empathy_roster_model_manager_get_property (GObject *object,
     guint property_id,
@@ -299,6 +306,8 @@ empathy_roster_model_manager_constructed (GObject *object)
       G_CALLBACK (top_individuals_changed_cb), self, 0);
   tp_g_signal_connect_object (self->priv->manager, "favourites-changed",
       G_CALLBACK (favourites_changed_cb), self, 0);
+  tp_g_signal_connect_object (self->priv->manager, "contacts-loaded",
+      G_CALLBACK (contacts_loaded_cb), self, 0);
 }
 
 static void
@@ -412,10 +421,19 @@ empathy_roster_model_manager_dup_groups_for_individual (
   return groups_list;
 }
 
+static gboolean
+empathy_roster_model_manager_is_loaded (EmpathyRosterModel *model)
+{
+  EmpathyRosterModelManager *self = EMPATHY_ROSTER_MODEL_MANAGER (model);
+
+  return empathy_individual_manager_get_contacts_loaded (self->priv->manager);
+}
+
 static void
 roster_model_iface_init (EmpathyRosterModelInterface *iface)
 {
   iface->get_individuals = empathy_roster_model_manager_get_individuals;
   iface->dup_groups_for_individual =
     empathy_roster_model_manager_dup_groups_for_individual;
+  iface->is_loaded = empathy_roster_model_manager_is_loaded;
 }
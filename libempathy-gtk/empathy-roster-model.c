@@ -27,6 +27,7 @@ enum
   SIG_INDIVIDUAL_ADDED,
   SIG_INDIVIDUAL_REMOVED,
   SIG_GROUPS_CHANGED,
+  SIG_LOADED,
   LAST_SIGNAL
 };
 
@@ -60,6 +61,16 @@ empathy_roster_model_default_init (EmpathyRosterModelInterface *iface)
         FOLKS_TYPE_INDIVIDUAL,
         G_TYPE_STRING,
         G_TYPE_BOOLEAN);
+
+  /* Emitted once, when the model has been populated with the individuals
+   * it knew about at startup. The individuals added after that are the ones
+   * appearing while the roster is used. */
+  signals[SIG_LOADED] =
+    g_signal_new ("loaded",
+        EMPATHY_TYPE_ROSTER_MODEL,
+        G_SIGNAL_RUN_LAST,
+        0, NULL, NULL, NULL,
+        G_TYPE_NONE, 0);
 }
 
 /***** Restricted *****/
@@ -88,6 +99,12 @@ empathy_roster_model_fire_groups_changed (EmpathyRosterModel *self,
       is_member);
 }
 
+void
+empathy_roster_model_fire_loaded (EmpathyRosterModel *self)
+{
+  g_signal_emit (self, signals[SIG_LOADED], 0);
+}
+
 /***** Public *****/
 
 /**
@@ -134,3 +151,25 @@ empathy_roster_model_dup_groups_for_individual (EmpathyRosterModel *self,
 
   return (* iface->dup_groups_for_individual) (self, individual);
 }
+
+/**
+ * empathy_roster_model_is_loaded:
+ * @self: a #EmpathyRosterModel
+ *
+ * Returns whether @self has finished its initial load, see the
+ * #EmpathyRosterModel::loaded signal.
+ *
+ * Returns: %TRUE if the initial set of individuals has been added
+ */
+gboolean
+empathy_roster_model_is_loaded (EmpathyRosterModel *self)
+{
+  EmpathyRosterModelInterface *iface;
+
+  g_return_val_if_fail (EMPATHY_IS_ROSTER_MODEL (self), FALSE);
+
+  iface = EMPATHY_ROSTER_MODEL_GET_IFACE (self);
+  g_return_val_if_fail (iface->is_loaded != NULL, FALSE);
+
+  return (* iface->is_loaded) (self);
+}
@@ -40,6 +40,7 @@ struct _EmpathyRosterModelInterface
   GList * (* get_individuals) (EmpathyRosterModel *self);
   GList * (*dup_groups_for_individual) (EmpathyRosterModel *self,
       FolksIndividual *individual);
+  gboolean (* is_loaded) (EmpathyRosterModel *self);
 };
 
 GType empathy_roster_model_get_type (void);
@@ -72,6 +73,8 @@ void empathy_roster_model_fire_groups_changed (EmpathyRosterModel *self,
     const gchar *group,
     gboolean is_member);
 
+void empathy_roster_model_fire_loaded (EmpathyRosterModel *self);
+
 /* Public API */
 GList * empathy_roster_model_get_individuals (EmpathyRosterModel *self);
 
@@ -79,6 +82,8 @@ GList * empathy_roster_model_dup_groups_for_individual (
     EmpathyRosterModel *self,
     FolksIndividual *individual);
 
+gboolean empathy_roster_model_is_loaded (EmpathyRosterModel *self);
+
 G_END_DECLS
 
 #endif /* #ifndef __EMPATHY_ROSTER_MODEL_H__*/
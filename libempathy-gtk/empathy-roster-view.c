@@ -6,7 +6,9 @@
 #include "empathy-contact-groups.h"
 #include "empathy-roster-contact.h"
 #include "empathy-roster-group.h"
+#include "empathy-search-index.h"
 #include "empathy-ui-utils.h"
+#include "empathy-utils.h"
 
 G_DEFINE_TYPE (EmpathyRosterView, empathy_roster_view, GTK_TYPE_LIST_BOX)
 
@@ -17,6 +19,14 @@ G_DEFINE_TYPE (EmpathyRosterView, empathy_roster_view, GTK_TYPE_LIST_BOX)
  * of the live search. */
 #define SEARCH_TIMEOUT 500
 
+/* Time in milliseconds spent creating rows before returning to the main loop
+ * when populating the view. */
+#define POPULATE_TIME_SLICE 10
+
+/* Above this number of individuals, only the rows close to the visible part of
+ * the view have widgets, see update_bound_rows(). */
+#define VIRTUAL_THRESHOLD 1000
+
 enum
 {
   PROP_MODEL = 1,
@@ -51,6 +61,8 @@ struct _EmpathyRosterViewPriv
   GHashTable *roster_contacts;
   /* (gchar *group_name) -> EmpathyRosterGroup (borrowed) */
   GHashTable *roster_groups;
+  /* (gchar *group_name) -> (gchar *) g_utf8_collate_key() of the name */
+  GHashTable *group_keys;
   /* Hash of the EmpathyRosterContact currently displayed */
   GHashTable *displayed_contacts;
 
@@ -63,11 +75,40 @@ struct _EmpathyRosterViewPriv
 
   guint search_id;
 
+  /* TRUE while the view is being populated, see populate_view() */
+  gboolean loading;
+  /* TRUE while rows are inserted without being sorted */
+  gboolean sort_deferred;
+  /* FolksIndividual (owned) waiting for their rows, sorted by alias */
+  GSequence *pending;
+  /* FolksIndividual (borrowed) -> its GSequenceIter in pending */
+  GHashTable *pending_iters;
+  guint populate_id;
+
+  /* TRUE if the rows are bound to their widgets only when they are about to
+   * be displayed, see update_bound_rows() */
+  gboolean virtual;
+  /* Set of the EmpathyRosterContact (borrowed) bound in virtual mode */
+  GHashTable *bound_contacts;
+  /* queue of widgets (owned) unbound from their row, to be recycled */
+  GQueue *recycled;
+  guint bind_id;
+  /* The vertical GtkAdjustment of the view we are following, if any */
+  GtkAdjustment *adjustment;
+
   gboolean show_offline;
   gboolean show_groups;
   gboolean empty;
 
   TpawLiveSearch *search;
+  /* Search keys of each FolksIndividual (borrowed) */
+  EmpathySearchIndex *search_index;
+  /* Set of the FolksIndividual (borrowed) matching search_hits_text, NULL if
+   * not computed yet. See update_search_hits() */
+  GHashTable *search_hits;
+  gchar *search_hits_text;
+  /* tpaw_live_search_strip_utf8_string (search_hits_text), may be NULL */
+  GPtrArray *search_hits_words;
 
   EmpathyRosterModel *model;
 };
@@ -76,6 +117,7 @@ struct _EmpathyRosterViewPriv
 static void remove_from_group (EmpathyRosterView *self,
     FolksIndividual *individual,
     const gchar *group);
+static gboolean is_searching (EmpathyRosterView *self);
 
 typedef struct
 {
@@ -164,6 +206,201 @@ empathy_roster_view_set_property (GObject *object,
     }
 }
 
+static void
+clear_recycled (EmpathyRosterView *self)
+{
+  GtkWidget *content;
+
+  while ((content = g_queue_pop_head (self->priv->recycled)) != NULL)
+    g_object_unref (content);
+}
+
+/* Rosters synchronized from a big directory can have tens of thousands of
+ * individuals. Instead of having the widgets of all of them, the rows in the
+ * visible page and the ones just above and below are bound to widgets; the
+ * others are empty rows of the same size, whose widgets are recycled. */
+static void
+update_bound_rows (EmpathyRosterView *self)
+{
+  GtkListBox *box = GTK_LIST_BOX (self);
+  GtkAdjustment *adjustment;
+  GtkListBoxRow *row, *last;
+  GHashTable *bound;
+  GHashTableIter iter;
+  gpointer k;
+  gint top, bottom, height, y, i, end;
+
+  /* The rows aren't allocated yet */
+  if (!gtk_widget_get_mapped (GTK_WIDGET (self)))
+    return;
+
+  adjustment = gtk_list_box_get_adjustment (box);
+  if (adjustment != NULL)
+    {
+      gdouble value, page;
+
+      value = gtk_adjustment_get_value (adjustment);
+      page = gtk_adjustment_get_page_size (adjustment);
+
+      top = value - page;
+      bottom = value + 2 * page;
+    }
+  else
+    {
+      top = 0;
+      bottom = gtk_widget_get_allocated_height (GTK_WIDGET (self));
+    }
+
+  bound = g_hash_table_new (NULL, NULL);
+
+  /* There is no row at the y of a header, such as the separators added by
+   * update_header(), so look further down for the first row and further up
+   * for the last one. Filtered out rows keep their old allocation, so only
+   * the rows in between are looked at. */
+  height = gtk_widget_get_allocated_height (GTK_WIDGET (self));
+  top = MAX (top, 0);
+  bottom = MIN (bottom, height - 1);
+
+  row = NULL;
+  for (y = top; row == NULL && y <= bottom; y++)
+    row = gtk_list_box_get_row_at_y (box, y);
+
+  last = NULL;
+  for (y = bottom; last == NULL && y >= top; y--)
+    last = gtk_list_box_get_row_at_y (box, y);
+
+  if (row != NULL && last != NULL)
+    {
+      i = gtk_list_box_row_get_index (row);
+      end = gtk_list_box_row_get_index (last);
+    }
+  else
+    {
+      i = 0;
+      end = -1;
+    }
+
+  for (; i <= end; i++)
+    {
+      row = gtk_list_box_get_row_at_index (box, i);
+
+      /* Filtered out */
+      if (!gtk_widget_get_child_visible (GTK_WIDGET (row)))
+        continue;
+
+      if (EMPATHY_IS_ROSTER_CONTACT (row))
+        g_hash_table_add (bound, row);
+    }
+
+  g_hash_table_iter_init (&iter, self->priv->bound_contacts);
+  while (g_hash_table_iter_next (&iter, &k, NULL))
+    {
+      GtkWidget *content;
+
+      if (g_hash_table_contains (bound, k))
+        continue;
+
+      content = empathy_roster_contact_unbind (EMPATHY_ROSTER_CONTACT (k));
+      if (content != NULL)
+        g_queue_push_head (self->priv->recycled, content);
+    }
+
+  g_hash_table_iter_init (&iter, bound);
+  while (g_hash_table_iter_next (&iter, &k, NULL))
+    {
+      if (empathy_roster_contact_is_bound (EMPATHY_ROSTER_CONTACT (k)))
+        continue;
+
+      /* Creates new widgets if there is none to recycle */
+      empathy_roster_contact_bind (EMPATHY_ROSTER_CONTACT (k),
+          g_queue_pop_head (self->priv->recycled));
+    }
+
+  g_hash_table_unref (self->priv->bound_contacts);
+  self->priv->bound_contacts = bound;
+}
+
+static gboolean
+update_bound_rows_cb (gpointer user_data)
+{
+  EmpathyRosterView *self = user_data;
+
+  self->priv->bind_id = 0;
+  update_bound_rows (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_update_bound_rows (EmpathyRosterView *self)
+{
+  if (!self->priv->virtual || self->priv->bind_id != 0)
+    return;
+
+  self->priv->bind_id = g_idle_add (update_bound_rows_cb, self);
+}
+
+static void
+adjustment_value_changed_cb (GtkAdjustment *adjustment,
+    EmpathyRosterView *self)
+{
+  schedule_update_bound_rows (self);
+}
+
+static void
+set_adjustment (EmpathyRosterView *self,
+    GtkAdjustment *adjustment)
+{
+  if (self->priv->adjustment == adjustment)
+    return;
+
+  if (self->priv->adjustment != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (self->priv->adjustment,
+          adjustment_value_changed_cb, self);
+      g_clear_object (&self->priv->adjustment);
+    }
+
+  if (adjustment != NULL)
+    {
+      self->priv->adjustment = g_object_ref (adjustment);
+      g_signal_connect (adjustment, "value-changed",
+          G_CALLBACK (adjustment_value_changed_cb), self);
+    }
+}
+
+static void
+update_virtual (EmpathyRosterView *self)
+{
+  GHashTableIter iter;
+  gpointer v;
+
+  if (self->priv->virtual)
+    return;
+
+  if (g_hash_table_size (self->priv->roster_contacts) +
+      g_hash_table_size (self->priv->pending_iters) <= VIRTUAL_THRESHOLD)
+    return;
+
+  self->priv->virtual = TRUE;
+
+  /* The rows created so far are bound, until update_bound_rows() sees they
+   * are not visible */
+  g_hash_table_iter_init (&iter, self->priv->roster_contacts);
+  while (g_hash_table_iter_next (&iter, NULL, &v))
+    {
+      GHashTable *contacts = v;
+      GHashTableIter contacts_iter;
+      gpointer contact;
+
+      g_hash_table_iter_init (&contacts_iter, contacts);
+      while (g_hash_table_iter_next (&contacts_iter, NULL, &contact))
+        g_hash_table_add (self->priv->bound_contacts, contact);
+    }
+
+  schedule_update_bound_rows (self);
+}
+
 static void
 roster_contact_changed_cb (GtkListBoxRow *child,
     GParamSpec *spec,
@@ -179,7 +416,10 @@ add_roster_contact (EmpathyRosterView *self,
 {
   GtkWidget *contact;
 
-  contact = empathy_roster_contact_new (individual, group);
+  if (self->priv->virtual)
+    contact = empathy_roster_contact_new_unbound (individual, group);
+  else
+    contact = empathy_roster_contact_new (individual, group);
 
   /* Need to refilter if online is changed */
   g_signal_connect (contact, "notify::online",
@@ -196,6 +436,8 @@ add_roster_contact (EmpathyRosterView *self,
   gtk_widget_show (contact);
   gtk_container_add (GTK_CONTAINER (self), contact);
 
+  schedule_update_bound_rows (self);
+
   return contact;
 }
 
@@ -292,6 +534,10 @@ at_least_one_group_displayed (EmpathyRosterView *self)
 static void
 check_if_empty (EmpathyRosterView *self)
 {
+  /* Checked once the pending individuals are added, see populate_done() */
+  if (self->priv->populate_id != 0)
+    return;
+
   /* Roster is considered as empty if there is no contact *and* no group
    * currently displayed. */
   if (g_hash_table_size (self->priv->displayed_contacts) != 0 ||
@@ -390,6 +636,72 @@ individual_favourite_change_cb (FolksIndividual *individual,
   gtk_list_box_row_changed (GTK_LIST_BOX_ROW (contact));
 }
 
+static void
+update_search_keys (EmpathyRosterView *self,
+    FolksIndividual *individual)
+{
+  GeeSet *personas;
+  GeeIterator *iter;
+  GPtrArray *ids;
+
+  ids = g_ptr_array_new ();
+
+  personas = folks_individual_get_personas (individual);
+  iter = gee_iterable_iterator (GEE_ITERABLE (personas));
+  while (gee_iterator_next (iter))
+    {
+      FolksPersona *persona = gee_iterator_get (iter);
+
+      /* The individual keeps the persona and its id alive */
+      if (empathy_folks_persona_is_interesting (persona))
+        g_ptr_array_add (ids, (gpointer) folks_persona_get_display_id (persona));
+
+      g_clear_object (&persona);
+    }
+  g_clear_object (&iter);
+
+  g_ptr_array_add (ids, NULL);
+
+  empathy_search_index_set (self->priv->search_index, individual,
+      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)),
+      (const gchar * const *) ids->pdata);
+
+  g_ptr_array_unref (ids);
+
+  /* Keep the current results right */
+  if (self->priv->search_hits == NULL)
+    return;
+
+  if (empathy_search_index_match (self->priv->search_index, individual,
+        self->priv->search_hits_text, self->priv->search_hits_words))
+    g_hash_table_add (self->priv->search_hits, individual);
+  else
+    g_hash_table_remove (self->priv->search_hits, individual);
+}
+
+static void
+individual_search_keys_changed_cb (FolksIndividual *individual,
+    GParamSpec *spec,
+    EmpathyRosterView *self)
+{
+  GHashTable *contacts;
+  GHashTableIter iter;
+  gpointer v;
+
+  update_search_keys (self, individual);
+
+  if (!is_searching (self))
+    return;
+
+  contacts = g_hash_table_lookup (self->priv->roster_contacts, individual);
+  if (contacts == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, contacts);
+  while (g_hash_table_iter_next (&iter, NULL, &v))
+    gtk_list_box_row_changed (GTK_LIST_BOX_ROW (v));
+}
+
 static void
 individual_added (EmpathyRosterView *self,
     FolksIndividual *individual)
@@ -404,6 +716,8 @@ individual_added (EmpathyRosterView *self,
 
   g_hash_table_insert (self->priv->roster_contacts, individual, contacts);
 
+  update_virtual (self);
+
   if (!self->priv->show_groups)
     {
       add_to_group (self, individual, NO_GROUP);
@@ -433,6 +747,17 @@ individual_added (EmpathyRosterView *self,
 
   tp_g_signal_connect_object (individual, "notify::is-favourite",
       G_CALLBACK (individual_favourite_change_cb), self, 0);
+
+  /* The view may be populated again, see empathy_roster_view_show_groups() */
+  g_signal_handlers_disconnect_by_func (individual,
+      individual_search_keys_changed_cb, self);
+
+  update_search_keys (self, individual);
+
+  tp_g_signal_connect_object (individual, "notify::alias",
+      G_CALLBACK (individual_search_keys_changed_cb), self, 0);
+  tp_g_signal_connect_object (individual, "notify::personas",
+      G_CALLBACK (individual_search_keys_changed_cb), self, 0);
 }
 
 static void
@@ -576,6 +901,66 @@ individual_removed (EmpathyRosterView *self,
     }
 
   g_hash_table_remove (self->priv->roster_contacts, individual);
+
+  g_signal_handlers_disconnect_by_func (individual,
+      individual_search_keys_changed_cb, self);
+
+  empathy_search_index_remove (self->priv->search_index, individual);
+  if (self->priv->search_hits != NULL)
+    g_hash_table_remove (self->priv->search_hits, individual);
+}
+
+static gint
+compare_individuals_by_alias (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  return empathy_individual_compare_alias ((FolksIndividual *) a,
+      (FolksIndividual *) b);
+}
+
+static gboolean populate_cb (gpointer user_data);
+
+static void
+schedule_populate (EmpathyRosterView *self)
+{
+  if (self->priv->populate_id != 0)
+    return;
+
+  self->priv->populate_id = g_idle_add (populate_cb, self);
+}
+
+static void
+add_pending (EmpathyRosterView *self,
+    FolksIndividual *individual)
+{
+  GSequenceIter *iter;
+
+  if (g_hash_table_contains (self->priv->roster_contacts, individual) ||
+      g_hash_table_contains (self->priv->pending_iters, individual))
+    return;
+
+  iter = g_sequence_insert_sorted (self->priv->pending,
+      g_object_ref (individual), compare_individuals_by_alias, NULL);
+  g_hash_table_insert (self->priv->pending_iters, individual, iter);
+
+  update_virtual (self);
+  schedule_populate (self);
+}
+
+static gboolean
+remove_pending (EmpathyRosterView *self,
+    FolksIndividual *individual)
+{
+  GSequenceIter *iter;
+
+  iter = g_hash_table_lookup (self->priv->pending_iters, individual);
+  if (iter == NULL)
+    return FALSE;
+
+  g_hash_table_remove (self->priv->pending_iters, individual);
+  g_sequence_remove (iter);
+  return TRUE;
 }
 
 static void
@@ -583,7 +968,10 @@ individual_added_cb (EmpathyRosterModel *model,
     FolksIndividual *individual,
     EmpathyRosterView *self)
 {
-  individual_added (self, individual);
+  if (self->priv->loading)
+    add_pending (self, individual);
+  else
+    individual_added (self, individual);
 }
 
 static void
@@ -591,6 +979,9 @@ individual_removed_cb (EmpathyRosterModel *model,
     FolksIndividual *individual,
     EmpathyRosterView *self)
 {
+  if (remove_pending (self, individual))
+    return;
+
   individual_removed (self, individual);
 }
 
@@ -648,15 +1039,11 @@ compare_roster_contacts_by_alias (EmpathyRosterContact *a,
     EmpathyRosterContact *b)
 {
   FolksIndividual *ind_a, *ind_b;
-  const gchar *alias_a, *alias_b;
 
   ind_a = empathy_roster_contact_get_individual (a);
   ind_b = empathy_roster_contact_get_individual (b);
 
-  alias_a = folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (ind_a));
-  alias_b = folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (ind_b));
-
-  return g_utf8_collate (alias_a, alias_b);
+  return empathy_individual_compare_alias (ind_a, ind_b);
 }
 
 static gint
@@ -679,8 +1066,25 @@ compare_roster_contacts_no_group (EmpathyRosterView *self,
     return 1;
 }
 
+static const gchar *
+get_group_key (EmpathyRosterView *self,
+    const gchar *group)
+{
+  gchar *key;
+
+  key = g_hash_table_lookup (self->priv->group_keys, group);
+  if (key == NULL)
+    {
+      key = g_utf8_collate_key (group, -1);
+      g_hash_table_insert (self->priv->group_keys, g_strdup (group), key);
+    }
+
+  return key;
+}
+
 static gint
-compare_group_names (const gchar *group_a,
+compare_group_names (EmpathyRosterView *self,
+    const gchar *group_a,
     const gchar *group_b)
 {
   if (!tp_strdiff (group_a, EMPATHY_ROSTER_MODEL_GROUP_TOP_GROUP))
@@ -694,7 +1098,7 @@ compare_group_names (const gchar *group_a,
   else if (!tp_strdiff (group_b, EMPATHY_ROSTER_MODEL_GROUP_UNGROUPED))
     return -1;
 
-  return g_utf8_collate (group_a, group_b);
+  return strcmp (get_group_key (self, group_a), get_group_key (self, group_b));
 }
 
 static gint
@@ -712,7 +1116,7 @@ compare_roster_contacts_with_groups (EmpathyRosterView *self,
     return compare_roster_contacts_by_conversation_time (a, b);
 
   /* Sort by group */
-  return compare_group_names (group_a, group_b);
+  return compare_group_names (self, group_a, group_b);
 }
 
 static gint
@@ -727,7 +1131,8 @@ compare_roster_contacts (EmpathyRosterView *self,
 }
 
 static gint
-compare_roster_groups (EmpathyRosterGroup *a,
+compare_roster_groups (EmpathyRosterView *self,
+    EmpathyRosterGroup *a,
     EmpathyRosterGroup *b)
 {
   const gchar *name_a, *name_b;
@@ -735,11 +1140,12 @@ compare_roster_groups (EmpathyRosterGroup *a,
   name_a = empathy_roster_group_get_name (a);
   name_b = empathy_roster_group_get_name (b);
 
-  return compare_group_names (name_a, name_b);
+  return compare_group_names (self, name_a, name_b);
 }
 
 static gint
-compare_contact_group (EmpathyRosterContact *contact,
+compare_contact_group (EmpathyRosterView *self,
+    EmpathyRosterContact *contact,
     EmpathyRosterGroup *group)
 {
   const char *contact_group, *group_name;
@@ -752,7 +1158,7 @@ compare_contact_group (EmpathyRosterContact *contact,
     return 1;
 
   /* @contact is in a different group, sort by group name */
-  return compare_group_names (contact_group, group_name);
+  return compare_group_names (self, contact_group, group_name);
 }
 
 static gint
@@ -766,13 +1172,13 @@ roster_view_sort (GtkListBoxRow *a,
     return compare_roster_contacts (self, EMPATHY_ROSTER_CONTACT (a),
         EMPATHY_ROSTER_CONTACT (b));
   else if (EMPATHY_IS_ROSTER_GROUP (a) && EMPATHY_IS_ROSTER_GROUP (b))
-    return compare_roster_groups (EMPATHY_ROSTER_GROUP (a),
+    return compare_roster_groups (self, EMPATHY_ROSTER_GROUP (a),
         EMPATHY_ROSTER_GROUP (b));
   else if (EMPATHY_IS_ROSTER_CONTACT (a) && EMPATHY_IS_ROSTER_GROUP (b))
-    return compare_contact_group (EMPATHY_ROSTER_CONTACT (a),
+    return compare_contact_group (self, EMPATHY_ROSTER_CONTACT (a),
         EMPATHY_ROSTER_GROUP (b));
   else if (EMPATHY_IS_ROSTER_GROUP (a) && EMPATHY_IS_ROSTER_CONTACT (b))
-    return -1 * compare_contact_group (EMPATHY_ROSTER_CONTACT (b),
+    return -1 * compare_contact_group (self, EMPATHY_ROSTER_CONTACT (b),
         EMPATHY_ROSTER_GROUP (a));
 
   g_return_val_if_reached (0);
@@ -806,6 +1212,46 @@ is_searching (EmpathyRosterView *self)
   return gtk_widget_get_visible (GTK_WIDGET (self->priv->search));
 }
 
+static void
+clear_search_hits (EmpathyRosterView *self)
+{
+  tp_clear_pointer (&self->priv->search_hits, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->search_hits_text, g_free);
+  tp_clear_pointer (&self->priv->search_hits_words, g_ptr_array_unref);
+}
+
+/* Live search results are computed once for each searched text, when the
+ * first row is filtered, from the search keys of the individuals. When the
+ * user types more, only the previous results can still match. */
+static void
+update_search_hits (EmpathyRosterView *self)
+{
+  const gchar *text;
+  GHashTable *among = NULL;
+  GHashTable *hits;
+  GPtrArray *words;
+
+  text = tpaw_live_search_get_text (self->priv->search);
+
+  if (self->priv->search_hits != NULL &&
+      !tp_strdiff (text, self->priv->search_hits_text))
+    return;
+
+  if (self->priv->search_hits != NULL &&
+      !tp_str_empty (self->priv->search_hits_text) &&
+      g_str_has_prefix (text, self->priv->search_hits_text))
+    among = self->priv->search_hits;
+
+  words = tpaw_live_search_strip_utf8_string (text);
+  hits = empathy_search_index_find (self->priv->search_index, text, words,
+      among);
+
+  clear_search_hits (self);
+  self->priv->search_hits = hits;
+  self->priv->search_hits_text = g_strdup (text);
+  self->priv->search_hits_words = words;
+}
+
 static void
 add_to_displayed (EmpathyRosterView *self,
     EmpathyRosterContact *contact)
@@ -880,9 +1326,9 @@ contact_should_be_displayed (EmpathyRosterView *self,
 
       individual = empathy_roster_contact_get_individual (contact);
 
-      return empathy_individual_match_string (individual,
-          tpaw_live_search_get_text (self->priv->search),
-          tpaw_live_search_get_words (self->priv->search));
+      update_search_hits (self);
+
+      return g_hash_table_contains (self->priv->search_hits, individual);
     }
 
   if (self->priv->show_offline)
@@ -974,20 +1420,95 @@ filter_list (GtkListBoxRow *child,
   g_return_val_if_reached (FALSE);
 }
 
+/* Called each time populate_cb() added all the pending individuals */
+static void
+populate_done (EmpathyRosterView *self)
+{
+  /* Sort the rows at once. The ones added later are inserted sorted. */
+  if (self->priv->sort_deferred)
+    {
+      self->priv->sort_deferred = FALSE;
+      gtk_list_box_set_sort_func (GTK_LIST_BOX (self),
+          roster_view_sort, self, NULL);
+    }
+
+  /* Until the model is loaded, the individuals it adds are queued as well
+   * and model_loaded_cb() finishes the job. */
+  if (empathy_roster_model_is_loaded (self->priv->model))
+    self->priv->loading = FALSE;
+
+  check_if_empty (self);
+}
+
+static gboolean
+populate_cb (gpointer user_data)
+{
+  EmpathyRosterView *self = user_data;
+  GSequenceIter *iter;
+  gint64 end;
+
+  end = g_get_monotonic_time () + POPULATE_TIME_SLICE * 1000;
+
+  for (iter = g_sequence_get_begin_iter (self->priv->pending);
+      !g_sequence_iter_is_end (iter);
+      iter = g_sequence_get_begin_iter (self->priv->pending))
+    {
+      FolksIndividual *individual;
+
+      individual = g_object_ref (g_sequence_get (iter));
+
+      remove_pending (self, individual);
+      individual_added (self, individual);
+
+      g_object_unref (individual);
+
+      if (g_get_monotonic_time () >= end)
+        return G_SOURCE_CONTINUE;
+    }
+
+  self->priv->populate_id = 0;
+  populate_done (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Creating the rows of thousands of individuals one by one, each of them
+ * sorted against the others, takes a while. Instead the rows are created in
+ * alias order from an idle callback, a slice of time at a time. They are
+ * filtered, and so displayed, as they are created, but only sorted and
+ * checked for an empty roster once they have all been created. */
 static void
 populate_view (EmpathyRosterView *self)
 {
   GList *individuals, *l;
 
+  self->priv->loading = TRUE;
+
+  if (!self->priv->sort_deferred)
+    {
+      self->priv->sort_deferred = TRUE;
+      gtk_list_box_set_sort_func (GTK_LIST_BOX (self), NULL, NULL, NULL);
+    }
+
   individuals = empathy_roster_model_get_individuals (self->priv->model);
   for (l = individuals; l != NULL; l = g_list_next (l))
     {
       FolksIndividual *individual = l->data;
 
-      individual_added (self, individual);
+      add_pending (self, individual);
     }
 
   g_list_free (individuals);
+
+  schedule_populate (self);
+}
+
+static void
+model_loaded_cb (EmpathyRosterModel *model,
+    EmpathyRosterView *self)
+{
+  if (self->priv->loading && self->priv->populate_id == 0)
+    populate_done (self);
 }
 
 static void
@@ -1071,9 +1592,8 @@ empathy_roster_view_constructed (GObject *object)
       G_CALLBACK (individual_removed_cb), self, 0);
   tp_g_signal_connect_object (self->priv->model, "groups-changed",
       G_CALLBACK (groups_changed_cb), self, 0);
-
-  gtk_list_box_set_sort_func (GTK_LIST_BOX (self),
-      roster_view_sort, self, NULL);
+  tp_g_signal_connect_object (self->priv->model, "loaded",
+      G_CALLBACK (model_loaded_cb), self, 0);
 
   gtk_list_box_set_header_func (GTK_LIST_BOX (self), update_header, self, NULL);
 
@@ -1085,12 +1605,33 @@ empathy_roster_view_constructed (GObject *object)
 static void
 clear_view (EmpathyRosterView *self)
 {
+  if (self->priv->populate_id != 0)
+    {
+      g_source_remove (self->priv->populate_id);
+      self->priv->populate_id = 0;
+    }
+
+  g_hash_table_remove_all (self->priv->pending_iters);
+  g_sequence_remove_range (g_sequence_get_begin_iter (self->priv->pending),
+      g_sequence_get_end_iter (self->priv->pending));
+
   g_hash_table_remove_all (self->priv->roster_contacts);
   g_hash_table_remove_all (self->priv->roster_groups);
   g_hash_table_remove_all (self->priv->displayed_contacts);
 
   gtk_container_foreach (GTK_CONTAINER (self),
       (GtkCallback) gtk_widget_destroy, NULL);
+
+  /* Populating the view again decides if it's virtual */
+  if (self->priv->bind_id != 0)
+    {
+      g_source_remove (self->priv->bind_id);
+      self->priv->bind_id = 0;
+    }
+
+  self->priv->virtual = FALSE;
+  g_hash_table_remove_all (self->priv->bound_contacts);
+  clear_recycled (self);
 }
 
 static void
@@ -1108,6 +1649,7 @@ empathy_roster_view_dispose (GObject *object)
 
   empathy_roster_view_set_live_search (self, NULL);
   g_clear_object (&self->priv->model);
+  set_adjustment (self, NULL);
 
   if (self->priv->search_id != 0)
     {
@@ -1128,8 +1670,15 @@ empathy_roster_view_finalize (GObject *object)
 
   g_hash_table_unref (self->priv->roster_contacts);
   g_hash_table_unref (self->priv->roster_groups);
+  g_hash_table_unref (self->priv->group_keys);
   g_hash_table_unref (self->priv->displayed_contacts);
   g_queue_free_full (self->priv->events, event_free);
+  empathy_search_index_free (self->priv->search_index);
+  clear_search_hits (self);
+  g_sequence_free (self->priv->pending);
+  g_hash_table_unref (self->priv->pending_iters);
+  g_hash_table_unref (self->priv->bound_contacts);
+  g_queue_free (self->priv->recycled);
 
   if (chain_up != NULL)
     chain_up (object);
@@ -1312,7 +1861,26 @@ empathy_roster_view_remove (GtkContainer *container,
   chain_up (container, widget);
 
   if (EMPATHY_IS_ROSTER_CONTACT (widget))
-    remove_from_displayed (self, (EmpathyRosterContact *) widget);
+    {
+      remove_from_displayed (self, (EmpathyRosterContact *) widget);
+      g_hash_table_remove (self->priv->bound_contacts, widget);
+    }
+}
+
+static void
+empathy_roster_view_size_allocate (GtkWidget *widget,
+    GtkAllocation *allocation)
+{
+  EmpathyRosterView *self = EMPATHY_ROSTER_VIEW (widget);
+  void (*chain_up) (GtkWidget *, GtkAllocation *) =
+      ((GtkWidgetClass *) empathy_roster_view_parent_class)->size_allocate;
+
+  chain_up (widget, allocation);
+
+  /* Rows may have moved or been resized, and the view may have been put in
+   * a different scrolled window. */
+  set_adjustment (self, gtk_list_box_get_adjustment (GTK_LIST_BOX (self)));
+  schedule_update_bound_rows (self);
 }
 
 static void
@@ -1334,6 +1902,7 @@ empathy_roster_view_class_init (
   widget_class->button_press_event = empathy_roster_view_button_press_event;
   widget_class->key_press_event = empathy_roster_view_key_press_event;
   widget_class->query_tooltip = empathy_roster_view_query_tooltip;
+  widget_class->size_allocate = empathy_roster_view_size_allocate;
 
   container_class->remove = empathy_roster_view_remove;
 
@@ -1405,7 +1974,14 @@ empathy_roster_view_init (EmpathyRosterView *self)
       NULL, (GDestroyNotify) g_hash_table_unref);
   self->priv->roster_groups = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, NULL);
+  self->priv->group_keys = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
   self->priv->displayed_contacts = g_hash_table_new (NULL, NULL);
+  self->priv->search_index = empathy_search_index_new ();
+  self->priv->pending = g_sequence_new (g_object_unref);
+  self->priv->pending_iters = g_hash_table_new (NULL, NULL);
+  self->priv->bound_contacts = g_hash_table_new (NULL, NULL);
+  self->priv->recycled = g_queue_new ();
 
   self->priv->events = g_queue_new ();
 
@@ -1444,7 +2020,6 @@ empathy_roster_view_show_groups (EmpathyRosterView *self,
 
   self->priv->show_groups = show;
 
-  /* TODO: block sort/filter? */
   clear_view (self);
   populate_view (self);
 
@@ -0,0 +1,353 @@
+#include "config.h"
+#include "empathy-search-index.h"
+
+#include <string.h>
+#include <tp-account-widgets/tpaw-live-search.h>
+
+/* Search keys of the items displayed in a live searched list, computed
+ * once when the item is added or changes instead of for every item on
+ * every key stroke. Matches the same items as
+ * empathy_individual_match_string(): an item matches if each searched
+ * word is the prefix of a word of its name, or of a word of one of its ids
+ * (without the @server part), or if the searched text is the prefix of one
+ * of its ids.
+ *
+ * All the words and ids are also kept sorted, so the items which can match
+ * are found by looking up the prefix of a single searched word instead of
+ * testing them all. */
+
+typedef struct
+{
+  /* Stripped words of the name, then of each id: GStrv, one per source */
+  GPtrArray *sources;
+  /* The ids as they are */
+  gchar **ids;
+  /* GSequenceIter of the IndexEntry for each word and id */
+  GPtrArray *entries;
+} SearchKeys;
+
+typedef struct
+{
+  /* Owned by the SearchKeys */
+  const gchar *key;
+  /* NULL when looking up a prefix */
+  gpointer item;
+} IndexEntry;
+
+struct _EmpathySearchIndex
+{
+  /* item -> owned SearchKeys */
+  GHashTable *items;
+  /* IndexEntry for each stripped word, sorted by key */
+  GSequence *words;
+  /* IndexEntry for each id, sorted by key */
+  GSequence *ids;
+};
+
+static gchar **
+search_index_strip (const gchar *str)
+{
+  GPtrArray *words;
+  gchar **result;
+  guint i;
+
+  words = tpaw_live_search_strip_utf8_string (str);
+  if (words == NULL)
+    return g_new0 (gchar *, 1);
+
+  result = g_new (gchar *, words->len + 1);
+  for (i = 0; i < words->len; i++)
+    result[i] = g_strdup (g_ptr_array_index (words, i));
+  result[i] = NULL;
+
+  g_ptr_array_unref (words);
+
+  return result;
+}
+
+static gint
+index_entry_cmp (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  const IndexEntry *entry_a = a;
+  const IndexEntry *entry_b = b;
+  gint result;
+
+  result = strcmp (entry_a->key, entry_b->key);
+  if (result != 0)
+    return result;
+
+  /* A prefix being looked up goes before the entries equal to it */
+  if (entry_a->item == NULL)
+    return -1;
+  if (entry_b->item == NULL)
+    return 1;
+
+  return 0;
+}
+
+static void
+index_entry_free (gpointer data)
+{
+  g_slice_free (IndexEntry, data);
+}
+
+static void
+search_index_add_entry (EmpathySearchIndex *self,
+    SearchKeys *keys,
+    GSequence *seq,
+    const gchar *key,
+    gpointer item)
+{
+  IndexEntry *entry = g_slice_new (IndexEntry);
+
+  entry->key = key;
+  entry->item = item;
+
+  g_ptr_array_add (keys->entries,
+      g_sequence_insert_sorted (seq, entry, index_entry_cmp, NULL));
+}
+
+static void
+search_keys_free (gpointer data)
+{
+  SearchKeys *keys = data;
+  guint i;
+
+  /* Removes the entries pointing to our strings */
+  for (i = 0; i < keys->entries->len; i++)
+    g_sequence_remove (g_ptr_array_index (keys->entries, i));
+
+  g_ptr_array_unref (keys->entries);
+  g_ptr_array_unref (keys->sources);
+  g_strfreev (keys->ids);
+
+  g_slice_free (SearchKeys, keys);
+}
+
+EmpathySearchIndex *
+empathy_search_index_new (void)
+{
+  EmpathySearchIndex *self = g_slice_new (EmpathySearchIndex);
+
+  self->items = g_hash_table_new_full (NULL, NULL, NULL, search_keys_free);
+  self->words = g_sequence_new (index_entry_free);
+  self->ids = g_sequence_new (index_entry_free);
+
+  return self;
+}
+
+void
+empathy_search_index_free (EmpathySearchIndex *self)
+{
+  /* The keys remove their entries from the sequences */
+  g_hash_table_unref (self->items);
+  g_sequence_free (self->words);
+  g_sequence_free (self->ids);
+
+  g_slice_free (EmpathySearchIndex, self);
+}
+
+/* Replaces the keys of @item. @ids may be NULL. */
+void
+empathy_search_index_set (EmpathySearchIndex *self,
+    gpointer item,
+    const gchar *name,
+    const gchar * const *ids)
+{
+  SearchKeys *keys;
+  guint i, j;
+
+  g_return_if_fail (item != NULL);
+
+  keys = g_slice_new (SearchKeys);
+  keys->sources = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) g_strfreev);
+  keys->ids = g_strdupv ((gchar **) ids);
+  keys->entries = g_ptr_array_new ();
+
+  g_ptr_array_add (keys->sources, search_index_strip (name));
+
+  for (i = 0; keys->ids != NULL && keys->ids[i] != NULL; i++)
+    {
+      const gchar *id = keys->ids[i];
+      const gchar *at;
+      gchar *user;
+
+      /* Remove the @server.com part */
+      at = strchr (id, '@');
+      user = g_strndup (id, at != NULL ? at - id : (gssize) strlen (id));
+      g_ptr_array_add (keys->sources, search_index_strip (user));
+      g_free (user);
+
+      search_index_add_entry (self, keys, self->ids, id, item);
+    }
+
+  for (i = 0; i < keys->sources->len; i++)
+    {
+      gchar **words = g_ptr_array_index (keys->sources, i);
+
+      for (j = 0; words[j] != NULL; j++)
+        search_index_add_entry (self, keys, self->words, words[j], item);
+    }
+
+  g_hash_table_replace (self->items, item, keys);
+}
+
+void
+empathy_search_index_remove (EmpathySearchIndex *self,
+    gpointer item)
+{
+  g_hash_table_remove (self->items, item);
+}
+
+static gboolean
+source_match_words (gchar **source,
+    GPtrArray *words)
+{
+  guint i, j;
+
+  for (i = 0; i < words->len; i++)
+    {
+      const gchar *word = g_ptr_array_index (words, i);
+
+      for (j = 0; source[j] != NULL; j++)
+        {
+          if (g_str_has_prefix (source[j], word))
+            break;
+        }
+
+      if (source[j] == NULL)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+search_keys_match (SearchKeys *keys,
+    const gchar *text,
+    GPtrArray *words)
+{
+  guint i;
+
+  if (words == NULL)
+    return TRUE;
+
+  if (source_match_words (g_ptr_array_index (keys->sources, 0), words))
+    return TRUE;
+
+  for (i = 0; keys->ids != NULL && keys->ids[i] != NULL; i++)
+    {
+      /* Accept the id if @text is a full prefix of it; that allows user to
+       * find, say, a jabber contact by typing his JID. */
+      if (g_str_has_prefix (keys->ids[i], text))
+        return TRUE;
+
+      if (source_match_words (g_ptr_array_index (keys->sources, i + 1),
+            words))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* @words = tpaw_live_search_strip_utf8_string (@text), as for
+ * empathy_individual_match_string() */
+gboolean
+empathy_search_index_match (EmpathySearchIndex *self,
+    gpointer item,
+    const gchar *text,
+    GPtrArray *words)
+{
+  SearchKeys *keys;
+
+  keys = g_hash_table_lookup (self->items, item);
+  if (keys == NULL)
+    return FALSE;
+
+  return search_keys_match (keys, text, words);
+}
+
+static void
+search_index_find_prefix (EmpathySearchIndex *self,
+    GSequence *seq,
+    const gchar *prefix,
+    const gchar *text,
+    GPtrArray *words,
+    GHashTable *hits)
+{
+  IndexEntry probe = { prefix, NULL };
+  GSequenceIter *iter;
+
+  for (iter = g_sequence_search (seq, &probe, index_entry_cmp, NULL);
+      !g_sequence_iter_is_end (iter);
+      iter = g_sequence_iter_next (iter))
+    {
+      IndexEntry *entry = g_sequence_get (iter);
+
+      if (!g_str_has_prefix (entry->key, prefix))
+        break;
+
+      if (g_hash_table_contains (hits, entry->item))
+        continue;
+
+      if (empathy_search_index_match (self, entry->item, text, words))
+        g_hash_table_add (hits, entry->item);
+    }
+}
+
+/**
+ * empathy_search_index_find:
+ * @self: an #EmpathySearchIndex
+ * @text: the searched text
+ * @words: tpaw_live_search_strip_utf8_string (@text)
+ * @among: (allow-none): if not %NULL, a set of items including all the
+ *   ones which can match, for example the result of a search for a prefix
+ *   of @text
+ *
+ * Returns: (transfer full): the set of the items matching @text
+ */
+GHashTable *
+empathy_search_index_find (EmpathySearchIndex *self,
+    const gchar *text,
+    GPtrArray *words,
+    GHashTable *among)
+{
+  GHashTable *hits;
+  GHashTableIter iter;
+  gpointer item;
+  const gchar *longest = NULL;
+  guint i;
+
+  hits = g_hash_table_new (NULL, NULL);
+
+  if (among == NULL && words != NULL && words->len > 0)
+    {
+      /* Any match has a word starting with each searched word, look up the
+       * most selective one. */
+      for (i = 0; i < words->len; i++)
+        {
+          const gchar *word = g_ptr_array_index (words, i);
+
+          if (longest == NULL || strlen (word) > strlen (longest))
+            longest = word;
+        }
+
+      search_index_find_prefix (self, self->words, longest, text, words,
+          hits);
+      search_index_find_prefix (self, self->ids, text, text, words, hits);
+
+      return hits;
+    }
+
+  g_hash_table_iter_init (&iter, among != NULL ? among : self->items);
+  while (g_hash_table_iter_next (&iter, &item, NULL))
+    {
+      if (empathy_search_index_match (self, item, text, words))
+        g_hash_table_add (hits, item);
+    }
+
+  return hits;
+}
@@ -0,0 +1,34 @@
+#ifndef __EMPATHY_SEARCH_INDEX_H__
+#define __EMPATHY_SEARCH_INDEX_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathySearchIndex EmpathySearchIndex;
+
+EmpathySearchIndex * empathy_search_index_new (void);
+
+void empathy_search_index_free (EmpathySearchIndex *self);
+
+void empathy_search_index_set (EmpathySearchIndex *self,
+    gpointer item,
+    const gchar *name,
+    const gchar * const *ids);
+
+void empathy_search_index_remove (EmpathySearchIndex *self,
+    gpointer item);
+
+gboolean empathy_search_index_match (EmpathySearchIndex *self,
+    gpointer item,
+    const gchar *text,
+    GPtrArray *words);
+
+GHashTable * empathy_search_index_find (EmpathySearchIndex *self,
+    const gchar *text,
+    GPtrArray *words,
+    GHashTable *among);
+
+G_END_DECLS
+
+#endif /* #ifndef __EMPATHY_SEARCH_INDEX_H__*/
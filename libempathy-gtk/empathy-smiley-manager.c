@@ -23,94 +23,271 @@
 #include "config.h"
 #include "empathy-smiley-manager.h"
 
+#include <string.h>
+
 #include <tp-account-widgets/tpaw-pixbuf-utils.h>
 #include <tp-account-widgets/tpaw-utils.h>
 
 #include "empathy-ui-utils.h"
 #include "empathy-utils.h"
 
-typedef struct _SmileyManagerTree SmileyManagerTree;
+/* Smileys are matched on UTF-8 bytes by an Aho-Corasick automaton. Since
+ * both the smiley strings and the text are valid UTF-8, a byte match always
+ * starts and ends on character boundaries. The goto function is completed
+ * with the failure links into a dense table indexed by byte class, so
+ * matching costs one lookup per byte and never backtracks. */
+#define SMILEY_NO_OUTPUT -1
+
+/* States are numbered with guint16. There is at most one state per byte of
+ * smiley string, plus the root. */
+#define SMILEY_MAX_STATES G_MAXUINT16
+
+/* Smiley images are only looked up the first time they are needed, and
+ * shared between all the strings of a smiley. */
+typedef struct {
+	GdkPixbuf *pixbuf; /* NULL if the icon could not be found */
+	gchar     *path;
+} SmileyImage;
+
+typedef struct {
+	EmpathySmiley  smiley;
+	gchar         *icon_name;
+} SmileyEntry;
+
+typedef struct {
+	SmileyEntry       *entry;
+	const SmileyImage *image; /* NULL until the first hit */
+	gchar             *str;
+	guint              len;
+} SmileyPattern;
+
+typedef struct {
+	gint    output; /* Index of the pattern ending here, or SMILEY_NO_OUTPUT */
+	guint16 dict;   /* Next state on the failure chain having an output */
+	guint16 depth;
+} SmileyState;
+
+typedef struct {
+	guint8       classes[256]; /* byte -> class, 0 for unused bytes */
+	guint8       starts[256];  /* TRUE if a smiley can start with byte */
+	guint        n_classes;
+	guint        n_states;
+	guint16     *delta;        /* n_states * n_classes transitions */
+	SmileyState *states;
+} SmileyAutomaton;
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathySmileyManager)
 typedef struct {
-	SmileyManagerTree *tree;
-	GSList            *smileys;
+	GArray            *patterns;
+	guint              max_states; /* Upper bound of the automaton size */
+	SmileyAutomaton   *automaton; /* Built lazily from patterns */
+	GSList            *smileys;   /* SmileyEntry */
+	GHashTable        *images;    /* "icon-name:size" -> SmileyImage */
 } EmpathySmileyManagerPriv;
 
-struct _SmileyManagerTree {
-	gunichar     c;
-	GdkPixbuf   *pixbuf;
-	gchar       *path;
-	GSList      *childrens;
-};
-
 G_DEFINE_TYPE (EmpathySmileyManager, empathy_smiley_manager, G_TYPE_OBJECT);
 
 static EmpathySmileyManager *manager_singleton = NULL;
 
-static SmileyManagerTree *
-smiley_manager_tree_new (gunichar c)
+static void
+smiley_pattern_clear (SmileyPattern *pattern)
 {
-	SmileyManagerTree *tree;
+	g_free (pattern->str);
+}
 
-	tree = g_slice_new0 (SmileyManagerTree);
-	tree->c = c;
-	tree->pixbuf = NULL;
-	tree->childrens = NULL;
-	tree->path = NULL;
+static void
+smiley_automaton_free (SmileyAutomaton *automaton)
+{
+	if (!automaton) {
+		return;
+	}
 
-	return tree;
+	g_free (automaton->delta);
+	g_free (automaton->states);
+	g_slice_free (SmileyAutomaton, automaton);
 }
 
-static void
-smiley_manager_tree_free (SmileyManagerTree *tree)
+static SmileyAutomaton *
+smiley_automaton_new (GArray *patterns)
 {
-	GSList *l;
+	SmileyAutomaton *automaton;
+	guint16         *fail;
+	guint16         *queue;
+	guint            max_states = 1;
+	guint            head = 0, tail = 0;
+	guint            i, c;
+
+	automaton = g_slice_new0 (SmileyAutomaton);
+
+	/* Give each byte used by a smiley its own class */
+	automaton->n_classes = 1;
+	for (i = 0; i < patterns->len; i++) {
+		SmileyPattern *pattern = &g_array_index (patterns, SmileyPattern, i);
+		const guchar  *p;
+
+		for (p = (const guchar *) pattern->str; *p; p++) {
+			if (automaton->classes[*p] == 0) {
+				automaton->classes[*p] = automaton->n_classes++;
+			}
+		}
+		automaton->starts[(guchar) pattern->str[0]] = TRUE;
+		max_states += pattern->len;
+	}
 
-	if (!tree) {
-		return;
+	/* Checked by smiley_manager_insert(). There are at most 255 non-NUL
+	 * bytes, so classes always fit in a guint8. */
+	g_assert (max_states <= SMILEY_MAX_STATES);
+
+	automaton->delta = g_new0 (guint16, max_states * automaton->n_classes);
+	automaton->states = g_new0 (SmileyState, max_states);
+	automaton->states[0].output = SMILEY_NO_OUTPUT;
+	automaton->n_states = 1;
+
+	/* Build the trie. A 0 transition from any state other than the
+	 * root means there is no goto for that class yet. */
+	for (i = 0; i < patterns->len; i++) {
+		SmileyPattern *pattern = &g_array_index (patterns, SmileyPattern, i);
+		const guchar  *p;
+		guint          state = 0;
+
+		for (p = (const guchar *) pattern->str; *p; p++) {
+			guint16 *next;
+
+			next = &automaton->delta[state * automaton->n_classes +
+						 automaton->classes[*p]];
+			if (*next == 0) {
+				*next = automaton->n_states++;
+				automaton->states[*next].output = SMILEY_NO_OUTPUT;
+				automaton->states[*next].depth =
+					automaton->states[state].depth + 1;
+			}
+			state = *next;
+		}
+
+		/* The last smiley added with a given string wins */
+		automaton->states[state].output = i;
 	}
 
-	for (l = tree->childrens; l; l = l->next) {
-		smiley_manager_tree_free (l->data);
+	/* Breadth-first walk computing the failure links, then replacing
+	 * missing gotos by the transition of the failure state. */
+	fail = g_new0 (guint16, automaton->n_states);
+	queue = g_new (guint16, automaton->n_states);
+
+	for (c = 1; c < automaton->n_classes; c++) {
+		guint16 next = automaton->delta[c];
+
+		if (next != 0) {
+			queue[tail++] = next;
+		}
 	}
 
-	if (tree->pixbuf) {
-		g_object_unref (tree->pixbuf);
+	while (head < tail) {
+		guint16  state = queue[head++];
+		guint16 *row = &automaton->delta[state * automaton->n_classes];
+		guint16 *fail_row = &automaton->delta[fail[state] * automaton->n_classes];
+
+		for (c = 1; c < automaton->n_classes; c++) {
+			guint16 next = row[c];
+
+			if (next == 0) {
+				row[c] = fail_row[c];
+				continue;
+			}
+
+			fail[next] = fail_row[c];
+			if (automaton->states[fail[next]].output != SMILEY_NO_OUTPUT) {
+				automaton->states[next].dict = fail[next];
+			} else {
+				automaton->states[next].dict =
+					automaton->states[fail[next]].dict;
+			}
+			queue[tail++] = next;
+		}
 	}
-	g_slist_free (tree->childrens);
-	g_free (tree->path);
-	g_slice_free (SmileyManagerTree, tree);
+
+	g_free (queue);
+	g_free (fail);
+
+	return automaton;
 }
 
-static EmpathySmiley *
-smiley_new (GdkPixbuf *pixbuf, const gchar *str)
+static SmileyEntry *
+smiley_entry_new (const gchar *icon_name, const gchar *str)
 {
-	EmpathySmiley *smiley;
+	SmileyEntry *entry;
 
-	smiley = g_slice_new0 (EmpathySmiley);
-	smiley->pixbuf = g_object_ref (pixbuf);
-	smiley->str = g_strdup (str);
+	entry = g_slice_new0 (SmileyEntry);
+	entry->smiley.pixbuf = NULL;
+	entry->smiley.str = g_strdup (str);
+	entry->icon_name = g_strdup (icon_name);
 
-	return smiley;
+	return entry;
+}
+
+static void
+smiley_entry_free (SmileyEntry *entry)
+{
+	if (entry->smiley.pixbuf) {
+		g_object_unref (entry->smiley.pixbuf);
+	}
+	g_free (entry->smiley.str);
+	g_free (entry->icon_name);
+	g_slice_free (SmileyEntry, entry);
 }
 
 static void
-smiley_free (EmpathySmiley *smiley)
+smiley_image_free (SmileyImage *image)
 {
-	g_object_unref (smiley->pixbuf);
-	g_free (smiley->str);
-	g_slice_free (EmpathySmiley, smiley);
+	if (image->pixbuf) {
+		g_object_unref (image->pixbuf);
+	}
+	g_free (image->path);
+	g_slice_free (SmileyImage, image);
+}
+
+static const SmileyImage *
+smiley_manager_get_image (EmpathySmileyManager *manager,
+			  const gchar          *icon_name,
+			  GtkIconSize           size)
+{
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	SmileyImage              *image;
+	gchar                    *key;
+
+	key = g_strdup_printf ("%s:%d", icon_name, size);
+	image = g_hash_table_lookup (priv->images, key);
+	if (image) {
+		g_free (key);
+		return image;
+	}
+
+	image = g_slice_new0 (SmileyImage);
+	image->pixbuf = tpaw_pixbuf_from_icon_name (icon_name, size);
+	if (image->pixbuf) {
+		image->path = tpaw_filename_from_icon_name (icon_name, size);
+	}
+
+	/* Also cache failures, the theme is not going to change */
+	g_hash_table_insert (priv->images, key, image);
+
+	return image;
 }
 
 static void
 smiley_manager_finalize (GObject *object)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (object);
+	guint i;
 
-	smiley_manager_tree_free (priv->tree);
-	g_slist_foreach (priv->smileys, (GFunc) smiley_free, NULL);
+	for (i = 0; i < priv->patterns->len; i++) {
+		smiley_pattern_clear (&g_array_index (priv->patterns,
+						      SmileyPattern, i));
+	}
+	g_array_free (priv->patterns, TRUE);
+	smiley_automaton_free (priv->automaton);
+	g_slist_foreach (priv->smileys, (GFunc) smiley_entry_free, NULL);
 	g_slist_free (priv->smileys);
+	g_hash_table_unref (priv->images);
 }
 
 static GObject *
@@ -151,8 +328,12 @@ empathy_smiley_manager_init (EmpathySmileyManager *manager)
 		EMPATHY_TYPE_SMILEY_MANAGER, EmpathySmileyManagerPriv);
 
 	manager->priv = priv;
-	priv->tree = smiley_manager_tree_new ('\0');
+	priv->patterns = g_array_new (FALSE, FALSE, sizeof (SmileyPattern));
+	priv->max_states = 1;
+	priv->automaton = NULL;
 	priv->smileys = NULL;
+	priv->images = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+					      (GDestroyNotify) smiley_image_free);
 
 	empathy_smiley_manager_load (manager);
 }
@@ -163,76 +344,62 @@ empathy_smiley_manager_dup_singleton (void)
 	return g_object_new (EMPATHY_TYPE_SMILEY_MANAGER, NULL);
 }
 
-static SmileyManagerTree *
-smiley_manager_tree_find_child (SmileyManagerTree *tree, gunichar c)
-{
-	GSList *l;
-
-	for (l = tree->childrens; l; l = l->next) {
-		SmileyManagerTree *child = l->data;
-
-		if (child->c == c) {
-			return child;
-		}
-	}
-
-	return NULL;
-}
-
-static SmileyManagerTree *
-smiley_manager_tree_find_or_insert_child (SmileyManagerTree *tree, gunichar c)
+/* Like empathy_smiley_manager_dup_singleton() but without taking a
+ * reference, for the message parsing path. The returned manager is kept
+ * alive until the end of the process. */
+EmpathySmileyManager *
+empathy_smiley_manager_get_default (void)
 {
-	SmileyManagerTree *child;
-
-	child = smiley_manager_tree_find_child (tree, c);
-
-	if (!child) {
-		child = smiley_manager_tree_new (c);
-		tree->childrens = g_slist_prepend (tree->childrens, child);
+	if (G_UNLIKELY (manager_singleton == NULL)) {
+		/* Intentionally leaked */
+		empathy_smiley_manager_dup_singleton ();
 	}
 
-	return child;
+	return manager_singleton;
 }
 
 static void
-smiley_manager_tree_insert (SmileyManagerTree *tree,
-			    GdkPixbuf         *pixbuf,
-			    const gchar       *str,
-			    const gchar       *path)
+smiley_manager_insert (EmpathySmileyManager *manager,
+		       SmileyEntry          *entry,
+		       const gchar          *str)
 {
-	SmileyManagerTree *child;
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	SmileyPattern             pattern;
+	gsize                     len;
 
-	child = smiley_manager_tree_find_or_insert_child (tree, g_utf8_get_char (str));
+	g_return_if_fail (!TPAW_STR_EMPTY (str));
 
-	str = g_utf8_next_char (str);
-	if (*str) {
-		smiley_manager_tree_insert (child, pixbuf, str, path);
-		return;
-	}
+	len = strlen (str);
+	g_return_if_fail (len <= SMILEY_MAX_STATES - priv->max_states);
 
-	child->pixbuf = g_object_ref (pixbuf);
-	child->path = g_strdup (path);
+	pattern.entry = entry;
+	pattern.image = NULL;
+	pattern.str = g_strdup (str);
+	pattern.len = len;
+	g_array_append_val (priv->patterns, pattern);
+	priv->max_states += len;
+
+	/* Rebuilt on next parse */
+	smiley_automaton_free (priv->automaton);
+	priv->automaton = NULL;
 }
 
 static void
 smiley_manager_add_valist (EmpathySmileyManager *manager,
-			   GdkPixbuf            *pixbuf,
-			   const gchar          *path,
+			   const gchar          *icon_name,
 			   const gchar          *first_str,
 			   va_list               var_args)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
 	const gchar              *str;
-	EmpathySmiley            *smiley;
+	SmileyEntry              *entry;
+
+	entry = smiley_entry_new (icon_name, first_str);
+	priv->smileys = g_slist_prepend (priv->smileys, entry);
 
 	for (str = first_str; str; str = va_arg (var_args, gchar*)) {
-		smiley_manager_tree_insert (priv->tree, pixbuf, str, path);
+		smiley_manager_insert (manager, entry, str);
 	}
-
-	g_object_set_data_full (G_OBJECT (pixbuf), "smiley_str",
-				g_strdup (first_str), g_free);
-	smiley = smiley_new (pixbuf, first_str);
-	priv->smileys = g_slist_prepend (priv->smileys, smiley);
 }
 
 void
@@ -241,24 +408,17 @@ empathy_smiley_manager_add (EmpathySmileyManager *manager,
 			    const gchar          *first_str,
 			    ...)
 {
-	GdkPixbuf *pixbuf;
 	va_list    var_args;
 
 	g_return_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager));
 	g_return_if_fail (!TPAW_STR_EMPTY (icon_name));
 	g_return_if_fail (!TPAW_STR_EMPTY (first_str));
 
-	pixbuf = tpaw_pixbuf_from_icon_name (icon_name, GTK_ICON_SIZE_MENU);
-	if (pixbuf) {
-		gchar *path;
-
-		va_start (var_args, first_str);
-		path = tpaw_filename_from_icon_name (icon_name, GTK_ICON_SIZE_MENU);
-		smiley_manager_add_valist (manager, pixbuf, path, first_str, var_args);
-		va_end (var_args);
-		g_object_unref (pixbuf);
-		g_free (path);
-	}
+	/* The image is looked up on first use, smileys whose icon can't be
+	 * found are then left as text. */
+	va_start (var_args, first_str);
+	smiley_manager_add_valist (manager, icon_name, first_str, var_args);
+	va_end (var_args);
 }
 
 void
@@ -317,19 +477,9 @@ empathy_smiley_manager_load (EmpathySmileyManager *manager)
 }
 
 static EmpathySmileyHit *
-smiley_hit_new (SmileyManagerTree *tree,
-		guint              start,
-		guint              end)
+smiley_hit_new (const EmpathySmileyHit *hit)
 {
-	EmpathySmileyHit *hit;
-
-	hit = g_slice_new (EmpathySmileyHit);
-	hit->pixbuf = tree->pixbuf;
-	hit->path = tree->path;
-	hit->start = start;
-	hit->end = end;
-
-	return hit;
+	return g_slice_dup (EmpathySmileyHit, hit);
 }
 
 void
@@ -340,101 +490,214 @@ empathy_smiley_hit_free (EmpathySmileyHit *hit)
 	g_slice_free (EmpathySmileyHit, hit);
 }
 
+static const SmileyImage *
+smiley_pattern_get_image (EmpathySmileyManager *manager,
+			  SmileyPattern        *pattern)
+{
+	if (G_UNLIKELY (pattern->image == NULL)) {
+		pattern->image = smiley_manager_get_image (manager,
+			pattern->entry->icon_name, GTK_ICON_SIZE_MENU);
+	}
+
+	return pattern->image;
+}
+
+/* Find the smileys in the len first bytes of text and write at most n_hits
+ * of them into hits, in order. Returns the number of hits written; if it is
+ * n_hits there may be more smileys after hits[n_hits - 1].end.
+ *
+ * Overlapping smileys are resolved leftmost-longest: ">:)" is one smiley,
+ * ">:(" is '>' followed by ":(". */
+guint
+empathy_smiley_manager_parse_into (EmpathySmileyManager *manager,
+				   const gchar          *text,
+				   gssize                len,
+				   EmpathySmileyHit     *hits,
+				   guint                 n_hits)
+{
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	SmileyAutomaton          *automaton;
+	const guchar             *str = (const guchar *) text;
+	EmpathySmileyHit          pending = { NULL, NULL, 0, 0 };
+	gboolean                  has_pending = FALSE;
+	guint                     last_end = 0;
+	guint                     n = 0;
+	guint                     state = 0;
+	gsize                     i;
+
+	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), 0);
+	g_return_val_if_fail (text != NULL, 0);
+
+	if (n_hits == 0 || priv->patterns->len == 0) {
+		return 0;
+	}
+
+	if (priv->automaton == NULL) {
+		priv->automaton = smiley_automaton_new (priv->patterns);
+	}
+	automaton = priv->automaton;
+
+	/* If len is negative, parse the string until we find '\0' */
+	if (len < 0) {
+		len = strlen (text);
+	}
+
+#define COMMIT_PENDING() \
+	G_STMT_START { \
+		last_end = pending.end; \
+		has_pending = FALSE; \
+		hits[n++] = pending; \
+		if (n == n_hits) { \
+			return n; \
+		} \
+	} G_STMT_END
+
+	for (i = 0; i < (gsize) len; i++) {
+		const SmileyState *s;
+		guint              o;
+
+		if (state == 0) {
+			/* No smiley in progress, a pending one is final */
+			if (has_pending) {
+				COMMIT_PENDING ();
+			}
+
+			/* Skip straight to the next byte starting a smiley */
+			while (i < (gsize) len && !automaton->starts[str[i]]) {
+				i++;
+			}
+			if (i == (gsize) len) {
+				break;
+			}
+		}
+
+		state = automaton->delta[state * automaton->n_classes +
+					 automaton->classes[str[i]]];
+		s = &automaton->states[state];
+
+		/* No smiley still in progress can start at or before the
+		 * pending one, so it is final. */
+		if (has_pending && i + 1 - s->depth > pending.start) {
+			COMMIT_PENDING ();
+		}
+
+		/* Smileys ending here, longest first */
+		for (o = s->output != SMILEY_NO_OUTPUT ? state : s->dict;
+		     o != 0;
+		     o = automaton->states[o].dict) {
+			SmileyPattern     *pattern;
+			const SmileyImage *image;
+			guint              start;
+
+			pattern = &g_array_index (priv->patterns, SmileyPattern,
+						  automaton->states[o].output);
+			start = i + 1 - pattern->len;
+
+			if (start < last_end) {
+				continue;
+			}
+
+			/* A smiley whose icon can't be found is left as text,
+			 * so it must not hide the shorter smileys it contains */
+			image = smiley_pattern_get_image (manager, pattern);
+			if (image->pixbuf == NULL) {
+				continue;
+			}
+
+			if (has_pending && start > pending.start) {
+				if (start < pending.end) {
+					continue;
+				}
+				/* Disjoint from the pending smiley. Only a
+				 * smiley both starting with the pending one
+				 * and containing this one could still win,
+				 * there is none in the default set. */
+				COMMIT_PENDING ();
+			}
+
+			pending.pixbuf = image->pixbuf;
+			pending.path = image->path;
+			pending.start = start;
+			pending.end = i + 1;
+			has_pending = TRUE;
+			break;
+		}
+	}
+
+	if (has_pending) {
+		COMMIT_PENDING ();
+	}
+
+#undef COMMIT_PENDING
+
+	return n;
+}
+
 GSList *
 empathy_smiley_manager_parse_len (EmpathySmileyManager *manager,
 				  const gchar          *text,
 				  gssize                len)
 {
-	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
-	EmpathySmileyHit         *hit;
-	GSList                   *hits = NULL;
-	SmileyManagerTree        *cur_tree = priv->tree;
-	const gchar              *cur_str;
-	const gchar              *start = NULL;
+	EmpathySmileyHit  hits[16];
+	GSList           *list = NULL;
+	guint             offset = 0;
+	guint             n, i;
 
 	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
 	g_return_val_if_fail (text != NULL, NULL);
 
-	/* If len is negative, parse the string until we find '\0' */
 	if (len < 0) {
-		len = G_MAXSSIZE;
+		len = strlen (text);
 	}
 
-	/* Parse the len first bytes of text to find smileys. Each time a smiley
-	 * is detected, append a EmpathySmileyHit struct to the returned list,
-	 * containing the smiley pixbuf and the position of the text to be
-	 * replaced by it.
-	 * cur_str is a pointer in the text showing the current position
-	 * of the parsing. It is always at the begining of an UTF-8 character,
-	 * because we support unicode smileys! For example we could want to
-	 * replace ™ by an image. */
-
-	for (cur_str = text;
-	     *cur_str != '\0' && cur_str - text < len;
-	     cur_str = g_utf8_next_char (cur_str)) {
-		SmileyManagerTree *child;
-		gunichar           c;
-
-		c = g_utf8_get_char (cur_str);
-		child = smiley_manager_tree_find_child (cur_tree, c);
-
-		/* If we have a child it means c is part of a smiley */
-		if (child) {
-			if (cur_tree == priv->tree) {
-				/* c is the first char of some smileys, keep
-				 * the begining position */
-				start = cur_str;
-			}
-			cur_tree = child;
-			continue;
+	do {
+		n = empathy_smiley_manager_parse_into (manager, text + offset,
+							len - offset, hits,
+							G_N_ELEMENTS (hits));
+		for (i = 0; i < n; i++) {
+			hits[i].start += offset;
+			hits[i].end += offset;
+			list = g_slist_prepend (list, smiley_hit_new (&hits[i]));
 		}
-
-		/* c is not part of a smiley. let's check if we found a smiley
-		 * before it. */
-		if (cur_tree->pixbuf != NULL) {
-			/* found! */
-			hit = smiley_hit_new (cur_tree, start - text,
-					      cur_str - text);
-			hits = g_slist_prepend (hits, hit);
-
-			/* c was not part of this smiley, check if a new smiley
-			 * start with it. */
-			cur_tree = smiley_manager_tree_find_child (priv->tree, c);
-			if (cur_tree) {
-				start = cur_str;
-			} else {
-				cur_tree = priv->tree;
-			}
-		} else if (cur_tree != priv->tree) {
-			/* We searched a smiley starting at 'start' but we ended
-			 * with no smiley. Look again starting from next char.
-			 *
-			 * For example ">:)" and ":(" are both valid smileys,
-			 * when parsing text ">:(" we first see '>' which could
-			 * be the start of a smiley. 'start' variable is set to
-			 * that position and we parse next char which is ':' and
-			 * is still potential smiley. Then we see '(' which is
-			 * NOT part of the smiley, ">:(" does not exist, so we
-			 * have to start again from ':' to find ":(" which is
-			 * correct smiley. */
-			cur_str = start;
-			cur_tree = priv->tree;
+		if (n > 0) {
+			offset = hits[n - 1].end;
 		}
+	} while (n == G_N_ELEMENTS (hits));
+
+	return g_slist_reverse (list);
+}
+
+static gboolean
+smiley_entry_load_pixbuf (EmpathySmileyManager *manager,
+			  SmileyEntry          *entry)
+{
+	const SmileyImage *image;
+
+	if (entry->smiley.pixbuf) {
+		return TRUE;
 	}
 
-	/* Check if last char of the text was the end of a smiley */
-	if (cur_tree->pixbuf != NULL) {
-		hit = smiley_hit_new (cur_tree, start - text, cur_str - text);
-		hits = g_slist_prepend (hits, hit);
+	image = smiley_manager_get_image (manager, entry->icon_name,
+					  GTK_ICON_SIZE_MENU);
+	if (!image->pixbuf) {
+		return FALSE;
 	}
 
-	return g_slist_reverse (hits);
+	entry->smiley.pixbuf = g_object_ref (image->pixbuf);
+
+	return TRUE;
 }
 
+/* Returns a list of EmpathySmiley, their pixbuf is loaded on demand */
 GSList *
 empathy_smiley_manager_get_all (EmpathySmileyManager *manager)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	GSList                   *l;
+
+	for (l = priv->smileys; l; l = l->next) {
+		smiley_entry_load_pixbuf (manager, l->data);
+	}
 
 	return priv->smileys;
 }
@@ -482,12 +745,17 @@ empathy_smiley_menu_new (EmpathySmileyManager *manager,
 	menu = gtk_menu_new ();
 
 	for (l = priv->smileys; l; l = l->next) {
+		SmileyEntry   *entry = l->data;
 		EmpathySmiley *smiley;
 		GtkWidget     *item;
 		GtkWidget     *image;
 		ActivateData  *data;
 
-		smiley = l->data;
+		smiley = &entry->smiley;
+		if (!smiley_entry_load_pixbuf (manager, entry)) {
+			continue;
+		}
+
 		image = gtk_image_new_from_pixbuf (smiley->pixbuf);
 
 		item = gtk_image_menu_item_new ();
@@ -64,6 +64,7 @@ typedef void (*EmpathySmileyMenuFunc) (EmpathySmileyManager *manager,
 
 GType                 empathy_smiley_manager_get_type        (void) G_GNUC_CONST;
 EmpathySmileyManager *empathy_smiley_manager_dup_singleton   (void);
+EmpathySmileyManager *empathy_smiley_manager_get_default     (void);
 void                  empathy_smiley_manager_load            (EmpathySmileyManager *manager);
 void                  empathy_smiley_manager_add             (EmpathySmileyManager *manager,
 							      const gchar          *icon_name,
@@ -73,6 +74,11 @@ GSList *              empathy_smiley_manager_get_all         (EmpathySmileyManag
 GSList *              empathy_smiley_manager_parse_len       (EmpathySmileyManager *manager,
 							      const gchar          *text,
 							      gssize                len);
+guint                 empathy_smiley_manager_parse_into      (EmpathySmileyManager *manager,
+							      const gchar          *text,
+							      gssize                len,
+							      EmpathySmileyHit     *hits,
+							      guint                 n_hits);
 GtkWidget *           empathy_smiley_menu_new                (EmpathySmileyManager *manager,
 							      EmpathySmileyMenuFunc func,
 							      gpointer              user_data);
@@ -25,6 +25,8 @@
 #include "empathy-spell.h"
 
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
 
 #ifdef HAVE_ENCHANT
 #include <enchant.h>
@@ -44,13 +46,47 @@ typedef struct {
 
 #define ISO_CODES_DATADIR    ISO_CODES_PREFIX "/share/xml/iso-codes"
 #define ISO_CODES_LOCALESDIR ISO_CODES_PREFIX "/share/locale"
+#define ISO_639_FILE         ISO_CODES_DATADIR "/iso_639.xml"
 
-/* Language code (gchar *) -> language name (gchar *) */
-static GHashTable  *iso_code_names = NULL;
+/* Array of (language code, language name) sorted by code, as an "a(ss)"
+ * variant. Cached in the user's cache dir, see spell_iso_code_names_init() */
+static GVariant    *iso_code_names = NULL;
+
+typedef struct {
+	gchar *code;
+	gchar *name;
+} IsoCodeName;
 /* Contains only _enabled_ languages
  * Language code (gchar *) -> language (SpellLanguage *) */
 static GHashTable  *languages = NULL;
 
+/* Number of words whose verdict is remembered */
+#define CACHE_SIZE 4096
+
+typedef struct {
+	gchar    *word;
+	gboolean  correct;
+} SpellCacheEntry;
+
+/* Verdicts for the enabled languages, most recently used first.
+ * Word (gchar *) -> borrowed GList link in cache_lru */
+static GHashTable  *cache = NULL;
+static GQueue       cache_lru = G_QUEUE_INIT;
+
+/* Words are checked from a thread too, see empathy_spell_check_words_async().
+ * Protects languages and the cache. */
+static GMutex       spell_lock;
+
+static void
+spell_iso_codes_add (GArray      *entries,
+		     const gchar *code,
+		     const gchar *name)
+{
+	IsoCodeName entry = { g_strdup (code), g_strdup (name) };
+
+	g_array_append_val (entries, entry);
+}
+
 static void
 spell_iso_codes_parse_start_tag (GMarkupParseContext  *ctx,
 				 const gchar          *element_name,
@@ -59,6 +95,7 @@ spell_iso_codes_parse_start_tag (GMarkupParseContext  *ctx,
 				 gpointer              data,
 				 GError              **error)
 {
+	GArray *entries = data;
 	const gchar *ccode_longB, *ccode_longT, *ccode;
 	const gchar *lang_name;
 
@@ -101,60 +138,297 @@ spell_iso_codes_parse_start_tag (GMarkupParseContext  *ctx,
 	}
 
 	if (ccode) {
-		g_hash_table_insert (iso_code_names,
-				     g_strdup (ccode),
-				     g_strdup (lang_name));
+		spell_iso_codes_add (entries, ccode, lang_name);
 	}
 
 	if (ccode_longB) {
-		g_hash_table_insert (iso_code_names,
-				     g_strdup (ccode_longB),
-				     g_strdup (lang_name));
+		spell_iso_codes_add (entries, ccode_longB, lang_name);
 	}
 
 	if (ccode_longT) {
-		g_hash_table_insert (iso_code_names,
-				     g_strdup (ccode_longT),
-				     g_strdup (lang_name));
+		spell_iso_codes_add (entries, ccode_longT, lang_name);
 	}
 }
 
-static void
-spell_iso_code_names_init (void)
+static gint
+spell_iso_code_name_compare (gconstpointer a,
+			     gconstpointer b)
+{
+	const IsoCodeName *entry1 = a;
+	const IsoCodeName *entry2 = b;
+
+	return strcmp (entry1->code, entry2->code);
+}
+
+/* Returns a new "a(ss)" variant. If iso_639.xml couldn't be read or
+ * parsed completely, it only has the languages found so far and @complete
+ * is set to FALSE. */
+static GVariant *
+spell_iso_code_names_parse (gboolean *complete)
 {
+	GMarkupParser parser = {
+		spell_iso_codes_parse_start_tag,
+		NULL, NULL, NULL, NULL
+	};
+	GArray *entries;
+	GFile *file;
+	GFileInputStream *stream;
+	GVariantBuilder builder;
+	const gchar *last_code = NULL;
 	GError *err = NULL;
-	gchar  *buf;
-	gsize   buf_len;
+	guint i;
 
-	iso_code_names = g_hash_table_new_full (g_str_hash, g_str_equal,
-						g_free, g_free);
+	entries = g_array_new (FALSE, FALSE, sizeof (IsoCodeName));
 
-	bindtextdomain ("iso_639", ISO_CODES_LOCALESDIR);
-	bind_textdomain_codeset ("iso_639", "UTF-8");
+	file = g_file_new_for_path (ISO_639_FILE);
+	stream = g_file_read (file, NULL, &err);
+	g_object_unref (file);
 
-	/* FIXME: We should read this in chunks and pass to the parser. */
-	if (g_file_get_contents (ISO_CODES_DATADIR "/iso_639.xml", &buf, &buf_len, &err)) {
+	if (stream != NULL) {
 		GMarkupParseContext *ctx;
-		GMarkupParser        parser = {
-			spell_iso_codes_parse_start_tag,
-			NULL, NULL, NULL, NULL
-		};
+		gchar buf[4096];
+		gssize len;
+
+		ctx = g_markup_parse_context_new (&parser, 0, entries, NULL);
+
+		while ((len = g_input_stream_read (G_INPUT_STREAM (stream),
+				buf, sizeof (buf), NULL, &err)) > 0) {
+			if (!g_markup_parse_context_parse (ctx, buf, len, &err))
+				break;
+		}
+
+		if (err == NULL) {
+			g_markup_parse_context_end_parse (ctx, &err);
+		}
 
-		ctx = g_markup_parse_context_new (&parser, 0, NULL, NULL);
-		if (!g_markup_parse_context_parse (ctx, buf, buf_len, &err)) {
+		if (err != NULL) {
 			g_warning ("Failed to parse '%s': %s",
-				   ISO_CODES_DATADIR"/iso_639.xml",
-				   err->message);
-			g_error_free (err);
+				   ISO_639_FILE, err->message);
 		}
 
 		g_markup_parse_context_free (ctx);
-		g_free (buf);
+		g_object_unref (stream);
 	} else {
 		g_warning ("Failed to load '%s': %s",
-				ISO_CODES_DATADIR"/iso_639.xml", err->message);
+				ISO_639_FILE, err->message);
+	}
+
+	/* The 2B and 2T codes of most languages are the same, only keep
+	 * one of them */
+	g_array_sort (entries, spell_iso_code_name_compare);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
+	for (i = 0; i < entries->len; i++) {
+		IsoCodeName *entry = &g_array_index (entries, IsoCodeName, i);
+
+		if (g_strcmp0 (entry->code, last_code) == 0) {
+			continue;
+		}
+
+		g_variant_builder_add (&builder, "(ss)", entry->code, entry->name);
+		last_code = entry->code;
+	}
+
+	for (i = 0; i < entries->len; i++) {
+		IsoCodeName *entry = &g_array_index (entries, IsoCodeName, i);
+
+		g_free (entry->code);
+		g_free (entry->name);
+	}
+	g_array_unref (entries);
+
+	*complete = (err == NULL);
+	g_clear_error (&err);
+
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/* The cache is a "(xxa(ss))" variant: the mtime and size of iso_639.xml
+ * it was built from, then the table. */
+static GVariant *
+spell_iso_code_names_load_cache (const gchar *path,
+				 gint64       mtime,
+				 gint64       size)
+{
+	GMappedFile *mapped;
+	GBytes *bytes;
+	GVariant *cache;
+	GVariant *table = NULL;
+	gint64 cache_mtime, cache_size;
+
+	mapped = g_mapped_file_new (path, FALSE, NULL);
+	if (mapped == NULL) {
+		return NULL;
+	}
+
+	bytes = g_mapped_file_get_bytes (mapped);
+	g_mapped_file_unref (mapped);
+
+	/* Not trusted, so a broken file only gives empty values */
+	cache = g_variant_ref_sink (g_variant_new_from_bytes (
+		G_VARIANT_TYPE ("(xxa(ss))"), bytes, FALSE));
+	g_bytes_unref (bytes);
+
+	g_variant_get_child (cache, 0, "x", &cache_mtime);
+	g_variant_get_child (cache, 1, "x", &cache_size);
+	if (cache_mtime == mtime && cache_size == size) {
+		table = g_variant_get_child_value (cache, 2);
+	}
+
+	g_variant_unref (cache);
+
+	return table;
+}
+
+static void
+spell_iso_code_names_save_cache (const gchar *path,
+				 gint64       mtime,
+				 gint64       size,
+				 GVariant    *table)
+{
+	GVariant *cache;
+	gchar *dir;
+	GError *err = NULL;
+
+	dir = g_path_get_dirname (path);
+	g_mkdir_with_parents (dir, 0700);
+	g_free (dir);
+
+	cache = g_variant_ref_sink (g_variant_new ("(xx@a(ss))", mtime, size,
+						   table));
+
+	if (!g_file_set_contents (path, g_variant_get_data (cache),
+				  g_variant_get_size (cache), &err)) {
+		DEBUG ("Failed to save '%s': %s", path, err->message);
 		g_error_free (err);
 	}
+
+	g_variant_unref (cache);
+}
+
+static void
+spell_iso_code_names_init (void)
+{
+	GStatBuf st;
+	gint64 mtime = 0, size = 0;
+	gchar *cache_path;
+
+	bindtextdomain ("iso_639", ISO_CODES_LOCALESDIR);
+	bind_textdomain_codeset ("iso_639", "UTF-8");
+
+	if (g_stat (ISO_639_FILE, &st) == 0) {
+		mtime = st.st_mtime;
+		size = st.st_size;
+	}
+
+	cache_path = g_build_filename (g_get_user_cache_dir (), "empathy",
+				       "iso-639.gvariant", NULL);
+
+	if (mtime != 0) {
+		iso_code_names = spell_iso_code_names_load_cache (cache_path,
+								  mtime, size);
+	}
+
+	if (iso_code_names == NULL) {
+		gboolean complete;
+
+		DEBUG ("Parsing '%s'", ISO_639_FILE);
+		iso_code_names = spell_iso_code_names_parse (&complete);
+
+		/* Don't keep a truncated table for the next runs */
+		if (mtime != 0 && complete) {
+			spell_iso_code_names_save_cache (cache_path, mtime,
+							 size, iso_code_names);
+		}
+	}
+
+	g_free (cache_path);
+}
+
+static void
+spell_cache_entry_free (SpellCacheEntry *entry)
+{
+	g_free (entry->word);
+	g_slice_free (SpellCacheEntry, entry);
+}
+
+static void
+spell_cache_clear (void)
+{
+	if (cache == NULL) {
+		return;
+	}
+
+	g_hash_table_remove_all (cache);
+	g_queue_foreach (&cache_lru, (GFunc) spell_cache_entry_free, NULL);
+	g_queue_clear (&cache_lru);
+}
+
+static gboolean
+spell_cache_lookup (const gchar *word,
+		    gboolean    *correct)
+{
+	GList *link;
+	SpellCacheEntry *entry;
+
+	if (cache == NULL) {
+		return FALSE;
+	}
+
+	link = g_hash_table_lookup (cache, word);
+	if (link == NULL) {
+		return FALSE;
+	}
+
+	g_queue_unlink (&cache_lru, link);
+	g_queue_push_head_link (&cache_lru, link);
+
+	entry = link->data;
+	*correct = entry->correct;
+	return TRUE;
+}
+
+static void
+spell_cache_insert (const gchar *word,
+		    gboolean     correct)
+{
+	SpellCacheEntry *entry;
+
+	if (cache == NULL) {
+		cache = g_hash_table_new (g_str_hash, g_str_equal);
+	}
+
+	if (cache_lru.length >= CACHE_SIZE) {
+		entry = g_queue_pop_tail (&cache_lru);
+		g_hash_table_remove (cache, entry->word);
+		spell_cache_entry_free (entry);
+	}
+
+	entry = g_slice_new (SpellCacheEntry);
+	entry->word = g_strdup (word);
+	entry->correct = correct;
+
+	g_queue_push_head (&cache_lru, entry);
+	g_hash_table_insert (cache, entry->word, cache_lru.head);
+}
+
+static void
+spell_cache_remove (const gchar *word)
+{
+	GList *link;
+
+	if (cache == NULL) {
+		return;
+	}
+
+	link = g_hash_table_lookup (cache, word);
+	if (link == NULL) {
+		return;
+	}
+
+	g_hash_table_remove (cache, word);
+	spell_cache_entry_free (link->data);
+	g_queue_delete_link (&cache_lru, link);
 }
 
 static void
@@ -164,11 +438,18 @@ spell_notify_languages_cb (GSettings   *gsettings,
 {
 	DEBUG ("Resetting languages due to config change");
 
+	g_mutex_lock (&spell_lock);
+
 	/* We just reset the languages list. */
 	if (languages != NULL) {
 		g_hash_table_unref (languages);
 		languages = NULL;
 	}
+
+	/* The verdicts were for the old set of languages */
+	spell_cache_clear ();
+
+	g_mutex_unlock (&spell_lock);
 }
 
 static void
@@ -180,6 +461,7 @@ empathy_spell_free_language (SpellLanguage *lang)
 	g_slice_free (SpellLanguage, lang);
 }
 
+/* Must be called with spell_lock held */
 static void
 spell_setup_languages (void)
 {
@@ -244,7 +526,7 @@ spell_setup_languages (void)
 const gchar *
 empathy_spell_get_language_name (const gchar *code)
 {
-	const gchar *name;
+	gsize low, high;
 
 	g_return_val_if_fail (code != NULL, NULL);
 
@@ -252,12 +534,28 @@ empathy_spell_get_language_name (const gchar *code)
 		spell_iso_code_names_init ();
 	}
 
-	name = g_hash_table_lookup (iso_code_names, code);
-	if (!name) {
-		return NULL;
+	low = 0;
+	high = g_variant_n_children (iso_code_names);
+
+	while (low < high) {
+		gsize middle = low + (high - low) / 2;
+		const gchar *middle_code, *name;
+		gint cmp;
+
+		g_variant_get_child (iso_code_names, middle, "(&s&s)",
+				     &middle_code, &name);
+
+		cmp = strcmp (code, middle_code);
+		if (cmp == 0) {
+			return dgettext ("iso_639", name);
+		} else if (cmp < 0) {
+			high = middle;
+		} else {
+			low = middle + 1;
+		}
 	}
 
-	return dgettext ("iso_639", name);
+	return NULL;
 }
 
 static void
@@ -300,8 +598,14 @@ empathy_spell_get_language_codes (void)
 GList *
 empathy_spell_get_enabled_language_codes (void)
 {
+	GList *codes;
+
+	g_mutex_lock (&spell_lock);
 	spell_setup_languages ();
-	return g_hash_table_get_keys (languages);
+	codes = g_hash_table_get_keys (languages);
+	g_mutex_unlock (&spell_lock);
+
+	return codes;
 }
 
 void
@@ -311,25 +615,29 @@ empathy_spell_free_language_codes (GList *codes)
 	g_list_free (codes);
 }
 
-gboolean
-empathy_spell_check (const gchar *word)
+/* Must be called with spell_lock held */
+static gboolean
+spell_check_locked (const gchar *word)
 {
 	gint         enchant_result = 1;
 	const gchar *p;
 	gboolean     digit;
+	gboolean     correct;
 	gunichar     c;
 	gint         len;
 	GHashTableIter iter;
 	SpellLanguage  *lang;
 
-	g_return_val_if_fail (word != NULL, FALSE);
-
 	spell_setup_languages ();
 
 	if (!languages) {
 		return TRUE;
 	}
 
+	if (spell_cache_lookup (word, &correct)) {
+		return correct;
+	}
+
 	/* Ignore certain cases like numbers, etc. */
 	for (p = word, digit = TRUE; *p && digit; p = g_utf8_next_char (p)) {
 		c = g_utf8_get_char (p);
@@ -339,6 +647,7 @@ empathy_spell_check (const gchar *word)
 	if (digit) {
 		/* We don't spell check digits. */
 		DEBUG ("Not spell checking word:'%s', it is all digits", word);
+		spell_cache_insert (word, TRUE);
 		return TRUE;
 	}
 
@@ -352,7 +661,102 @@ empathy_spell_check (const gchar *word)
 		}
 	}
 
-	return (enchant_result == 0);
+	correct = (enchant_result == 0);
+	spell_cache_insert (word, correct);
+
+	return correct;
+}
+
+gboolean
+empathy_spell_check (const gchar *word)
+{
+	gboolean correct;
+
+	g_return_val_if_fail (word != NULL, FALSE);
+
+	g_mutex_lock (&spell_lock);
+	correct = spell_check_locked (word);
+	g_mutex_unlock (&spell_lock);
+
+	return correct;
+}
+
+gboolean
+empathy_spell_check_cached (const gchar *word,
+			    gboolean    *correct)
+{
+	gboolean known;
+
+	g_return_val_if_fail (word != NULL, FALSE);
+	g_return_val_if_fail (correct != NULL, FALSE);
+
+	g_mutex_lock (&spell_lock);
+	known = spell_cache_lookup (word, correct);
+	g_mutex_unlock (&spell_lock);
+
+	return known;
+}
+
+static void
+spell_check_words_thread (GTask        *task,
+			  gpointer      source_object,
+			  gpointer      task_data,
+			  GCancellable *cancellable)
+{
+	gchar **words = task_data;
+	guint i;
+
+	for (i = 0; words[i] != NULL; i++) {
+		if (g_task_return_error_if_cancelled (task)) {
+			return;
+		}
+
+		/* Released between words so the main loop doesn't wait for
+		 * the whole batch */
+		g_mutex_lock (&spell_lock);
+		spell_check_locked (words[i]);
+		g_mutex_unlock (&spell_lock);
+	}
+
+	g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * empathy_spell_check_words_async:
+ * @words: a %NULL-terminated array of words
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: called once all the words have been checked
+ * @user_data: data for @callback
+ *
+ * Checks @words from a thread. Their verdicts can then be retrieved with
+ * empathy_spell_check_cached(), as long as they didn't get out of the cache
+ * in the meantime.
+ */
+void
+empathy_spell_check_words_async (const gchar * const *words,
+				 GCancellable        *cancellable,
+				 GAsyncReadyCallback  callback,
+				 gpointer             user_data)
+{
+	GTask *task;
+
+	g_return_if_fail (words != NULL);
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, empathy_spell_check_words_async);
+	g_task_set_task_data (task, g_strdupv ((gchar **) words),
+			      (GDestroyNotify) g_strfreev);
+	g_task_run_in_thread (task, spell_check_words_thread);
+	g_object_unref (task);
+}
+
+gboolean
+empathy_spell_check_words_finish (GAsyncResult  *result,
+				  GError       **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 GList *
@@ -368,17 +772,19 @@ empathy_spell_get_suggestions (const gchar *code,
 	g_return_val_if_fail (code != NULL, NULL);
 	g_return_val_if_fail (word != NULL, NULL);
 
+	g_mutex_lock (&spell_lock);
+
 	spell_setup_languages ();
 
 	if (!languages) {
-		return NULL;
+		goto out;
 	}
 
 	len = strlen (word);
 
 	lang = g_hash_table_lookup (languages, code);
 	if (!lang) {
-		return NULL;
+		goto out;
 	}
 
 	suggestions = enchant_dict_suggest (lang->speller, word, len,
@@ -393,6 +799,9 @@ empathy_spell_get_suggestions (const gchar *code,
 		enchant_dict_free_string_list (lang->speller, suggestions);
 	}
 
+out:
+	g_mutex_unlock (&spell_lock);
+
 	return suggestion_list;
 }
 
@@ -416,15 +825,21 @@ empathy_spell_add_to_dictionary (const gchar *code,
 	g_return_if_fail (code != NULL);
 	g_return_if_fail (word != NULL);
 
+	g_mutex_lock (&spell_lock);
+
 	spell_setup_languages ();
 	if (languages == NULL)
-		return;
+		goto out;
 
 	lang = g_hash_table_lookup (languages, code);
 	if (lang == NULL)
-		return;
+		goto out;
 
 	enchant_dict_add_to_pwl (lang->speller, word, strlen (word));
+	spell_cache_remove (word);
+
+out:
+	g_mutex_unlock (&spell_lock);
 }
 
 #else /* not HAVE_ENCHANT */
@@ -452,6 +867,36 @@ empathy_spell_check (const gchar *word)
 	return TRUE;
 }
 
+gboolean
+empathy_spell_check_cached (const gchar *word,
+			    gboolean    *correct)
+{
+	*correct = TRUE;
+
+	return TRUE;
+}
+
+void
+empathy_spell_check_words_async (const gchar * const *words,
+				 GCancellable        *cancellable,
+				 GAsyncReadyCallback  callback,
+				 gpointer             user_data)
+{
+	GTask *task;
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, empathy_spell_check_words_async);
+	g_task_return_boolean (task, TRUE);
+	g_object_unref (task);
+}
+
+gboolean
+empathy_spell_check_words_finish (GAsyncResult  *result,
+				  GError       **error)
+{
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 const gchar *
 empathy_spell_get_language_name (const gchar *lang)
 {
@@ -24,7 +24,7 @@
 #ifndef __EMPATHY_SPELL_H__
 #define __EMPATHY_SPELL_H__
 
-#include <glib.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -34,6 +34,14 @@ GList       *empathy_spell_get_language_codes  (void);
 GList       *empathy_spell_get_enabled_language_codes (void);
 void         empathy_spell_free_language_codes (GList       *codes);
 gboolean     empathy_spell_check               (const gchar *word);
+gboolean     empathy_spell_check_cached        (const gchar *word,
+						gboolean    *correct);
+void         empathy_spell_check_words_async   (const gchar * const *words,
+						GCancellable        *cancellable,
+						GAsyncReadyCallback  callback,
+						gpointer             user_data);
+gboolean     empathy_spell_check_words_finish  (GAsyncResult  *result,
+						GError       **error);
 GList *      empathy_spell_get_suggestions     (const gchar *code,
 						const gchar *word);
 void         empathy_spell_free_suggestions    (GList       *suggestions);
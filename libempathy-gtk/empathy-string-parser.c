@@ -21,6 +21,8 @@
 #include "config.h"
 #include "empathy-string-parser.h"
 
+#include <string.h>
+
 #include "empathy-smiley-manager.h"
 
 void
@@ -32,32 +34,269 @@ empathy_string_match_smiley (const gchar *text,
 {
 	guint last = 0;
 	EmpathySmileyManager *smiley_manager;
-	GSList *hits, *l;
+	EmpathySmileyHit hits[16];
+	guint n, i;
 
-	smiley_manager = empathy_smiley_manager_dup_singleton ();
-	hits = empathy_smiley_manager_parse_len (smiley_manager, text, len);
+	if (len < 0)
+		len = strlen (text);
 
-	for (l = hits; l; l = l->next) {
-		EmpathySmileyHit *hit = l->data;
+	smiley_manager = empathy_smiley_manager_get_default ();
 
-		if (hit->start > last) {
-			/* Append the text between last smiley (or the
-			 * start of the message) and this smiley */
-			tpaw_string_parser_substr (text + last,
-						   hit->start - last,
-						   sub_parsers, user_data);
-		}
+	do {
+		guint offset = last;
 
-		replace_func (text + hit->start, hit->end - hit->start,
-			      hit, user_data);
+		n = empathy_smiley_manager_parse_into (smiley_manager,
+						       text + offset,
+						       len - offset,
+						       hits,
+						       G_N_ELEMENTS (hits));
 
-		last = hit->end;
+		for (i = 0; i < n; i++) {
+			EmpathySmileyHit *hit = &hits[i];
 
-		empathy_smiley_hit_free (hit);
-	}
-	g_slist_free (hits);
-	g_object_unref (smiley_manager);
+			if (offset + hit->start > last) {
+				/* Append the text between last smiley (or the
+				 * start of the message) and this smiley */
+				tpaw_string_parser_substr (text + last,
+							   offset + hit->start - last,
+							   sub_parsers, user_data);
+			}
+
+			replace_func (text + offset + hit->start,
+				      hit->end - hit->start, hit, user_data);
+
+			last = offset + hit->end;
+		}
+	} while (n == G_N_ELEMENTS (hits));
 
 	tpaw_string_parser_substr (text + last, len - last,
 				   sub_parsers, user_data);
 }
+
+/* Same expressions as the tpaw link parser and the WebKit image link
+ * parser, so the scanner matches exactly what the parser chain did. */
+#define SCHEMES           "([a-zA-Z\\+]+)"
+#define INVALID_CHARS     "\\s\"<>"
+#define INVALID_CHARS_EXT INVALID_CHARS "\\[\\](){},;:"
+#define INVALID_CHARS_FULL INVALID_CHARS_EXT "?'"
+#define BODY              "([^"INVALID_CHARS_FULL"])([^"INVALID_CHARS_EXT"]*)"
+#define BODY_END          "([^"INVALID_CHARS"]*)[^"INVALID_CHARS_FULL".]"
+#define IMAGEEXTS         "(jpg|jpeg|png|gif|bmp|webp)"
+#define IMG_URI_REGEX     "(?i:"SCHEMES"://"BODY_END"."IMAGEEXTS")"
+#define URI_REGEX         "("SCHEMES"://"BODY_END")" \
+			  "|((www|ftp)\\."BODY_END")" \
+			  "|((mailto:)?"BODY"@"BODY"\\."BODY_END")"
+
+static GRegex *
+string_scanner_get_regex (gboolean images)
+{
+	/* We intentionally leak the regexes so they're not recomputed */
+	static GRegex *regexes[2] = { NULL, NULL };
+	GError *error = NULL;
+
+	if (regexes[images] != NULL)
+		return regexes[images];
+
+	/* The image alternative comes first and is captured as group 1, so a
+	 * match at a given position prefers an image link. */
+	if (images)
+		regexes[images] = g_regex_new ("(" IMG_URI_REGEX ")|" URI_REGEX,
+					       G_REGEX_OPTIMIZE, 0, &error);
+	else
+		regexes[images] = g_regex_new (URI_REGEX,
+					       G_REGEX_OPTIMIZE, 0, &error);
+
+	if (regexes[images] == NULL) {
+		g_warning ("Failed to create reg exp: %s", error->message);
+		g_error_free (error);
+	}
+
+	return regexes[images];
+}
+
+/* Equivalent to g_markup_escape_text() followed by stripping '\r', and
+ * optionally replacing '\n', but appending runs of plain bytes at once
+ * straight into @string. */
+void
+empathy_string_append_escaped (GString *string,
+			       const gchar *text,
+			       gssize len,
+			       const gchar *newline)
+{
+	const guchar *p, *run, *end;
+
+	if (len < 0)
+		len = strlen (text);
+
+	p = run = (const guchar *) text;
+	end = p + len;
+
+	while (p < end) {
+		const gchar *replace = NULL;
+		guint skip = 1;
+		guchar c = *p;
+
+		if (c >= 0x20 && c != '&' && c != '<' && c != '>' &&
+		    c != '\'' && c != '"' && c != 0x7f && c != 0xc2) {
+			p++;
+			continue;
+		}
+
+		switch (c) {
+		case '&':
+			replace = "&amp;";
+			break;
+		case '<':
+			replace = "&lt;";
+			break;
+		case '>':
+			replace = "&gt;";
+			break;
+		case '\'':
+			replace = "&apos;";
+			break;
+		case '"':
+			replace = "&quot;";
+			break;
+		case '\r':
+			replace = "";
+			break;
+		case '\n':
+			replace = newline;
+			break;
+		case '\t':
+			break;
+		case 0xc2:
+			/* C1 control characters, U+0085 excepted */
+			if (p + 1 < end && p[1] >= 0x80 && p[1] <= 0x9f &&
+			    p[1] != 0x85) {
+				c = p[1];
+				skip = 2;
+			} else {
+				c = 0;
+			}
+			break;
+		}
+
+		if (replace == NULL && (c == 0 || c == '\t' || c == '\n')) {
+			p += skip;
+			continue;
+		}
+
+		g_string_append_len (string, (const gchar *) run, p - run);
+		if (replace != NULL)
+			g_string_append (string, replace);
+		else
+			g_string_append_printf (string, "&#x%x;", c);
+
+		p += skip;
+		run = p;
+	}
+
+	g_string_append_len (string, (const gchar *) run, p - run);
+}
+
+static void
+string_scanner_append_text (const EmpathyStringScanner *scanner,
+			    EmpathySmileyManager *smiley_manager,
+			    const gchar *text,
+			    gsize len,
+			    GString *string)
+{
+	EmpathySmileyHit hits[16];
+	gsize last = 0;
+	guint n, i;
+
+	if (smiley_manager == NULL || len == 0) {
+		empathy_string_append_escaped (string, text, len,
+					       scanner->newline);
+		return;
+	}
+
+	do {
+		gsize offset = last;
+
+		n = empathy_smiley_manager_parse_into (smiley_manager,
+						       text + offset,
+						       len - offset,
+						       hits,
+						       G_N_ELEMENTS (hits));
+
+		for (i = 0; i < n; i++) {
+			EmpathySmileyHit *hit = &hits[i];
+
+			empathy_string_append_escaped (string, text + last,
+						       offset + hit->start - last,
+						       scanner->newline);
+			scanner->replace_smiley (text + offset + hit->start,
+						 hit->end - hit->start, hit,
+						 string);
+			last = offset + hit->end;
+		}
+	} while (n == G_N_ELEMENTS (hits));
+
+	empathy_string_append_escaped (string, text + last, len - last,
+				       scanner->newline);
+}
+
+/* Parse @text and append the output to @string. This still makes three
+ * passes: links and image links are found by one combined regex, then
+ * smileys are looked for in the text between them, and that text is escaped
+ * around the smileys. Unlike the parser chain, no pass copies the text or
+ * looks at the links again. */
+void
+empathy_string_scan (const EmpathyStringScanner *scanner,
+		     const gchar *text,
+		     gssize len,
+		     GString *string)
+{
+	EmpathySmileyManager *smiley_manager = NULL;
+	GMatchInfo *match_info = NULL;
+	GRegex *regex = NULL;
+	gsize last = 0;
+	gsize old_len;
+
+	if (len < 0)
+		len = strlen (text);
+
+	/* Reserve room for the common case where only a few characters
+	 * need replacing, so the buffer is grown once up front. */
+	old_len = string->len;
+	g_string_set_size (string, old_len + len + len / 8);
+	g_string_truncate (string, old_len);
+
+	if (scanner->replace_smiley != NULL)
+		smiley_manager = empathy_smiley_manager_get_default ();
+
+	if (scanner->replace_link != NULL)
+		regex = string_scanner_get_regex (
+			scanner->replace_image_link != NULL);
+
+	if (regex != NULL &&
+	    g_regex_match_full (regex, text, len, 0, 0, &match_info, NULL)) {
+		do {
+			TpawStringReplace replace = scanner->replace_link;
+			gint s = 0, e = 0, img_s = -1;
+
+			g_match_info_fetch_pos (match_info, 0, &s, &e);
+
+			if (scanner->replace_image_link != NULL &&
+			    g_match_info_fetch_pos (match_info, 1, &img_s, NULL) &&
+			    img_s >= 0)
+				replace = scanner->replace_image_link;
+
+			string_scanner_append_text (scanner, smiley_manager,
+						    text + last, s - last,
+						    string);
+			replace (text + s, e - s, NULL, string);
+
+			last = e;
+		} while (g_match_info_next (match_info, NULL));
+	}
+
+	string_scanner_append_text (scanner, smiley_manager, text + last,
+				    len - last, string);
+
+	if (match_info != NULL)
+		g_match_info_free (match_info);
+}
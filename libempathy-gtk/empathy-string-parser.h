@@ -33,6 +33,28 @@ empathy_string_match_smiley (const gchar *text,
 			     TpawStringParser *sub_parsers,
 			     gpointer user_data);
 
+/* Replacement for a chain of link, smiley, newline and escaping parsers,
+ * see empathy_string_scan(). A NULL replace function disables that kind of
+ * token, a NULL newline leaves '\n' untouched. */
+typedef struct {
+	TpawStringReplace replace_image_link;
+	TpawStringReplace replace_link;
+	TpawStringReplace replace_smiley;
+	const gchar *newline;
+} EmpathyStringScanner;
+
+void
+empathy_string_scan (const EmpathyStringScanner *scanner,
+		     const gchar *text,
+		     gssize len,
+		     GString *string);
+
+void
+empathy_string_append_escaped (GString *string,
+			       const gchar *text,
+			       gssize len,
+			       const gchar *newline);
+
 G_END_DECLS
 
 #endif /*  __EMPATHY_STRING_PARSER_H__ */
@@ -44,6 +44,9 @@
 /* "Join" consecutive messages with timestamps within five minutes */
 #define MESSAGE_JOIN_PERIOD 5*60
 
+/* Number of messages and events rendered again when waking up */
+#define HIBERNATION_RECORD_SIZE 200
+
 struct _EmpathyThemeAdiumPriv
 {
   EmpathyAdiumData *data;
@@ -55,12 +58,36 @@ struct _EmpathyThemeAdiumPriv
   gboolean first_is_backlog;
   gboolean last_is_backlog;
   guint pages_loading;
-  /* Queue of QueuedItem*s containing an EmpathyMessage or string */
+  /* Queue of QueuedItem*s containing an AdiumMessage or string */
   GQueue message_queue;
   /* Queue of guint32 of pending message id to remove unread
    * marker for when we lose focus. */
   GQueue acked_messages;
   GtkWidget *inspector_window;
+  /* JavaScript calls not sent to the web view yet. They are all run at
+   * once from an idle callback, see theme_adium_queue_script() */
+  GString *pending_scripts;
+  guint flush_scripts_id;
+  /* AdiumNode for each top-level message node in the view, oldest first.
+   * See theme_adium_maybe_prune() */
+  GArray *nodes;
+  /* Maximum number of nodes, 0 if unlimited */
+  guint scrollback_limit;
+  /* As reported by empathy-chat.js, we don't prune messages the user
+   * may be reading */
+  gboolean at_bottom;
+  /* QueuedItem*s for the latest messages and events shown, oldest first,
+   * see empathy_theme_adium_hibernate() */
+  GQueue recent_items;
+  /* TRUE if older items were dropped from recent_items */
+  gboolean recent_items_truncated;
+  /* gchar * "id\nalias" -> borrowed EmpathyContact, see
+   * theme_adium_intern_sender() */
+  GHashTable *senders;
+  gboolean hibernating;
+  /* While frozen, everything goes to message_queue, see
+   * empathy_theme_adium_freeze() */
+  gboolean frozen;
 
   GSettings *gsettings_chat;
   GSettings *gsettings_desktop;
@@ -73,6 +100,46 @@ struct _EmpathyThemeAdiumPriv
   gboolean show_avatars;
 };
 
+/* Keywords that are replaced in the Content/Status html files. Keywords
+ * we don't support (%senderStatusIcon%, %status%, ...) are stripped when
+ * compiling the template and have no segment type. */
+typedef enum
+{
+  ADIUM_SEGMENT_LITERAL,
+  ADIUM_SEGMENT_USER_ICON_PATH,
+  ADIUM_SEGMENT_SENDER_SCREEN_NAME,
+  ADIUM_SEGMENT_SENDER,
+  ADIUM_SEGMENT_SENDER_COLOR,
+  ADIUM_SEGMENT_MESSAGE_DIRECTION,
+  ADIUM_SEGMENT_MESSAGE,
+  ADIUM_SEGMENT_TIME,
+  ADIUM_SEGMENT_SHORT_TIME,
+  ADIUM_SEGMENT_SERVICE,
+  ADIUM_SEGMENT_USER_ICONS,
+  ADIUM_SEGMENT_MESSAGE_CLASSES,
+} AdiumSegmentType;
+
+typedef struct
+{
+  AdiumSegmentType type;
+  /* ADIUM_SEGMENT_LITERAL: the html, already escaped for JavaScript */
+  gchar *literal;
+  gsize literal_len;
+  /* ADIUM_SEGMENT_TIME: strftime format (owned by date_format_cache),
+   * or NULL to use the default one */
+  const gchar *time_format;
+} AdiumSegment;
+
+/* A Content/Status html file split once at load time into literals and
+ * keyword slots, so rendering a message doesn't have to scan it again. */
+typedef struct
+{
+  /* Array of AdiumSegment */
+  GArray *segments;
+  /* Sum of the literals length, used to size the output */
+  gsize literal_len;
+} AdiumTemplate;
+
 struct _EmpathyAdiumData
 {
   gint ref_count;
@@ -104,6 +171,21 @@ struct _EmpathyAdiumData
    * We do this because of fallbacks, some htmls could be pointing the
    * same string. */
   GPtrArray *strings_to_free;
+
+  /* Compiled versions of the above html strings. Same as for the
+   * strings, fallbacks share the same AdiumTemplate. */
+  AdiumTemplate *in_content;
+  AdiumTemplate *in_context;
+  AdiumTemplate *in_nextcontent;
+  AdiumTemplate *in_nextcontext;
+  AdiumTemplate *out_content;
+  AdiumTemplate *out_context;
+  AdiumTemplate *out_nextcontent;
+  AdiumTemplate *out_nextcontext;
+  AdiumTemplate *status;
+
+  /* Owns the above templates */
+  GPtrArray *templates_to_free;
 };
 
 static gchar * adium_info_dup_path_for_variant (GHashTable *info,
@@ -116,57 +198,302 @@ enum
   PROP_VARIANT,
 };
 
+enum
+{
+  SIG_PRUNED,
+  SIG_NEAR_TOP,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+typedef struct
+{
+  gint64 timestamp;
+  /* Token of the node's first message, NULL for events or messages
+   * without one */
+  gchar *token;
+} AdiumNode;
+
+static void
+adium_node_clear (gpointer data)
+{
+  AdiumNode *node = data;
+
+  g_free (node->token);
+}
+
 G_DEFINE_TYPE (EmpathyThemeAdium, empathy_theme_adium,
        WEBKIT_TYPE_WEB_VIEW)
 
 enum
 {
   QUEUED_EVENT,
+  QUEUED_EVENT_MARKUP,
   QUEUED_MESSAGE,
-  QUEUED_EDIT
+  QUEUED_EDIT,
+  QUEUED_SCRIPT
 };
 
+/* What theme_adium_add_message() needs from an EmpathyMessage. Messages
+ * which are queued or recorded are copied in a single block with their
+ * strings, so we don't keep every EmpathyMessage, its TpMessage and the
+ * sender's EmpathyContact alive. */
+typedef struct
+{
+  /* When copied from a log message, the one interned in priv->senders */
+  EmpathyContact *sender;
+  /* Built from a TplEvent rather than a TpMessage */
+  gboolean from_logs;
+  const gchar *body;
+  const gchar *token;
+  gint64 timestamp;
+  TpChannelTextMessageType type;
+  gboolean is_backlog;
+  /* For the x-empathy-message-id-* class */
+  gboolean has_pending_id;
+  guint32 pending_id;
+} AdiumMessage;
+
+static void
+adium_message_init (AdiumMessage *am,
+    EmpathyMessage *msg)
+{
+  TpMessage *tp_msg;
+
+  am->sender = empathy_message_get_sender (msg);
+  am->body = empathy_message_get_body (msg);
+  am->token = empathy_message_get_token (msg);
+  am->timestamp = empathy_message_get_timestamp (msg);
+  am->type = empathy_message_get_tptype (msg);
+  am->is_backlog = empathy_message_is_backlog (msg);
+
+  tp_msg = empathy_message_get_tp_message (msg);
+  am->from_logs = (tp_msg == NULL);
+
+  if (tp_msg != NULL)
+    am->pending_id = tp_message_get_pending_message_id (tp_msg,
+        &am->has_pending_id);
+  else
+    am->has_pending_id = FALSE;
+
+  if (!am->has_pending_id)
+    am->pending_id = 0;
+}
+
+static gboolean
+theme_adium_sender_equal (gpointer key,
+    gpointer value,
+    gpointer user_data)
+{
+  return value == user_data;
+}
+
+static void
+theme_adium_sender_finalized_cb (gpointer user_data,
+    GObject *where_the_object_was)
+{
+  EmpathyThemeAdium *self = user_data;
+
+  g_hash_table_foreach_remove (self->priv->senders, theme_adium_sender_equal,
+      where_the_object_was);
+}
+
+static void
+theme_adium_clear_senders (EmpathyThemeAdium *self)
+{
+  GHashTableIter iter;
+  gpointer sender;
+
+  g_hash_table_iter_init (&iter, self->priv->senders);
+  while (g_hash_table_iter_next (&iter, NULL, &sender))
+    g_object_weak_unref (sender, theme_adium_sender_finalized_cb, self);
+
+  g_hash_table_remove_all (self->priv->senders);
+}
+
+/* Log messages from the same sender share their EmpathyContact, which is
+ * otherwise a new object for each message. Live messages already share
+ * theirs, and must keep it: a contact built from the logs has the avatar
+ * and presence of the time. The queued and recorded messages own the
+ * contacts; a contact leaves the table once nothing uses it anymore. */
+static EmpathyContact *
+theme_adium_intern_sender (EmpathyThemeAdium *self,
+    EmpathyContact *sender)
+{
+  EmpathyContact *interned;
+  gchar *key;
+
+  key = g_strdup_printf ("%s\n%s", empathy_contact_get_id (sender),
+      empathy_contact_get_logged_alias (sender));
+
+  interned = g_hash_table_lookup (self->priv->senders, key);
+  if (interned != NULL)
+    {
+      g_free (key);
+      return interned;
+    }
+
+  g_hash_table_insert (self->priv->senders, key, sender);
+  g_object_weak_ref (G_OBJECT (sender), theme_adium_sender_finalized_cb,
+      self);
+
+  return sender;
+}
+
+static AdiumMessage *
+theme_adium_copy_message (EmpathyThemeAdium *self,
+    const AdiumMessage *am)
+{
+  AdiumMessage *copy;
+  const gchar *body;
+  gsize body_len, token_len;
+  gchar *p;
+
+  body = am->body != NULL ? am->body : "";
+  body_len = strlen (body) + 1;
+  token_len = am->token != NULL ? strlen (am->token) + 1 : 0;
+
+  copy = g_malloc (sizeof (AdiumMessage) + body_len + token_len);
+  *copy = *am;
+  if (am->from_logs)
+    copy->sender = g_object_ref (theme_adium_intern_sender (self,
+          am->sender));
+  else
+    copy->sender = g_object_ref (am->sender);
+
+  p = (gchar *) (copy + 1);
+  copy->body = memcpy (p, body, body_len);
+  copy->token = token_len != 0 ? memcpy (p + body_len, am->token, token_len)
+    : NULL;
+
+  return copy;
+}
+
+static void
+adium_message_free (AdiumMessage *am)
+{
+  g_object_unref (am->sender);
+  g_free (am);
+}
+
 typedef struct
 {
   guint type;
-  EmpathyMessage *msg;
+  AdiumMessage *msg;
   char *str;
+  /* QUEUED_EVENT_MARKUP only */
+  char *fallback;
   gboolean should_highlight;
+  /* In message_queue, TRUE if it was prepended to the view. Items are
+   * kept in the order they came in and replayed the same way.
+   * recent_items is in display order and only has appended items. */
+  gboolean prepend;
 } QueuedItem;
 
 static QueuedItem *
-queue_item (GQueue *queue,
+theme_adium_new_queued_item (EmpathyThemeAdium *self,
     guint type,
-    EmpathyMessage *msg,
+    const AdiumMessage *msg,
     const char *str,
-    gboolean should_highlight,
-    gboolean prepend)
+    const char *fallback,
+    gboolean should_highlight)
 {
   QueuedItem *item = g_slice_new0 (QueuedItem);
 
   item->type = type;
   if (msg != NULL)
-    item->msg = g_object_ref (msg);
+    item->msg = theme_adium_copy_message (self, msg);
   item->str = g_strdup (str);
+  item->fallback = g_strdup (fallback);
   item->should_highlight = should_highlight;
 
-  if (prepend)
-    g_queue_push_head (queue, item);
-  else
-    g_queue_push_tail (queue, item);
-
   return item;
 }
 
 static void
 free_queued_item (QueuedItem *item)
 {
-  tp_clear_object (&item->msg);
+  tp_clear_pointer (&item->msg, adium_message_free);
   g_free (item->str);
+  g_free (item->fallback);
 
   g_slice_free (QueuedItem, item);
 }
 
+/* Remember what is shown, so it can be shown again after hibernating */
+static void
+theme_adium_record_item (EmpathyThemeAdium *self,
+    QueuedItem *item,
+    gboolean prepend)
+{
+  GQueue *items = &self->priv->recent_items;
+
+  /* Replayed in display order when waking up */
+  item->prepend = FALSE;
+
+  if (!prepend)
+    {
+      g_queue_push_tail (items, item);
+    }
+  else if (items->length < HIBERNATION_RECORD_SIZE)
+    {
+      g_queue_push_head (items, item);
+      return;
+    }
+  else
+    {
+      /* Older than everything we keep */
+      free_queued_item (item);
+      self->priv->recent_items_truncated = TRUE;
+      return;
+    }
+
+  if (items->length > HIBERNATION_RECORD_SIZE)
+    {
+      free_queued_item (g_queue_pop_head (items));
+      self->priv->recent_items_truncated = TRUE;
+    }
+}
+
+/* Returns TRUE if the item can't be rendered now. It is then queued until
+ * the page is loaded or the view thawed, or only recorded while
+ * hibernating. Otherwise it is recorded and the caller renders it. */
+static gboolean
+theme_adium_defer_item (EmpathyThemeAdium *self,
+    guint type,
+    const AdiumMessage *msg,
+    const char *str,
+    const char *fallback,
+    gboolean should_highlight,
+    gboolean prepend)
+{
+  QueuedItem *item;
+
+  if (!self->priv->hibernating &&
+      (self->priv->pages_loading != 0 || self->priv->frozen))
+    {
+      item = theme_adium_new_queued_item (self, type, msg, str, fallback,
+          should_highlight);
+      item->prepend = prepend;
+      g_queue_push_tail (&self->priv->message_queue, item);
+      return TRUE;
+    }
+
+  /* Older than everything we keep */
+  if (prepend && self->priv->recent_items.length >= HIBERNATION_RECORD_SIZE)
+    {
+      self->priv->recent_items_truncated = TRUE;
+      return self->priv->hibernating;
+    }
+
+  item = theme_adium_new_queued_item (self, type, msg, str, fallback,
+      should_highlight);
+  theme_adium_record_item (self, item, prepend);
+
+  return self->priv->hibernating;
+}
+
 static gboolean
 theme_adium_policy_decision_requested_cb (WebKitWebView *view,
     WebKitPolicyDecision *decision,
@@ -209,6 +536,37 @@ string_with_format (const gchar *format,
   return g_string_free (result, FALSE);
 }
 
+/* empathy-chat.js is the same for every view, so we intentionally
+ * leak the script and let all the views share it */
+static WebKitUserScript *
+theme_adium_get_chat_script (void)
+{
+  static WebKitUserScript *script = NULL;
+
+  if (script == NULL)
+    {
+      GBytes *bytes;
+
+      bytes = g_resources_lookup_data (
+          "/org/gnome/Empathy/Chat/empathy-chat.js",
+          G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+
+      if (bytes == NULL)
+        return NULL;
+
+      /* Inject it once the template has been parsed, it needs the
+       * #Chat node and overrides some of the template's functions */
+      script = webkit_user_script_new (g_bytes_get_data (bytes, NULL),
+          WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+          WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_END,
+          NULL, NULL);
+
+      g_bytes_unref (bytes);
+    }
+
+  return script;
+}
+
 static void
 theme_adium_load_template (EmpathyThemeAdium *self)
 {
@@ -238,11 +596,11 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
   const gchar *text,
   const gchar *token)
 {
-  TpawStringParser *parsers;
+  const EmpathyStringScanner *scanner;
   GString *string;
 
   /* Check if we have to parse smileys */
-  parsers = empathy_webkit_get_string_parser (
+  scanner = empathy_webkit_get_string_scanner (
     g_settings_get_boolean (self->priv->gsettings_chat,
       EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
 
@@ -258,7 +616,7 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
       "<span id=\"message-token-%s\">",
       token);
 
-  tpaw_string_parser_substr (text, -1, parsers, string);
+  empathy_string_scan (scanner, text, -1, string);
 
   if (!tp_str_empty (token))
     g_string_append (string, "<span class=\"status\" /></span>");
@@ -275,8 +633,26 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
 static void
 escape_and_append_len (GString *string, const gchar *str, gint len)
 {
-  while (str != NULL && *str != '\0' && len != 0)
+  if (str == NULL)
+    return;
+
+  while (*str != '\0' && len != 0)
     {
+      gsize run;
+
+      /* Copy everything up to the next character to escape at once */
+      run = strcspn (str, "\\\"\n");
+      if (len > 0 && run > (gsize) len)
+        run = len;
+
+      g_string_append_len (string, str, run);
+      str += run;
+      if (len > 0)
+        len -= run;
+
+      if (*str == '\0' || len == 0)
+        break;
+
       switch (*str)
         {
           case '\\':
@@ -290,8 +666,6 @@ escape_and_append_len (GString *string, const gchar *str, gint len)
           case '\n':
             /* Remove end of lines */
             break;
-          default:
-            g_string_append_c (string, *str);
         }
 
       str++;
@@ -509,87 +883,64 @@ nsdate_to_strftime (EmpathyAdiumData *data, const gchar *nsdate)
 }
 
 static void
-web_view_javascript_finished (GObject      *object,
-                              GAsyncResult *result,
-                              gpointer      user_data)
+adium_template_flush_literal (AdiumTemplate *tmpl,
+    GString *literal)
 {
-    WebKitJavascriptResult *js_result;
-    JSValueRef              value;
-    JSGlobalContextRef      context;
-    GError                 *error = NULL;
+  AdiumSegment segment = { ADIUM_SEGMENT_LITERAL, };
 
-    js_result = webkit_web_view_run_javascript_finish (WEBKIT_WEB_VIEW (object), result, &error);
-    if (!js_result) {
-        g_warning ("Error running javascript: %s", error->message);
-        g_error_free (error);
-        return;
-    }
+  if (literal->len == 0)
+    return;
 
-    context = webkit_javascript_result_get_global_context (js_result);
-    value = webkit_javascript_result_get_value (js_result);
-    if (JSValueIsString (context, value)) {
-        JSStringRef js_str_value;
-        gchar      *str_value;
-        gsize       str_length;
-
-        js_str_value = JSValueToStringCopy (context, value, NULL);
-        str_length = JSStringGetMaximumUTF8CStringSize (js_str_value);
-        str_value = (gchar *)g_malloc (str_length);
-        JSStringGetUTF8CString (js_str_value, str_value, str_length);
-        JSStringRelease (js_str_value);
-        g_print ("Script result: %s type: \n", str_value);
-        g_free (str_value);
-    } else if (!JSValueIsNull(context, value)) {
-        g_warning ("Script result: value of type %d", JSValueGetType(context, value));
-    }
-    webkit_javascript_result_unref (js_result);
+  segment.literal = g_strndup (literal->str, literal->len);
+  segment.literal_len = literal->len;
+  g_array_append_val (tmpl->segments, segment);
+
+  tmpl->literal_len += literal->len;
+  g_string_truncate (literal, 0);
 }
 
-static void
-theme_adium_add_html (EmpathyThemeAdium *self,
-    const gchar *func,
-    const gchar *html,
-    const gchar *message,
-    const gchar *avatar_filename,
-    const gchar *name,
-    const gchar *contact_id,
-    const gchar *service_name,
-    const gchar *message_classes,
-    gint64 timestamp,
-    gboolean is_backlog,
-    gboolean outgoing,
-    PangoDirection direction)
+/* Split html into literal and keyword segments. Literals are escaped
+ * right away, rendering a message then only has to fill the keywords.
+ * See theme_adium_add_html(). */
+static AdiumTemplate *
+adium_template_compile (EmpathyAdiumData *data,
+    const gchar *html)
 {
-  GBytes *bytes;
-  GString *string;
-  const gchar *cur = NULL;
-  const gchar *js;
-  gchar *script;
+  AdiumTemplate *tmpl;
+  GString *literal;
+  const gchar *cur;
 
-  /* Make some search-and-replace in the html code */
-  string = g_string_sized_new (strlen (html) + strlen (message));
-  g_string_append_printf (string, "%s(\"", func);
+  tmpl = g_slice_new0 (AdiumTemplate);
+  tmpl->segments = g_array_new (FALSE, TRUE, sizeof (AdiumSegment));
+
+  if (html == NULL)
+    return tmpl;
+
+  literal = g_string_sized_new (strlen (html));
 
   for (cur = html; *cur != '\0'; cur++)
     {
-      const gchar *replace = NULL;
-      gchar *dup_replace = NULL;
+      AdiumSegment segment = { ADIUM_SEGMENT_LITERAL, };
+      gboolean matched = TRUE;
       gchar *format = NULL;
 
       /* Those are all well known keywords that needs replacement in
        * html files. Please keep them in the same order than the adium
-       * spec. See http://trac.adium.im/wiki/CreatingMessageStyles */
+       * spec. See http://trac.adium.im/wiki/CreatingMessageStyles
+       *
+       * Keywords we don't support keep the ADIUM_SEGMENT_LITERAL type
+       * and are stripped. */
       if (theme_adium_match (&cur, "%userIconPath%"))
         {
-          replace = avatar_filename;
+          segment.type = ADIUM_SEGMENT_USER_ICON_PATH;
         }
       else if (theme_adium_match (&cur, "%senderScreenName%"))
         {
-          replace = contact_id;
+          segment.type = ADIUM_SEGMENT_SENDER_SCREEN_NAME;
         }
       else if (theme_adium_match (&cur, "%sender%"))
         {
-          replace = name;
+          segment.type = ADIUM_SEGMENT_SENDER;
         }
       else if (theme_adium_match (&cur, "%senderColor%"))
         {
@@ -598,18 +949,7 @@ theme_adium_add_html (EmpathyThemeAdium *self,
            * Incoming/SenderColors.txt it will be used instead of
            * the default colors.
            */
-
-          /* Ensure we always use the same color when sending messages
-           * (bgo #658821) */
-          if (outgoing)
-            {
-              replace = "inherit";
-            }
-          else if (contact_id != NULL)
-            {
-              guint hash = g_str_hash (contact_id);
-              replace = colors[hash % G_N_ELEMENTS (colors)];
-            }
+          segment.type = ADIUM_SEGMENT_SENDER_COLOR;
         }
       else if (theme_adium_match (&cur, "%senderStatusIcon%"))
         {
@@ -619,22 +959,7 @@ theme_adium_add_html (EmpathyThemeAdium *self,
         }
       else if (theme_adium_match (&cur, "%messageDirection%"))
         {
-          switch (direction)
-            {
-              case PANGO_DIRECTION_LTR:
-              case PANGO_DIRECTION_TTB_LTR:
-              case PANGO_DIRECTION_WEAK_LTR:
-                replace = "ltr";
-                break;
-              case PANGO_DIRECTION_RTL:
-              case PANGO_DIRECTION_TTB_RTL:
-              case PANGO_DIRECTION_WEAK_RTL:
-                replace = "rtl";
-                break;
-              case PANGO_DIRECTION_NEUTRAL:
-              default:
-                break;
-            }
+          segment.type = ADIUM_SEGMENT_MESSAGE_DIRECTION;
         }
       else if (theme_adium_match (&cur, "%senderDisplayName%"))
         {
@@ -644,7 +969,7 @@ theme_adium_add_html (EmpathyThemeAdium *self,
            *  We don't have access to that yet so we use
            * local alias instead.
            */
-          replace = name;
+          segment.type = ADIUM_SEGMENT_SENDER;
         }
       else if (theme_adium_match (&cur, "%senderPrefix%"))
         {
@@ -665,34 +990,21 @@ theme_adium_add_html (EmpathyThemeAdium *self,
         }
       else if (theme_adium_match (&cur, "%message%"))
         {
-          replace = message;
+          segment.type = ADIUM_SEGMENT_MESSAGE;
         }
       else if (theme_adium_match (&cur, "%time%") ||
            theme_adium_match_with_format (&cur, "%time{", &format))
         {
-          const gchar *strftime_format;
-
-          strftime_format = nsdate_to_strftime (self->priv->data, format);
-          if (is_backlog)
-            dup_replace = tpaw_time_to_string_local (timestamp,
-              strftime_format ? strftime_format :
-              TPAW_TIME_DATE_FORMAT_DISPLAY_SHORT);
-          else
-            dup_replace = tpaw_time_to_string_local (timestamp,
-              strftime_format ? strftime_format :
-              TPAW_TIME_FORMAT_DISPLAY_SHORT);
-
-          replace = dup_replace;
+          segment.type = ADIUM_SEGMENT_TIME;
+          segment.time_format = nsdate_to_strftime (data, format);
         }
       else if (theme_adium_match (&cur, "%shortTime%"))
         {
-          dup_replace = tpaw_time_to_string_local (timestamp,
-            TPAW_TIME_FORMAT_DISPLAY_SHORT);
-          replace = dup_replace;
+          segment.type = ADIUM_SEGMENT_SHORT_TIME;
         }
       else if (theme_adium_match (&cur, "%service%"))
         {
-          replace = service_name;
+          segment.type = ADIUM_SEGMENT_SERVICE;
         }
       else if (theme_adium_match (&cur, "%variant%"))
         {
@@ -704,11 +1016,11 @@ theme_adium_add_html (EmpathyThemeAdium *self,
         }
       else if (theme_adium_match (&cur, "%userIcons%"))
         {
-          replace = self->priv->show_avatars ? "showIcons" : "hideIcons";
+          segment.type = ADIUM_SEGMENT_USER_ICONS;
         }
       else if (theme_adium_match (&cur, "%messageClasses%"))
         {
-          replace = message_classes;
+          segment.type = ADIUM_SEGMENT_MESSAGE_CLASSES;
         }
       else if (theme_adium_match (&cur, "%status%"))
         {
@@ -741,32 +1053,351 @@ theme_adium_add_html (EmpathyThemeAdium *self,
         }
       else
         {
-          escape_and_append_len (string, cur, 1);
+          matched = FALSE;
+        }
+
+      g_free (format);
+
+      if (!matched)
+        {
+          escape_and_append_len (literal, cur, 1);
           continue;
         }
 
+      if (segment.type == ADIUM_SEGMENT_LITERAL)
+        continue;
+
+      adium_template_flush_literal (tmpl, literal);
+      g_array_append_val (tmpl->segments, segment);
+    }
+
+  adium_template_flush_literal (tmpl, literal);
+  g_string_free (literal, TRUE);
+
+  return tmpl;
+}
+
+static void
+adium_template_free (AdiumTemplate *tmpl)
+{
+  guint i;
+
+  for (i = 0; i < tmpl->segments->len; i++)
+    g_free (g_array_index (tmpl->segments, AdiumSegment, i).literal);
+
+  g_array_unref (tmpl->segments);
+  g_slice_free (AdiumTemplate, tmpl);
+}
+
+static gchar *
+theme_adium_js_value_dup_string (JSGlobalContextRef context,
+    JSValueRef value)
+{
+  JSStringRef js_str_value;
+  gchar *str_value;
+  gsize str_length;
+
+  js_str_value = JSValueToStringCopy (context, value, NULL);
+  str_length = JSStringGetMaximumUTF8CStringSize (js_str_value);
+  str_value = (gchar *) g_malloc (str_length);
+  JSStringGetUTF8CString (js_str_value, str_value, str_length);
+  JSStringRelease (js_str_value);
+
+  return str_value;
+}
+
+static void
+web_view_javascript_finished (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+    WebKitJavascriptResult *js_result;
+    JSValueRef              value;
+    JSGlobalContextRef      context;
+    GError                 *error = NULL;
+
+    js_result = webkit_web_view_run_javascript_finish (WEBKIT_WEB_VIEW (object), result, &error);
+    if (!js_result) {
+        g_warning ("Error running javascript: %s", error->message);
+        g_error_free (error);
+        return;
+    }
+
+    context = webkit_javascript_result_get_global_context (js_result);
+    value = webkit_javascript_result_get_value (js_result);
+    if (JSValueIsString (context, value)) {
+        gchar      *str_value;
+
+        /* The exceptions thrown by the scripts of the batch, see
+         * SCRIPT_BEGIN */
+        str_value = theme_adium_js_value_dup_string (context, value);
+        g_warning ("Error running javascript: %s", str_value);
+        g_free (str_value);
+    } else if (!JSValueIsNull(context, value)) {
+        g_warning ("Script result: value of type %d", JSValueGetType(context, value));
+    }
+    webkit_javascript_result_unref (js_result);
+}
+
+/* Each script of a batch is run in its own try block, so one throwing
+ * doesn't stop the others. The batch evaluates to their exceptions. */
+#define SCRIPTS_PROLOGUE "var empathyScriptErrors = [];\n"
+#define SCRIPT_BEGIN "try { "
+#define SCRIPT_END \
+  "; } catch (e) { empathyScriptErrors.push (String (e)); }\n"
+#define SCRIPTS_EPILOGUE \
+  "empathyScriptErrors.length > 0 ? empathyScriptErrors.join (\"\\n\") : null"
+
+static gboolean
+theme_adium_flush_scripts (EmpathyThemeAdium *self)
+{
+  self->priv->flush_scripts_id = 0;
+
+  /* Will be flushed once the page is loaded */
+  if (self->priv->pages_loading != 0 || self->priv->hibernating)
+    return G_SOURCE_REMOVE;
+
+  if (self->priv->pending_scripts->len == 0)
+    return G_SOURCE_REMOVE;
+
+  g_string_prepend (self->priv->pending_scripts, SCRIPTS_PROLOGUE);
+  g_string_append (self->priv->pending_scripts, SCRIPTS_EPILOGUE);
+
+  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (self),
+      self->priv->pending_scripts->str, NULL, web_view_javascript_finished,
+      NULL);
+  g_string_truncate (self->priv->pending_scripts, 0);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Scripts are appended to pending_scripts and sent in one go once the
+ * main loop is idle. When a burst of messages comes in (eg. backlog when
+ * reconnecting) the web view only has to run one script instead of one
+ * per message. */
+static void
+theme_adium_schedule_flush (EmpathyThemeAdium *self)
+{
+  if (self->priv->flush_scripts_id != 0)
+    return;
+
+  self->priv->flush_scripts_id = g_idle_add (
+      (GSourceFunc) theme_adium_flush_scripts, self);
+}
+
+static void
+theme_adium_queue_script (EmpathyThemeAdium *self,
+    const gchar *script)
+{
+  /* There is no page to run it on, it will be rendered again from
+   * recent_items */
+  if (self->priv->hibernating)
+    return;
+
+  /* Keep it in order with the queued messages it may be about */
+  if (self->priv->frozen)
+    {
+      g_queue_push_tail (&self->priv->message_queue,
+          theme_adium_new_queued_item (self, QUEUED_SCRIPT, NULL, script,
+            NULL, FALSE));
+      return;
+    }
+
+  g_string_append (self->priv->pending_scripts, SCRIPT_BEGIN);
+  g_string_append (self->priv->pending_scripts, script);
+  g_string_append (self->priv->pending_scripts, SCRIPT_END);
+
+  theme_adium_schedule_flush (self);
+}
+
+/* Starts each html added as a new node. pruneMessages() looks for it rather
+ * than counting the elements of #Chat: a theme's html may have several
+ * top-level elements, and the template buffers the latest ones. */
+#define NODE_MARKER "<span class=\\\"x-empathy-message\\\" hidden></span>"
+
+static void
+theme_adium_add_html (EmpathyThemeAdium *self,
+    const gchar *func,
+    gboolean new_node,
+    const AdiumTemplate *tmpl,
+    const gchar *message,
+    const gchar *avatar_filename,
+    const gchar *name,
+    const gchar *contact_id,
+    const gchar *service_name,
+    const gchar *message_classes,
+    gint64 timestamp,
+    gboolean is_backlog,
+    gboolean outgoing,
+    PangoDirection direction)
+{
+  GString *string = self->priv->pending_scripts;
+  guint i;
+
+  /* Fill the keyword slots of the precompiled html, directly in the
+   * pending scripts */
+  g_string_append_printf (string, SCRIPT_BEGIN "%s(\"", func);
+
+  if (new_node)
+    g_string_append (string, NODE_MARKER);
+
+  for (i = 0; i < tmpl->segments->len; i++)
+    {
+      const AdiumSegment *segment;
+      const gchar *replace = NULL;
+      gchar *dup_replace = NULL;
+
+      segment = &g_array_index (tmpl->segments, AdiumSegment, i);
+
+      switch (segment->type)
+        {
+          case ADIUM_SEGMENT_LITERAL:
+            /* Already escaped by adium_template_compile() */
+            g_string_append_len (string, segment->literal,
+                segment->literal_len);
+            continue;
+
+          case ADIUM_SEGMENT_USER_ICON_PATH:
+            replace = avatar_filename;
+            break;
+
+          case ADIUM_SEGMENT_SENDER_SCREEN_NAME:
+            replace = contact_id;
+            break;
+
+          case ADIUM_SEGMENT_SENDER:
+            replace = name;
+            break;
+
+          case ADIUM_SEGMENT_SENDER_COLOR:
+            /* Ensure we always use the same color when sending messages
+             * (bgo #658821) */
+            if (outgoing)
+              {
+                replace = "inherit";
+              }
+            else if (contact_id != NULL)
+              {
+                guint hash = g_str_hash (contact_id);
+                replace = colors[hash % G_N_ELEMENTS (colors)];
+              }
+            break;
+
+          case ADIUM_SEGMENT_MESSAGE_DIRECTION:
+            switch (direction)
+              {
+                case PANGO_DIRECTION_LTR:
+                case PANGO_DIRECTION_TTB_LTR:
+                case PANGO_DIRECTION_WEAK_LTR:
+                  replace = "ltr";
+                  break;
+                case PANGO_DIRECTION_RTL:
+                case PANGO_DIRECTION_TTB_RTL:
+                case PANGO_DIRECTION_WEAK_RTL:
+                  replace = "rtl";
+                  break;
+                case PANGO_DIRECTION_NEUTRAL:
+                default:
+                  break;
+              }
+            break;
+
+          case ADIUM_SEGMENT_MESSAGE:
+            replace = message;
+            break;
+
+          case ADIUM_SEGMENT_TIME:
+            if (is_backlog)
+              dup_replace = tpaw_time_to_string_local (timestamp,
+                segment->time_format ? segment->time_format :
+                TPAW_TIME_DATE_FORMAT_DISPLAY_SHORT);
+            else
+              dup_replace = tpaw_time_to_string_local (timestamp,
+                segment->time_format ? segment->time_format :
+                TPAW_TIME_FORMAT_DISPLAY_SHORT);
+
+            replace = dup_replace;
+            break;
+
+          case ADIUM_SEGMENT_SHORT_TIME:
+            dup_replace = tpaw_time_to_string_local (timestamp,
+              TPAW_TIME_FORMAT_DISPLAY_SHORT);
+            replace = dup_replace;
+            break;
+
+          case ADIUM_SEGMENT_SERVICE:
+            replace = service_name;
+            break;
+
+          case ADIUM_SEGMENT_USER_ICONS:
+            replace = self->priv->show_avatars ? "showIcons" : "hideIcons";
+            break;
+
+          case ADIUM_SEGMENT_MESSAGE_CLASSES:
+            replace = message_classes;
+            break;
+        }
+
       /* Here we have a replacement to make */
       escape_and_append_len (string, replace, -1);
 
       g_free (dup_replace);
-      g_free (format);
     }
-  g_string_append (string, "\")");
+  g_string_append (string, "\")" SCRIPT_END);
+
+  theme_adium_schedule_flush (self);
+}
+
+/* Remove the oldest nodes from the view once there are more than
+ * scrollback_limit of them. We allow 10% more nodes than the limit so
+ * we don't have to prune for each new message. */
+static void
+theme_adium_maybe_prune (EmpathyThemeAdium *self)
+{
+  GArray *nodes = self->priv->nodes;
+  guint limit = self->priv->scrollback_limit;
+  AdiumNode *first;
+  gint64 first_timestamp;
+  gchar *first_token;
+  gchar *script;
+  guint n;
+
+  if (limit == 0 || !self->priv->at_bottom)
+    return;
+
+  if (nodes->len <= limit + limit / 10)
+    return;
+
+  n = nodes->len - limit;
+  first = &g_array_index (nodes, AdiumNode, n);
+  first_timestamp = first->timestamp;
+  first_token = g_strdup (first->token);
+  g_array_remove_range (nodes, 0, n);
+
+  DEBUG ("Pruning %u messages older than %" G_GINT64_FORMAT, n,
+      first_timestamp);
+
+  script = g_strdup_printf ("pruneMessages(%u)", n);
+  theme_adium_queue_script (self, script);
+  g_free (script);
+
+  /* The next prepended message can't be joined with a pruned one */
+  g_clear_object (&self->priv->first_contact);
+  self->priv->first_timestamp = first_timestamp;
 
-  bytes = g_resources_lookup_data ("/org/gnome/Empathy/Chat/empathy-chat.js",
-      G_RESOURCE_LOOKUP_FLAGS_NONE,
-      NULL);
+  g_signal_emit (self, signals[SIG_PRUNED], 0, first_timestamp, first_token);
+  g_free (first_token);
+}
 
-  if (bytes != NULL)
-    {
-      js = (const gchar *) g_bytes_get_data (bytes, NULL);
-      g_string_prepend (string, js);
-      g_bytes_unref (bytes);
-    }
+static void
+theme_adium_node_appended (EmpathyThemeAdium *self,
+    gint64 timestamp,
+    const gchar *token)
+{
+  AdiumNode node = { timestamp, g_strdup (token) };
 
-  script = g_string_free (string, FALSE);
-  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (self), script, NULL, web_view_javascript_finished, NULL);
-  g_free (script);
+  g_array_append_val (self->priv->nodes, node);
+  theme_adium_maybe_prune (self);
 }
 
 static void
@@ -774,9 +1405,12 @@ theme_adium_append_event_escaped (EmpathyThemeAdium *self,
     const gchar *escaped,
     PangoDirection direction)
 {
-  theme_adium_add_html (self, "appendMessage",
-      self->priv->data->status_html, escaped, NULL, NULL, NULL,
-      NULL, "event", tpaw_time_get_current (), FALSE, FALSE, direction);
+  gint64 timestamp = tpaw_time_get_current ();
+
+  theme_adium_add_html (self, "appendMessage", TRUE,
+      self->priv->data->status, escaped, NULL, NULL, NULL,
+      NULL, "event", timestamp, FALSE, FALSE, direction);
+  theme_adium_node_appended (self, timestamp, NULL);
 
   /* There is no last contact */
   if (self->priv->last_contact)
@@ -785,83 +1419,16 @@ theme_adium_append_event_escaped (EmpathyThemeAdium *self,
       self->priv->last_contact = NULL;
     }
 }
-#if 0
-/* FIXME: check what this is for and port to WebKit2 */
-static void
-theme_adium_remove_focus_marks (EmpathyThemeAdium *self,
-    WebKitDOMNodeList *nodes)
-{
-  guint i;
-
-  /* Remove focus and firstFocus class */
-  for (i = 0; i < webkit_dom_node_list_get_length (nodes); i++)
-    {
-      WebKitDOMNode *node = webkit_dom_node_list_item (nodes, i);
-      WebKitDOMElement *element = WEBKIT_DOM_ELEMENT (node);
-      gchar *class_name;
-      gchar **classes, **iter;
-      GString *new_class_name;
-      gboolean first = TRUE;
-
-      if (element == NULL)
-        continue;
-
-      class_name = webkit_dom_element_get_class_name (element);
-      classes = g_strsplit (class_name, " ", -1);
-      new_class_name = g_string_sized_new (strlen (class_name));
-
-      for (iter = classes; *iter != NULL; iter++)
-        {
-          if (tp_strdiff (*iter, "focus") &&
-              tp_strdiff (*iter, "firstFocus"))
-            {
-              if (!first)
-                g_string_append_c (new_class_name, ' ');
-
-              g_string_append (new_class_name, *iter);
-              first = FALSE;
-            }
-        }
-
-      webkit_dom_element_set_class_name (element, new_class_name->str);
 
-      g_free (class_name);
-      g_strfreev (classes);
-      g_string_free (new_class_name, TRUE);
-    }
-}
-#endif
 static void
 theme_adium_remove_all_focus_marks (EmpathyThemeAdium *self)
 {
-#if 0
-  /* FIXME: check what this is for and port to WebKit2 */
-  WebKitDOMDocument *dom;
-  WebKitDOMNodeList *nodes;
-  GError *error = NULL;
-
   if (!self->priv->has_unread_message)
     return;
 
   self->priv->has_unread_message = FALSE;
 
-  dom = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (self));
-  if (dom == NULL)
-    return;
-
-  /* Get all nodes with focus class */
-  nodes = webkit_dom_document_query_selector_all (dom, ".focus", &error);
-
-  if (nodes == NULL)
-    {
-      DEBUG ("Error getting focus nodes: %s",
-        error ? error->message : "No error");
-      g_clear_error (&error);
-      return;
-    }
-
-  theme_adium_remove_focus_marks (self, nodes);
-#endif
+  theme_adium_queue_script (self, "removeFocusMarks(\".focus\")");
 }
 
 enum
@@ -904,10 +1471,12 @@ enum
  * - last message was recieved recently,
  * - last message and this message both are/aren't backlog, and
  * - DisableCombineConsecutive is not set in theme's settings
+ *
+ * Returns: %TRUE if @msg was added as a consecutive message
  */
-static void
+static gboolean
 theme_adium_add_message (EmpathyThemeAdium *self,
-    EmpathyMessage *msg,
+    const AdiumMessage *msg,
     EmpathyContact **prev_contact,
     gint64 *prev_timestamp,
     gboolean *prev_is_backlog,
@@ -915,7 +1484,6 @@ theme_adium_add_message (EmpathyThemeAdium *self,
     const gchar *js_funcs[])
 {
   EmpathyContact *sender;
-  TpMessage *tp_msg;
   TpAccount *account;
   gchar *body_escaped, *name_escaped;
   const gchar *name;
@@ -923,7 +1491,7 @@ theme_adium_add_message (EmpathyThemeAdium *self,
   EmpathyAvatar *avatar;
   const gchar *avatar_filename = NULL;
   gint64 timestamp;
-  const gchar *html = NULL;
+  const AdiumTemplate *html = NULL;
   const gchar *func;
   const gchar *service_name;
   GString *message_classes = NULL;
@@ -934,20 +1502,17 @@ theme_adium_add_message (EmpathyThemeAdium *self,
 
 
   /* Get information */
-  sender = empathy_message_get_sender (msg);
+  sender = msg->sender;
   account = empathy_contact_get_account (sender);
   service_name = tpaw_protocol_name_to_display_name
     (tp_account_get_protocol_name (account));
   if (service_name == NULL)
     service_name = tp_account_get_protocol_name (account);
-  timestamp = empathy_message_get_timestamp (msg);
-  body_escaped = theme_adium_parse_body (self,
-    empathy_message_get_body (msg),
-    empathy_message_get_token (msg));
+  timestamp = msg->timestamp;
+  body_escaped = theme_adium_parse_body (self, msg->body, msg->token);
   name = empathy_contact_get_logged_alias (sender);
   contact_id = empathy_contact_get_id (sender);
-  action = (empathy_message_get_tptype (msg) ==
-      TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION);
+  action = (msg->type == TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION);
 
   name_escaped = g_markup_escape_text (name, -1);
 
@@ -994,7 +1559,7 @@ theme_adium_add_message (EmpathyThemeAdium *self,
         }
     }
 
-  is_backlog = empathy_message_is_backlog (msg);
+  is_backlog = msg->is_backlog;
   consecutive = empathy_contact_equal (*prev_contact, sender) &&
     (ABS (timestamp - *prev_timestamp) < MESSAGE_JOIN_PERIOD) &&
     (is_backlog == *prev_is_backlog) &&
@@ -1027,8 +1592,7 @@ theme_adium_add_message (EmpathyThemeAdium *self,
   if (should_highlight)
     g_string_append (message_classes, " mention");
 
-  if (empathy_message_get_tptype (msg) ==
-      TP_CHANNEL_TEXT_MESSAGE_TYPE_AUTO_REPLY)
+  if (msg->type == TP_CHANNEL_TEXT_MESSAGE_TYPE_AUTO_REPLY)
     g_string_append (message_classes, " autoreply");
 
   if (action)
@@ -1038,7 +1602,7 @@ theme_adium_add_message (EmpathyThemeAdium *self,
    * status - the message is a status change
    * event - the message is a notification of something happening
    *         (for example, encryption being turned on)
-   * %status% - See %status% in theme_adium_add_html ()
+   * %status% - See %status% in adium_template_compile ()
    */
 
   /* This is slightly a hack, but it's the only way to add
@@ -1046,17 +1610,9 @@ theme_adium_add_message (EmpathyThemeAdium *self,
    * class called "x-empathy-message-id-*" to the message. This
    * way, we can remove the unread marker for this specific
    * message later. */
-  tp_msg = empathy_message_get_tp_message (msg);
-  if (tp_msg != NULL)
-    {
-      guint32 id;
-      gboolean valid;
-
-      id = tp_message_get_pending_message_id (tp_msg, &valid);
-      if (valid)
-        g_string_append_printf (message_classes,
-            " x-empathy-message-id-%u", id);
-    }
+  if (msg->has_pending_id)
+    g_string_append_printf (message_classes,
+        " x-empathy-message-id-%u", msg->pending_id);
 
   /* Define javascript function to use */
   if (consecutive)
@@ -1071,12 +1627,12 @@ theme_adium_add_message (EmpathyThemeAdium *self,
       /* out */
       if (is_backlog)
         /* context */
-        html = consecutive ? self->priv->data->out_nextcontext_html :
-          self->priv->data->out_context_html;
+        html = consecutive ? self->priv->data->out_nextcontext :
+          self->priv->data->out_context;
       else
         /* content */
-        html = consecutive ? self->priv->data->out_nextcontent_html :
-          self->priv->data->out_content_html;
+        html = consecutive ? self->priv->data->out_nextcontent :
+          self->priv->data->out_content;
 
       /* remove all the unread marks when we are sending a message */
       theme_adium_remove_all_focus_marks (self);
@@ -1086,17 +1642,17 @@ theme_adium_add_message (EmpathyThemeAdium *self,
       /* in */
       if (is_backlog)
         /* context */
-        html = consecutive ? self->priv->data->in_nextcontext_html :
-          self->priv->data->in_context_html;
+        html = consecutive ? self->priv->data->in_nextcontext :
+          self->priv->data->in_context;
       else
         /* content */
-        html = consecutive ? self->priv->data->in_nextcontent_html :
-          self->priv->data->in_content_html;
+        html = consecutive ? self->priv->data->in_nextcontent :
+          self->priv->data->in_content;
     }
 
-  direction = pango_find_base_dir (empathy_message_get_body (msg), -1);
+  direction = pango_find_base_dir (msg->body, -1);
 
-  theme_adium_add_html (self, func, html, body_escaped,
+  theme_adium_add_html (self, func, !consecutive, html, body_escaped,
       avatar_filename, name_escaped, contact_id,
       service_name, message_classes->str,
       timestamp, is_backlog, empathy_contact_is_user (sender), direction);
@@ -1112,11 +1668,13 @@ theme_adium_add_message (EmpathyThemeAdium *self,
   g_free (body_escaped);
   g_free (name_escaped);
   g_string_free (message_classes, TRUE);
+
+  return consecutive;
 }
 
-void
-empathy_theme_adium_append_message (EmpathyThemeAdium *self,
-    EmpathyMessage *msg,
+static void
+theme_adium_append_message (EmpathyThemeAdium *self,
+    const AdiumMessage *msg,
     gboolean should_highlight)
 {
   const gchar *js_funcs[] = { "appendNextMessage",
@@ -1124,16 +1682,25 @@ empathy_theme_adium_append_message (EmpathyThemeAdium *self,
       "appendMessage",
       "appendMessageNoScroll" };
 
-  if (self->priv->pages_loading != 0)
-    {
-      queue_item (&self->priv->message_queue, QUEUED_MESSAGE, msg, NULL,
-          should_highlight, FALSE);
-      return;
-    }
+  if (theme_adium_defer_item (self, QUEUED_MESSAGE, msg, NULL, NULL,
+        should_highlight, FALSE))
+    return;
+
+  if (!theme_adium_add_message (self, msg, &self->priv->last_contact,
+        &self->priv->last_timestamp, &self->priv->last_is_backlog,
+        should_highlight, js_funcs))
+    theme_adium_node_appended (self, msg->timestamp, msg->token);
+}
+
+void
+empathy_theme_adium_append_message (EmpathyThemeAdium *self,
+    EmpathyMessage *msg,
+    gboolean should_highlight)
+{
+  AdiumMessage am;
 
-  theme_adium_add_message (self, msg, &self->priv->last_contact,
-      &self->priv->last_timestamp, &self->priv->last_is_backlog,
-      should_highlight, js_funcs);
+  adium_message_init (&am, msg);
+  theme_adium_append_message (self, &am, should_highlight);
 }
 
 void
@@ -1143,11 +1710,9 @@ empathy_theme_adium_append_event (EmpathyThemeAdium *self,
   gchar *str_escaped;
   PangoDirection direction;
 
-  if (self->priv->pages_loading != 0)
-    {
-      queue_item (&self->priv->message_queue, QUEUED_EVENT, NULL, str, FALSE, FALSE);
-      return;
-    }
+  if (theme_adium_defer_item (self, QUEUED_EVENT, NULL, str, NULL,
+        FALSE, FALSE))
+    return;
 
   direction = pango_find_base_dir (str, -1);
   str_escaped = g_markup_escape_text (str, -1);
@@ -1162,13 +1727,17 @@ empathy_theme_adium_append_event_markup (EmpathyThemeAdium *self,
 {
   PangoDirection direction;
 
+  if (theme_adium_defer_item (self, QUEUED_EVENT_MARKUP, NULL, markup_text,
+        fallback_text, FALSE, FALSE))
+    return;
+
   direction = pango_find_base_dir (fallback_text, -1);
   theme_adium_append_event_escaped (self, markup_text, direction);
 }
 
-void
-empathy_theme_adium_prepend_message (EmpathyThemeAdium *self,
-    EmpathyMessage *msg,
+static void
+theme_adium_prepend_message (EmpathyThemeAdium *self,
+    const AdiumMessage *msg,
     gboolean should_highlight)
 {
   const gchar *js_funcs[] = { "prependPrev",
@@ -1176,16 +1745,174 @@ empathy_theme_adium_prepend_message (EmpathyThemeAdium *self,
       "prepend",
       "prepend" };
 
-  if (self->priv->pages_loading != 0)
+  if (theme_adium_defer_item (self, QUEUED_MESSAGE, msg, NULL, NULL,
+        should_highlight, TRUE))
+    return;
+
+  if (!theme_adium_add_message (self, msg, &self->priv->first_contact,
+        &self->priv->first_timestamp, &self->priv->first_is_backlog,
+        should_highlight, js_funcs))
     {
-      queue_item (&self->priv->message_queue, QUEUED_MESSAGE, msg, NULL,
-          should_highlight, TRUE);
-      return;
+      AdiumNode node = { msg->timestamp, g_strdup (msg->token) };
+
+      g_array_prepend_val (self->priv->nodes, node);
+    }
+}
+
+void
+empathy_theme_adium_prepend_message (EmpathyThemeAdium *self,
+    EmpathyMessage *msg,
+    gboolean should_highlight)
+{
+  AdiumMessage am;
+
+  adium_message_init (&am, msg);
+  theme_adium_prepend_message (self, &am, should_highlight);
+}
+
+/* Messages prepended between begin_prepend() and end_prepend() don't move
+ * what the user is looking at, the view scrolls down by their height. */
+void
+empathy_theme_adium_begin_prepend (EmpathyThemeAdium *self)
+{
+  /* Nothing is shown yet, the queued messages are added on load */
+  if (self->priv->pages_loading != 0 || self->priv->frozen)
+    return;
+
+  theme_adium_queue_script (self, "beginPrepend()");
+}
+
+void
+empathy_theme_adium_end_prepend (EmpathyThemeAdium *self)
+{
+  if (self->priv->pages_loading != 0 || self->priv->frozen)
+    return;
+
+  theme_adium_queue_script (self, "endPrepend()");
+}
+
+/**
+ * empathy_theme_adium_hibernate:
+ * @self: an #EmpathyThemeAdium
+ *
+ * Unloads the page, releasing its document and the memory used to render
+ * it, for views nobody looks at. Only the latest messages and events are
+ * kept; they keep being recorded, without being rendered, until
+ * empathy_theme_adium_wake() loads the page again and renders them all at
+ * once.
+ */
+void
+empathy_theme_adium_hibernate (EmpathyThemeAdium *self)
+{
+  if (self->priv->hibernating || self->priv->pages_loading != 0)
+    return;
+
+  /* Messages received while frozen were never rendered, nor recorded */
+  while (!g_queue_is_empty (&self->priv->message_queue))
+    {
+      QueuedItem *item = g_queue_pop_head (&self->priv->message_queue);
+
+      if (item->type != QUEUED_SCRIPT)
+        theme_adium_record_item (self, item, item->prepend);
+      else
+        free_queued_item (item);
+    }
+
+  DEBUG ("Hibernating, %u items kept", self->priv->recent_items.length);
+  self->priv->hibernating = TRUE;
+
+  g_string_truncate (self->priv->pending_scripts, 0);
+  if (self->priv->flush_scripts_id != 0)
+    {
+      g_source_remove (self->priv->flush_scripts_id);
+      self->priv->flush_scripts_id = 0;
+    }
+
+  /* Messages will be added to an empty page again */
+  g_clear_object (&self->priv->first_contact);
+  g_clear_object (&self->priv->last_contact);
+  self->priv->first_timestamp = 0;
+  self->priv->last_timestamp = 0;
+  self->priv->first_is_backlog = FALSE;
+  self->priv->last_is_backlog = FALSE;
+  g_array_set_size (self->priv->nodes, 0);
+
+  /* Counted like the template, so if we wake up before it is loaded its
+   * LOAD_FINISHED isn't taken for the template's */
+  self->priv->pages_loading++;
+  webkit_web_view_load_html (WEBKIT_WEB_VIEW (self), "", NULL);
+}
+
+void
+empathy_theme_adium_wake (EmpathyThemeAdium *self)
+{
+  GList *l;
+
+  if (!self->priv->hibernating)
+    return;
+
+  DEBUG ("Waking up");
+  self->priv->hibernating = FALSE;
+  self->priv->at_bottom = TRUE;
+
+  /* Render everything we kept in one go once the template is loaded */
+  g_assert (g_queue_is_empty (&self->priv->message_queue));
+  self->priv->message_queue = self->priv->recent_items;
+  g_queue_init (&self->priv->recent_items);
+
+  theme_adium_load_template (self);
+
+  if (!self->priv->recent_items_truncated)
+    return;
+
+  /* Older messages are now only in the logs */
+  self->priv->recent_items_truncated = FALSE;
+
+  for (l = self->priv->message_queue.head; l != NULL; l = l->next)
+    {
+      QueuedItem *item = l->data;
+
+      if (item->msg != NULL)
+        {
+          g_signal_emit (self, signals[SIG_PRUNED], 0, item->msg->timestamp,
+              item->msg->token);
+          break;
+        }
     }
+}
+
+/**
+ * empathy_theme_adium_freeze:
+ * @self: an #EmpathyThemeAdium
+ *
+ * Stops rendering messages and events, for views which are not visible.
+ * They are queued, in order, and rendered at once by
+ * empathy_theme_adium_thaw().
+ */
+void
+empathy_theme_adium_freeze (EmpathyThemeAdium *self)
+{
+  if (self->priv->frozen)
+    return;
+
+  DEBUG ("Freezing");
+  self->priv->frozen = TRUE;
+}
+
+void
+empathy_theme_adium_thaw (EmpathyThemeAdium *self)
+{
+  if (!self->priv->frozen)
+    return;
+
+  DEBUG ("Thawing, %u items queued", self->priv->message_queue.length);
+  self->priv->frozen = FALSE;
+
+  /* The queue will be displayed once the page is loaded */
+  if (self->priv->pages_loading != 0 || self->priv->hibernating)
+    return;
 
-  theme_adium_add_message (self, msg, &self->priv->first_contact,
-      &self->priv->first_timestamp, &self->priv->first_is_backlog,
-      should_highlight, js_funcs);
+  theme_adium_replay_queue (self);
 }
 
 void
@@ -1307,7 +2034,7 @@ empathy_theme_adium_scroll (EmpathyThemeAdium *self,
 void
 empathy_theme_adium_scroll_down (EmpathyThemeAdium *self)
 {
-  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (self), "alignChat(true);", NULL, NULL, NULL);
+  theme_adium_queue_script (self, "alignChat(true)");
 }
 
 static void
@@ -1347,7 +2074,13 @@ empathy_theme_adium_can_copy_finish (EmpathyThemeAdium *self,
 void
 empathy_theme_adium_clear (EmpathyThemeAdium *self)
 {
-  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (self), "clearPage()", NULL, NULL, NULL);
+  g_queue_foreach (&self->priv->recent_items, (GFunc) free_queued_item, NULL);
+  g_queue_clear (&self->priv->recent_items);
+  self->priv->recent_items_truncated = FALSE;
+  theme_adium_clear_senders (self);
+  g_array_set_size (self->priv->nodes, 0);
+
+  theme_adium_queue_script (self, "clearPage()");
   empathy_theme_adium_scroll_down (self);
 
   /* Clear last contact to avoid trying to add a 'joined'
@@ -1418,33 +2151,12 @@ static void
 theme_adium_remove_mark_from_message (EmpathyThemeAdium *self,
     guint32 id)
 {
-#if 0
-  /* FIXME: check what this is for and port to WebKit2 */
-  WebKitDOMDocument *dom;
-  WebKitDOMNodeList *nodes;
-  gchar *class;
-  GError *error = NULL;
-
-  dom = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (self));
-  if (dom == NULL)
-    return;
-
-  class = g_strdup_printf (".x-empathy-message-id-%u", id);
-
-  /* Get all nodes with focus class */
-  nodes = webkit_dom_document_query_selector_all (dom, class, &error);
-  g_free (class);
-
-  if (nodes == NULL)
-    {
-      DEBUG ("Error getting focus nodes: %s",
-        error ? error->message : "No error");
-      g_clear_error (&error);
-      return;
-    }
+  gchar *script;
 
-  theme_adium_remove_focus_marks (self, nodes);
-#endif
+  script = g_strdup_printf ("removeFocusMarks(\".x-empathy-message-id-%u\")",
+      id);
+  theme_adium_queue_script (self, script);
+  g_free (script);
 }
 
 static void
@@ -1533,47 +2245,138 @@ empathy_theme_adium_set_show_avatars (EmpathyThemeAdium *self,
 }
 
 static void
-theme_adium_load_changed_cb (WebKitWebView *view,
-    WebKitLoadEvent event,
-    gpointer user_data)
+theme_adium_script_message_received_cb (WebKitUserContentManager *manager,
+    WebKitJavascriptResult *js_result,
+    EmpathyThemeAdium *self)
 {
-  EmpathyThemeAdium *self = EMPATHY_THEME_ADIUM (view);
-  GList *l;
+  JSGlobalContextRef context;
+  JSValueRef value;
+  gchar *message;
 
-  if (event != WEBKIT_LOAD_FINISHED)
+  context = webkit_javascript_result_get_global_context (js_result);
+  value = webkit_javascript_result_get_value (js_result);
+  if (!JSValueIsString (context, value))
     return;
 
-  DEBUG ("Page loaded");
-  self->priv->pages_loading--;
+  /* See notifyScroll() in empathy-chat.js */
+  message = theme_adium_js_value_dup_string (context, value);
 
-  if (self->priv->pages_loading != 0)
-    return;
+  self->priv->at_bottom = !tp_strdiff (message, "at-bottom");
 
-  /* Display queued messages */
-  for (l = self->priv->message_queue.head; l != NULL; l = l->next)
+  if (self->priv->at_bottom)
+    theme_adium_maybe_prune (self);
+  else if (!tp_strdiff (message, "near-top"))
+    g_signal_emit (self, signals[SIG_NEAR_TOP], 0);
+
+  g_free (message);
+}
+
+static void
+theme_adium_scrollback_limit_changed_cb (GSettings *gsettings_chat,
+    const gchar *key,
+    EmpathyThemeAdium *self)
+{
+  self->priv->scrollback_limit = g_settings_get_uint (gsettings_chat,
+      EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT);
+
+  theme_adium_maybe_prune (self);
+}
+
+/* Display queued messages */
+static void
+theme_adium_replay_queue (EmpathyThemeAdium *self)
+{
+  GQueue queue = self->priv->message_queue;
+  gboolean prepending = FALSE;
+  GList *l;
+
+  g_queue_init (&self->priv->message_queue);
+
+  for (l = queue.head; l != NULL; l = l->next)
     {
       QueuedItem *item = l->data;
 
+      /* Each run of prepended messages is added like a page of history,
+       * see empathy_theme_adium_begin_prepend() */
+      if (item->prepend != prepending)
+        {
+          theme_adium_queue_script (self,
+              item->prepend ? "beginPrepend()" : "endPrepend()");
+          prepending = item->prepend;
+        }
+
       switch (item->type)
         {
           case QUEUED_MESSAGE:
-            empathy_theme_adium_append_message (self, item->msg,
-              item->should_highlight);
-            break;
-
-          case QUEUED_EDIT:
-            empathy_theme_adium_edit_message (self, item->msg);
+            if (item->prepend)
+              theme_adium_prepend_message (self, item->msg,
+                item->should_highlight);
+            else
+              theme_adium_append_message (self, item->msg,
+                item->should_highlight);
             break;
 
           case QUEUED_EVENT:
             empathy_theme_adium_append_event (self, item->str);
             break;
+
+          case QUEUED_EVENT_MARKUP:
+            empathy_theme_adium_append_event_markup (self, item->str,
+              item->fallback);
+            break;
+
+          case QUEUED_SCRIPT:
+            theme_adium_queue_script (self, item->str);
+            break;
         }
 
       free_queued_item (item);
     }
 
-  g_queue_clear (&self->priv->message_queue);
+  if (prepending)
+    theme_adium_queue_script (self, "endPrepend()");
+
+  g_queue_clear (&queue);
+
+  /* Send everything queued as one script */
+  if (self->priv->flush_scripts_id != 0)
+    {
+      g_source_remove (self->priv->flush_scripts_id);
+      self->priv->flush_scripts_id = 0;
+    }
+
+  theme_adium_flush_scripts (self);
+}
+
+static void
+theme_adium_load_changed_cb (WebKitWebView *view,
+    WebKitLoadEvent event,
+    gpointer user_data)
+{
+  EmpathyThemeAdium *self = EMPATHY_THEME_ADIUM (view);
+
+  if (event != WEBKIT_LOAD_FINISHED)
+    return;
+
+  /* Every load ends with LOAD_FINISHED, even the ones cancelled by
+   * the next load */
+  g_return_if_fail (self->priv->pages_loading != 0);
+
+  DEBUG ("Page loaded");
+  self->priv->pages_loading--;
+
+  if (self->priv->pages_loading != 0)
+    return;
+
+  /* The empty page loaded by empathy_theme_adium_hibernate() */
+  if (self->priv->hibernating)
+    return;
+
+  /* Messages queued while frozen are displayed once thawed */
+  if (self->priv->frozen)
+    return;
+
+  theme_adium_replay_queue (self);
 }
 
 static void
@@ -1587,6 +2390,9 @@ theme_adium_finalize (GObject *object)
   g_object_unref (self->priv->gsettings_desktop);
 
   g_free (self->priv->variant);
+  g_string_free (self->priv->pending_scripts, TRUE);
+  g_array_unref (self->priv->nodes);
+  g_hash_table_unref (self->priv->senders);
 
   G_OBJECT_CLASS (empathy_theme_adium_parent_class)->finalize (object);
 }
@@ -1621,6 +2427,19 @@ theme_adium_dispose (GObject *object)
       g_queue_clear (&self->priv->acked_messages);
     }
 
+  g_queue_foreach (&self->priv->recent_items, (GFunc) free_queued_item, NULL);
+  g_queue_clear (&self->priv->recent_items);
+  g_queue_foreach (&self->priv->message_queue, (GFunc) free_queued_item,
+      NULL);
+  g_queue_clear (&self->priv->message_queue);
+  theme_adium_clear_senders (self);
+
+  if (self->priv->flush_scripts_id != 0)
+    {
+      g_source_remove (self->priv->flush_scripts_id);
+      self->priv->flush_scripts_id = 0;
+    }
+
   G_OBJECT_CLASS (empathy_theme_adium_parent_class)->dispose (object);
 }
 
@@ -1631,6 +2450,8 @@ theme_adium_constructed (GObject *object)
   const gchar *font_family = NULL;
   gint font_size = 0;
   WebKitWebView *webkit_view = WEBKIT_WEB_VIEW (object);
+  WebKitUserContentManager *manager;
+  WebKitUserScript *chat_script;
 
   G_OBJECT_CLASS (empathy_theme_adium_parent_class)->constructed (object);
 
@@ -1656,6 +2477,20 @@ theme_adium_constructed (GObject *object)
         "default-charset", "utf8",
         NULL);
 
+  /* Install our helper library once, messages are then added with
+   * plain calls to its functions */
+  manager = webkit_web_view_get_user_content_manager (webkit_view);
+
+  chat_script = theme_adium_get_chat_script ();
+  if (chat_script != NULL)
+    webkit_user_content_manager_add_script (manager, chat_script);
+
+  /* Messages posted by empathy-chat.js */
+  g_signal_connect_object (manager, "script-message-received::empathy",
+      G_CALLBACK (theme_adium_script_message_received_cb), self, 0);
+  webkit_user_content_manager_register_script_message_handler (manager,
+      "empathy");
+
   /* Load template */
   theme_adium_load_template (EMPATHY_THEME_ADIUM (object));
 
@@ -1736,6 +2571,25 @@ empathy_theme_adium_class_init (EmpathyThemeAdiumClass *klass)
         G_PARAM_READWRITE |
         G_PARAM_STATIC_STRINGS));
 
+  /* Emitted when the oldest messages have been removed from the view.
+   * @first_timestamp and @first_token (which may be %NULL) are the ones of
+   * the oldest message still displayed; messages sharing its timestamp
+   * may have been removed as well. */
+  signals[SIG_PRUNED] = g_signal_new ("pruned",
+      G_OBJECT_CLASS_TYPE (klass),
+      G_SIGNAL_RUN_LAST,
+      0, NULL, NULL, NULL,
+      G_TYPE_NONE,
+      2, G_TYPE_INT64, G_TYPE_STRING);
+
+  /* Emitted when the user scrolls close to the top of the view */
+  signals[SIG_NEAR_TOP] = g_signal_new ("near-top",
+      G_OBJECT_CLASS_TYPE (klass),
+      G_SIGNAL_RUN_LAST,
+      0, NULL, NULL, NULL,
+      G_TYPE_NONE,
+      0);
+
   g_type_class_add_private (object_class, sizeof (EmpathyThemeAdiumPriv));
 }
 
@@ -1747,6 +2601,13 @@ empathy_theme_adium_init (EmpathyThemeAdium *self)
 
   self->priv->in_construction = TRUE;
   g_queue_init (&self->priv->message_queue);
+  g_queue_init (&self->priv->recent_items);
+  self->priv->senders = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  self->priv->pending_scripts = g_string_sized_new (4096);
+  self->priv->nodes = g_array_new (FALSE, FALSE, sizeof (AdiumNode));
+  g_array_set_clear_func (self->priv->nodes, adium_node_clear);
+  self->priv->at_bottom = TRUE;
   self->priv->allow_scrolling = TRUE;
   self->priv->smiley_manager = empathy_smiley_manager_dup_singleton ();
 
@@ -1762,6 +2623,12 @@ empathy_theme_adium_init (EmpathyThemeAdium *self)
   self->priv->gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
   self->priv->gsettings_desktop = g_settings_new (
     EMPATHY_PREFS_DESKTOP_INTERFACE_SCHEMA);
+
+  self->priv->scrollback_limit = g_settings_get_uint (
+      self->priv->gsettings_chat, EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT);
+  g_signal_connect (self->priv->gsettings_chat,
+      "changed::" EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT,
+      G_CALLBACK (theme_adium_scrollback_limit_changed_cb), self);
 }
 
 EmpathyThemeAdium *
@@ -1797,10 +2664,10 @@ empathy_theme_adium_set_variant (EmpathyThemeAdium *self,
   DEBUG ("Update view with variant: '%s'", variant);
   variant_path = adium_info_dup_path_for_variant (self->priv->data->info,
     self->priv->variant);
-  script = g_strdup_printf ("setStylesheet(\"mainStyle\",\"%s\");",
+  script = g_strdup_printf ("setStylesheet(\"mainStyle\",\"%s\")",
       variant_path);
 
-  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (self), script, NULL, NULL, NULL);
+  theme_adium_queue_script (self, script);
 
   g_free (variant_path);
   g_free (script);
@@ -2019,6 +2886,7 @@ empathy_adium_data_new_with_info (const gchar *path,
   EmpathyAdiumData *data;
   gchar *template_html = NULL;
   gchar *footer_html = NULL;
+  GHashTable *compiled;
   gchar *tmp;
 
   g_return_val_if_fail (empathy_adium_path_is_valid (path), NULL);
@@ -2031,6 +2899,8 @@ empathy_adium_data_new_with_info (const gchar *path,
   data->info = g_hash_table_ref (info);
   data->version = adium_info_get_version (info);
   data->strings_to_free = g_ptr_array_new_with_free_func (g_free);
+  data->templates_to_free = g_ptr_array_new_with_free_func (
+    (GDestroyNotify) adium_template_free);
   data->date_format_cache = g_hash_table_new_full (g_str_hash,
     g_str_equal, g_free, g_free);
 
@@ -2097,6 +2967,33 @@ empathy_adium_data_new_with_info (const gchar *path,
 
 #undef FALLBACK
 
+  /* Compile html files, fallbacks share the same template */
+  compiled = g_hash_table_new (NULL, NULL);
+
+#define COMPILE(html, tmpl) \
+  { \
+    tmpl = g_hash_table_lookup (compiled, html); \
+    if (tmpl == NULL) { \
+      tmpl = adium_template_compile (data, html); \
+      g_ptr_array_add (data->templates_to_free, tmpl); \
+      g_hash_table_insert (compiled, (gpointer) html, tmpl); \
+    } \
+  }
+
+  COMPILE (data->in_content_html,      data->in_content);
+  COMPILE (data->in_nextcontent_html,  data->in_nextcontent);
+  COMPILE (data->in_context_html,      data->in_context);
+  COMPILE (data->in_nextcontext_html,  data->in_nextcontext);
+  COMPILE (data->out_content_html,     data->out_content);
+  COMPILE (data->out_nextcontent_html, data->out_nextcontent);
+  COMPILE (data->out_context_html,     data->out_context);
+  COMPILE (data->out_nextcontext_html, data->out_nextcontext);
+  COMPILE (data->status_html,          data->status);
+
+#undef COMPILE
+
+  g_hash_table_unref (compiled);
+
   /* template -> empathy's template */
   data->custom_template = (template_html != NULL);
   if (template_html == NULL)
@@ -2201,6 +3098,7 @@ empathy_adium_data_unref (EmpathyAdiumData *data)
     g_free (data->default_outgoing_avatar_filename);
     g_hash_table_unref (data->info);
     g_ptr_array_unref (data->strings_to_free);
+    g_ptr_array_unref (data->templates_to_free);
     tp_clear_pointer (&data->date_format_cache, g_hash_table_unref);
 
     g_slice_free (EmpathyAdiumData, data);
@@ -2244,6 +3142,6 @@ empathy_theme_adium_set_message_status_marker (EmpathyThemeAdium *self,
         status_char = "";
     }
   script = g_strdup_printf ("setDeliveryStatus(\"%s\", \"%s\")", token, status_char);
-  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (self), script, NULL, NULL, NULL);
+  theme_adium_queue_script (self, script);
   g_free (script);
 }
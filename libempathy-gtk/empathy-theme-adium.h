@@ -91,6 +91,18 @@ void empathy_theme_adium_prepend_message (EmpathyThemeAdium *self,
     EmpathyMessage *msg,
     gboolean should_highlight);
 
+void empathy_theme_adium_begin_prepend (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_end_prepend (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_hibernate (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_wake (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_freeze (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_thaw (EmpathyThemeAdium *self);
+
 void empathy_theme_adium_edit_message (EmpathyThemeAdium *self,
     EmpathyMessage *message);
 
@@ -28,6 +28,10 @@
 #define DEBUG_FLAG EMPATHY_DEBUG_OTHER
 #include "empathy-debug.h"
 
+/* Number of views kept loaded in advance, see
+ * empathy_theme_manager_prepare_views() */
+#define VIEW_POOL_SIZE 2
+
 struct _EmpathyThemeManagerPriv
 {
   GSettings   *gsettings_chat;
@@ -38,6 +42,12 @@ struct _EmpathyThemeManagerPriv
   gchar *adium_variant;
   /* list of weakref to EmpathyThemeAdium objects */
   GList *adium_views;
+
+  /* Views with the template already loading, not handed out yet. They are
+   * still floating. */
+  GQueue view_pool;
+  gboolean use_view_pool;
+  guint fill_view_pool_id;
 };
 
 enum
@@ -118,6 +128,48 @@ theme_manager_create_adium_view (EmpathyThemeManager *self)
   return theme;
 }
 
+static void
+theme_manager_clear_view_pool (EmpathyThemeManager *self)
+{
+  GtkWidget *view;
+
+  while ((view = g_queue_pop_head (&self->priv->view_pool)) != NULL)
+    {
+      g_object_ref_sink (view);
+      g_object_unref (view);
+    }
+}
+
+static gboolean
+theme_manager_fill_view_pool_cb (gpointer user_data)
+{
+  EmpathyThemeManager *self = user_data;
+
+  if (self->priv->adium_data == NULL ||
+      self->priv->view_pool.length >= VIEW_POOL_SIZE)
+    {
+      self->priv->fill_view_pool_id = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  /* One view per iteration, loading a template is not free */
+  DEBUG ("Preparing a view, %u ready", self->priv->view_pool.length);
+  g_queue_push_tail (&self->priv->view_pool,
+      theme_manager_create_adium_view (self));
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+theme_manager_schedule_fill_view_pool (EmpathyThemeManager *self)
+{
+  if (!self->priv->use_view_pool || self->priv->fill_view_pool_id != 0)
+    return;
+
+  self->priv->fill_view_pool_id = g_idle_add_full (G_PRIORITY_LOW,
+      theme_manager_fill_view_pool_cb, self, NULL);
+}
+
 static void
 theme_manager_notify_theme_cb (GSettings *gsettings_chat,
     const gchar *key,
@@ -142,9 +194,11 @@ theme_manager_notify_theme_cb (GSettings *gsettings_chat,
   /* Load new theme data, we can stop tracking existing views since we
    * won't be able to change them live anymore */
   clear_list_of_views (&self->priv->adium_views);
+  theme_manager_clear_view_pool (self);
   tp_clear_pointer (&self->priv->adium_data, empathy_adium_data_unref);
   self->priv->adium_data = empathy_adium_data_new (path);
 
+  theme_manager_schedule_fill_view_pool (self);
   theme_manager_emit_changed (self);
 
   g_free (path);
@@ -180,12 +234,38 @@ theme_manager_notify_adium_variant_cb (GSettings *gsettings_chat,
 EmpathyThemeAdium *
 empathy_theme_manager_create_view (EmpathyThemeManager *self)
 {
+  EmpathyThemeAdium *view;
+
   g_return_val_if_fail (EMPATHY_IS_THEME_MANAGER (self), NULL);
 
-  if (self->priv->adium_data != NULL)
-    return theme_manager_create_adium_view (self);
+  if (self->priv->adium_data == NULL)
+    g_return_val_if_reached (NULL);
+
+  view = g_queue_pop_head (&self->priv->view_pool);
+  if (view == NULL)
+    view = theme_manager_create_adium_view (self);
 
-  g_return_val_if_reached (NULL);
+  theme_manager_schedule_fill_view_pool (self);
+
+  return view;
+}
+
+/**
+ * empathy_theme_manager_prepare_views:
+ * @self: an #EmpathyThemeManager
+ *
+ * Keeps a few views with the theme's template loaded in advance, so
+ * empathy_theme_manager_create_view() returns a view ready to display
+ * messages. Used by the process displaying chats; the pool is filled, and
+ * refilled after a view is taken, when the main loop is idle.
+ */
+void
+empathy_theme_manager_prepare_views (EmpathyThemeManager *self)
+{
+  g_return_if_fail (EMPATHY_IS_THEME_MANAGER (self));
+
+  self->priv->use_view_pool = TRUE;
+  theme_manager_schedule_fill_view_pool (self);
 }
 
 static void
@@ -198,7 +278,11 @@ theme_manager_finalize (GObject *object)
   if (self->priv->emit_changed_idle != 0)
     g_source_remove (self->priv->emit_changed_idle);
 
+  if (self->priv->fill_view_pool_id != 0)
+    g_source_remove (self->priv->fill_view_pool_id);
+
   clear_list_of_views (&self->priv->adium_views);
+  theme_manager_clear_view_pool (self);
   g_free (self->priv->adium_variant);
   tp_clear_pointer (&self->priv->adium_data, empathy_adium_data_unref);
 
@@ -35,11 +35,13 @@
 #include <X11/Xatom.h>
 #include <gdk/gdkx.h>
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 #include <gio/gdesktopappinfo.h>
 #include <tp-account-widgets/tpaw-live-search.h>
 #include <tp-account-widgets/tpaw-pixbuf-utils.h>
 #include <tp-account-widgets/tpaw-utils.h>
 
+#include "empathy-avatar-cache.h"
 #include "empathy-ft-factory.h"
 #include "empathy-images.h"
 #include "empathy-utils.h"
@@ -319,6 +321,35 @@ avatar_pixbuf_from_loader (GdkPixbufLoader *loader)
   return pixbuf_round_corners (pixbuf);
 }
 
+/* Returns the key of the avatar stored in @path in the avatar cache, or NULL
+ * if it can't be read. Some folks backends write a changed avatar to the same
+ * file, so the key changes along with the file's inode, size and
+ * modification time. */
+static gchar *
+avatar_cache_key_for_path (const gchar *path)
+{
+  GStatBuf st;
+
+  if (path == NULL || g_stat (path, &st) != 0)
+    return NULL;
+
+  return g_strdup_printf ("%s\n%" G_GUINT64_FORMAT "\n%" G_GINT64_FORMAT
+      "\n%" G_GINT64_FORMAT, path, (guint64) st.st_ino, (gint64) st.st_size,
+      (gint64) st.st_mtime);
+}
+
+/* Contacts and individuals share the key of the same file. An avatar which
+ * isn't stored in a file is keyed by its Telepathy token, changing with its
+ * image. */
+static gchar *
+avatar_get_cache_key (EmpathyAvatar *avatar)
+{
+  if (avatar->filename != NULL)
+    return avatar_cache_key_for_path (avatar->filename);
+
+  return g_strdup (avatar->token);
+}
+
 static GdkPixbuf *
 empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
     gint width,
@@ -328,10 +359,23 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
   GdkPixbufLoader *loader;
   struct SizeData data;
   GError *error = NULL;
+  gchar *key;
 
   if (!avatar)
     return NULL;
 
+  key = avatar_get_cache_key (avatar);
+  if (key != NULL)
+    {
+      pixbuf = empathy_avatar_cache_lookup (
+          empathy_avatar_cache_get_default (), key, width, height, TRUE);
+      if (pixbuf != NULL)
+        {
+          g_free (key);
+          return pixbuf;
+        }
+    }
+
   data.width = width;
   data.height = height;
   data.preserve_aspect_ratio = TRUE;
@@ -344,6 +388,7 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
   if (avatar->len == 0)
     {
       g_warning ("Avatar has 0 length");
+      g_free (key);
       return NULL;
     }
   else if (!gdk_pixbuf_loader_write (loader, avatar->data, avatar->len, &error))
@@ -353,6 +398,7 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
           avatar->data, avatar->len, error->message);
 
       g_error_free (error);
+      g_free (key);
       return NULL;
     }
 
@@ -361,6 +407,11 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
 
   g_object_unref (loader);
 
+  if (pixbuf != NULL && key != NULL)
+    empathy_avatar_cache_insert (empathy_avatar_cache_get_default (), key,
+        width, height, TRUE, pixbuf);
+
+  g_free (key);
   return pixbuf;
 }
 
@@ -384,6 +435,8 @@ typedef struct
   guint width;
   guint height;
   GCancellable *cancellable;
+  /* Key of the avatar in the cache, or NULL */
+  gchar *key;
 } PixbufAvatarFromIndividualClosure;
 
 static PixbufAvatarFromIndividualClosure *
@@ -391,7 +444,8 @@ pixbuf_avatar_from_individual_closure_new (FolksIndividual *individual,
     GSimpleAsyncResult *result,
     gint width,
     gint height,
-    GCancellable *cancellable)
+    GCancellable *cancellable,
+    const gchar *key)
 {
   PixbufAvatarFromIndividualClosure *closure;
 
@@ -402,6 +456,7 @@ pixbuf_avatar_from_individual_closure_new (FolksIndividual *individual,
   closure->result = g_object_ref (result);
   closure->width = width;
   closure->height = height;
+  closure->key = g_strdup (key);
 
   if (cancellable != NULL)
     closure->cancellable = g_object_ref (cancellable);
@@ -415,23 +470,65 @@ pixbuf_avatar_from_individual_closure_free (
 {
   g_clear_object (&closure->cancellable);
   g_object_unref (closure->result);
+  g_free (closure->key);
   g_slice_free (PixbufAvatarFromIndividualClosure, closure);
 }
 
-/**
- * @pixbuf: (transfer all)
- *
- * Return: (transfer all)
- */
+/* Decode and scale the avatar in @stream the same way as
+ * empathy_pixbuf_from_avatar_scaled(), as both share the avatar cache */
 static GdkPixbuf *
-transform_pixbuf (GdkPixbuf *pixbuf)
+avatar_pixbuf_from_stream_scaled (GInputStream *stream,
+    gint width,
+    gint height,
+    GCancellable *cancellable,
+    GError **error)
 {
-  GdkPixbuf *result;
+  GdkPixbufLoader *loader;
+  struct SizeData data;
+  GdkPixbuf *pixbuf = NULL;
+  guchar buffer[4096];
+  gssize n;
 
-  result = pixbuf_round_corners (pixbuf);
-  g_object_unref (pixbuf);
+  data.width = width;
+  data.height = height;
+  data.preserve_aspect_ratio = TRUE;
 
-  return result;
+  loader = gdk_pixbuf_loader_new ();
+
+  g_signal_connect (loader, "size-prepared",
+      G_CALLBACK (pixbuf_from_avatar_size_prepared_cb), &data);
+
+  do
+    {
+      n = g_input_stream_read (stream, buffer, sizeof (buffer), cancellable,
+          error);
+
+      if (n > 0 && !gdk_pixbuf_loader_write (loader, buffer, n, error))
+        n = -1;
+    }
+  while (n > 0);
+
+  if (n < 0)
+    {
+      gdk_pixbuf_loader_close (loader, NULL);
+      goto out;
+    }
+
+  if (!gdk_pixbuf_loader_close (loader, error))
+    goto out;
+
+  if (gdk_pixbuf_loader_get_pixbuf (loader) == NULL)
+    {
+      g_set_error_literal (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+          "No image in the avatar");
+      goto out;
+    }
+
+  pixbuf = avatar_pixbuf_from_loader (loader);
+
+out:
+  g_object_unref (loader);
+  return pixbuf;
 }
 
 static void
@@ -443,7 +540,6 @@ avatar_icon_load_cb (GObject *object,
   PixbufAvatarFromIndividualClosure *closure = user_data;
   GInputStream *stream;
   GError *error = NULL;
-  GdkPixbuf *pixbuf;
   GdkPixbuf *final_pixbuf;
 
   stream = g_loadable_icon_load_finish (icon, result, NULL, &error);
@@ -454,19 +550,21 @@ avatar_icon_load_cb (GObject *object,
       goto out;
     }
 
-  pixbuf = gdk_pixbuf_new_from_stream_at_scale (stream,
-      closure->width, closure->height, TRUE, closure->cancellable, &error);
+  final_pixbuf = avatar_pixbuf_from_stream_scaled (stream,
+      closure->width, closure->height, closure->cancellable, &error);
 
   g_object_unref (stream);
 
-  if (pixbuf == NULL)
+  if (final_pixbuf == NULL)
     {
       DEBUG ("Failed to read avatar: %s", error->message);
       g_simple_async_result_set_from_error (closure->result, error);
       goto out;
     }
 
-  final_pixbuf = transform_pixbuf (pixbuf);
+  if (closure->key != NULL)
+    empathy_avatar_cache_insert (empathy_avatar_cache_get_default (),
+        closure->key, closure->width, closure->height, TRUE, final_pixbuf);
 
   /* Pass ownership of final_pixbuf to the result */
   g_simple_async_result_set_op_res_gpointer (closure->result,
@@ -491,6 +589,8 @@ empathy_pixbuf_avatar_from_individual_scaled_async (
   GLoadableIcon *avatar_icon;
   GSimpleAsyncResult *result;
   PixbufAvatarFromIndividualClosure *closure;
+  gchar *key = NULL;
+  GdkPixbuf *pixbuf = NULL;
 
   result = g_simple_async_result_new (G_OBJECT (individual),
       callback, user_data, empathy_pixbuf_avatar_from_individual_scaled_async);
@@ -508,14 +608,41 @@ empathy_pixbuf_avatar_from_individual_scaled_async (
       return;
     }
 
+  /* Only avatars stored in local files are cached */
+  if (G_IS_FILE_ICON (avatar_icon))
+    {
+      gchar *path;
+
+      path = g_file_get_path (g_file_icon_get_file (G_FILE_ICON (avatar_icon)));
+      key = avatar_cache_key_for_path (path);
+      g_free (path);
+    }
+
+  if (key != NULL)
+    pixbuf = empathy_avatar_cache_lookup (empathy_avatar_cache_get_default (),
+        key, width, height, TRUE);
+
+  if (pixbuf != NULL)
+    {
+      /* Pass ownership of pixbuf to the result */
+      g_simple_async_result_set_op_res_gpointer (result, pixbuf,
+          g_object_unref);
+
+      /* Callers expect the avatar to be loaded after they return */
+      g_simple_async_result_complete_in_idle (result);
+      goto out;
+    }
+
   closure = pixbuf_avatar_from_individual_closure_new (individual, result,
-      width, height, cancellable);
+      width, height, cancellable, key);
 
   g_return_if_fail (closure != NULL);
 
   g_loadable_icon_load_async (avatar_icon, width, cancellable,
       avatar_icon_load_cb, closure);
 
+out:
+  g_free (key);
   g_object_unref (result);
 }
 
@@ -1070,6 +1197,155 @@ empathy_individual_match_string (FolksIndividual *individual,
   return retval;
 }
 
+/* What individuals are sorted by, kept with the individual and updated
+ * only when its alias or presence change, so sorting a roster doesn't
+ * collate the same strings again for each comparison.
+ *
+ * The keys are checked against the alias and presence type they were built
+ * from on each use. Views resort from their own notify::alias and
+ * notify::presence-type handlers, which may run before any handler of ours
+ * would. */
+typedef struct
+{
+  /* The alias alias_key was built from */
+  gchar *alias;
+  /* g_utf8_collate_key() of the alias */
+  gchar *alias_key;
+  /* g_utf8_collate_key() of the individual's id, which doesn't change */
+  gchar *id_key;
+  /* The presence type presence_rank was computed from */
+  FolksPresenceType presence_type;
+  /* See presence_rank() */
+  gint presence_rank;
+} IndividualSortKey;
+
+static GQuark
+individual_sort_key_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (G_UNLIKELY (quark == 0))
+    quark = g_quark_from_static_string ("empathy-individual-sort-key");
+
+  return quark;
+}
+
+/* Orders presence types as tp_connection_presence_type_cmp_availability()
+ * does, the most available having the highest rank */
+static gint
+presence_rank (FolksPresenceType presence_type)
+{
+  static gint ranks[TP_NUM_CONNECTION_PRESENCE_TYPES];
+  static gboolean initialized = FALSE;
+  TpConnectionPresenceType type;
+
+  if (G_UNLIKELY (!initialized))
+    {
+      guint i, j;
+
+      for (i = 0; i < TP_NUM_CONNECTION_PRESENCE_TYPES; i++)
+        {
+          ranks[i] = 0;
+
+          for (j = 0; j < TP_NUM_CONNECTION_PRESENCE_TYPES; j++)
+            {
+              if (tp_connection_presence_type_cmp_availability (i, j) > 0)
+                ranks[i]++;
+            }
+        }
+
+      initialized = TRUE;
+    }
+
+  type = empathy_folks_presence_type_to_tp (presence_type);
+
+  if (type >= TP_NUM_CONNECTION_PRESENCE_TYPES)
+    type = TP_CONNECTION_PRESENCE_TYPE_UNSET;
+
+  return ranks[type];
+}
+
+static void
+individual_sort_key_free (gpointer data)
+{
+  IndividualSortKey *key = data;
+
+  g_free (key->alias);
+  g_free (key->alias_key);
+  g_free (key->id_key);
+
+  g_slice_free (IndividualSortKey, key);
+}
+
+static IndividualSortKey *
+individual_get_sort_key (FolksIndividual *individual)
+{
+  IndividualSortKey *key;
+  const gchar *alias;
+  FolksPresenceType presence_type;
+
+  key = g_object_get_qdata (G_OBJECT (individual),
+      individual_sort_key_quark ());
+
+  if (G_UNLIKELY (key == NULL))
+    {
+      key = g_slice_new0 (IndividualSortKey);
+      key->id_key = g_utf8_collate_key (folks_individual_get_id (individual),
+          -1);
+      key->presence_type = FOLKS_PRESENCE_TYPE_UNSET;
+      key->presence_rank = presence_rank (key->presence_type);
+
+      g_object_set_qdata_full (G_OBJECT (individual),
+          individual_sort_key_quark (), key, individual_sort_key_free);
+    }
+
+  alias = folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual));
+  if (key->alias_key == NULL || tp_strdiff (alias, key->alias))
+    {
+      g_free (key->alias);
+      g_free (key->alias_key);
+      key->alias = g_strdup (alias);
+      key->alias_key = g_utf8_collate_key (alias != NULL ? alias : "", -1);
+    }
+
+  presence_type = folks_presence_details_get_presence_type (
+      FOLKS_PRESENCE_DETAILS (individual));
+  if (presence_type != key->presence_type)
+    {
+      key->presence_type = presence_type;
+      key->presence_rank = presence_rank (presence_type);
+    }
+
+  return key;
+}
+
+/* Same result as g_utf8_collate() on the aliases */
+gint
+empathy_individual_compare_alias (FolksIndividual *individual_a,
+    FolksIndividual *individual_b)
+{
+  return strcmp (individual_get_sort_key (individual_a)->alias_key,
+      individual_get_sort_key (individual_b)->alias_key);
+}
+
+/* Same result as g_utf8_collate() on the ids */
+gint
+empathy_individual_compare_id (FolksIndividual *individual_a,
+    FolksIndividual *individual_b)
+{
+  return strcmp (individual_get_sort_key (individual_a)->id_key,
+      individual_get_sort_key (individual_b)->id_key);
+}
+
+/* The most available first */
+gint
+empathy_individual_compare_presence (FolksIndividual *individual_a,
+    FolksIndividual *individual_b)
+{
+  return individual_get_sort_key (individual_b)->presence_rank -
+    individual_get_sort_key (individual_a)->presence_rank;
+}
+
 void
 empathy_launch_program (const gchar *dir,
     const gchar *name,
@@ -106,6 +106,13 @@ gboolean empathy_individual_match_string (
     const gchar *text,
     GPtrArray *words);
 
+gint empathy_individual_compare_alias (FolksIndividual *individual_a,
+    FolksIndividual *individual_b);
+gint empathy_individual_compare_id (FolksIndividual *individual_a,
+    FolksIndividual *individual_b);
+gint empathy_individual_compare_presence (FolksIndividual *individual_a,
+    FolksIndividual *individual_b);
+
 void empathy_launch_program (const gchar *dir,
     const gchar *name,
     const gchar *args);
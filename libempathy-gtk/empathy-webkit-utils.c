@@ -194,6 +194,31 @@ empathy_webkit_get_string_parser (gboolean smileys)
     return string_parsers;
 }
 
+static const EmpathyStringScanner string_scanner = {
+  empathy_webkit_replace_imagelink,
+  tpaw_string_replace_link,
+  NULL,
+  "<br/>"
+};
+
+static const EmpathyStringScanner string_scanner_with_smiley = {
+  empathy_webkit_replace_imagelink,
+  tpaw_string_replace_link,
+  empathy_webkit_replace_smiley,
+  "<br/>"
+};
+
+/* Same output as empathy_webkit_get_string_parser() but in a single pass,
+ * see empathy_string_scan() */
+const EmpathyStringScanner *
+empathy_webkit_get_string_scanner (gboolean smileys)
+{
+  if (smileys)
+    return &string_scanner_with_smiley;
+  else
+    return &string_scanner;
+}
+
 static gboolean
 webkit_get_font_family (GValue *value,
     GVariant *variant,
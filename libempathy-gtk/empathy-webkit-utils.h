@@ -24,6 +24,8 @@
 #include <tp-account-widgets/tpaw-string-parser.h>
 #include <webkit2/webkit2.h>
 
+#include "empathy-string-parser.h"
+
 G_BEGIN_DECLS
 
 typedef enum {
@@ -32,6 +34,8 @@ typedef enum {
 } EmpathyWebKitMenuFlags;
 
 TpawStringParser * empathy_webkit_get_string_parser (gboolean smileys);
+const EmpathyStringScanner * empathy_webkit_get_string_scanner (
+    gboolean smileys);
 
 void empathy_webkit_bind_font_setting (WebKitWebView *webview,
     GSettings *gsettings,
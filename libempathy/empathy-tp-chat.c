@@ -35,9 +35,14 @@ struct _EmpathyTpChatPrivate
   TpAccount *account;
   EmpathyContact *user;
   EmpathyContact *remote_contact;
-  GList *members;
+  /* Owned EmpathyContact, most recent first */
+  GQueue *members;
+  /* borrowed EmpathyContact -> borrowed GList link in members */
+  GHashTable *members_index;
   /* Queue of messages signalled but not acked yet */
   GQueue *pending_messages_queue;
+  /* borrowed TpMessage -> borrowed GList link in pending_messages_queue */
+  GHashTable *pending_messages_index;
 
   /* Subject */
   gboolean supports_subject;
@@ -77,6 +82,7 @@ enum
   MESSAGE_ACKNOWLEDGED,
   SIG_MEMBER_RENAMED,
   SIG_MEMBERS_CHANGED,
+  SIG_MEMBERS_CHANGED_BATCH,
   LAST_SIGNAL
 };
 
@@ -234,9 +240,9 @@ empathy_tp_chat_get_members (EmpathyTpChat *self)
 {
   GList *members = NULL;
 
-  if (self->priv->members)
+  if (!g_queue_is_empty (self->priv->members))
     {
-      members = g_list_copy (self->priv->members);
+      members = g_list_copy (self->priv->members->head);
       g_list_foreach (members, (GFunc) g_object_ref, NULL);
     }
   else
@@ -294,6 +300,8 @@ tp_chat_build_message (EmpathyTpChat *self,
     }
 
   g_queue_push_tail (self->priv->pending_messages_queue, message);
+  g_hash_table_insert (self->priv->pending_messages_index, msg,
+      self->priv->pending_messages_queue->tail);
   g_signal_emit (self, signals[MESSAGE_RECEIVED], 0, message);
 }
 
@@ -421,19 +429,6 @@ message_received_cb (TpTextChannel *channel,
   handle_incoming_message (self, message, FALSE);
 }
 
-static gboolean
-find_pending_message_func (gconstpointer a,
-    gconstpointer b)
-{
-  EmpathyMessage *msg = (EmpathyMessage *) a;
-  TpMessage *message = (TpMessage *) b;
-
-  if (empathy_message_get_tp_message (msg) == message)
-    return 0;
-
-  return -1;
-}
-
 static void
 pending_message_removed_cb (TpTextChannel   *channel,
     TpMessage *message,
@@ -441,12 +436,12 @@ pending_message_removed_cb (TpTextChannel   *channel,
 {
   GList *m;
 
-  m = g_queue_find_custom (self->priv->pending_messages_queue, message,
-      find_pending_message_func);
-
+  m = g_hash_table_lookup (self->priv->pending_messages_index, message);
   if (m == NULL)
     return;
 
+  g_hash_table_remove (self->priv->pending_messages_index, message);
+
   g_signal_emit (self, signals[MESSAGE_ACKNOWLEDGED], 0, m->data);
 
   g_object_unref (m->data);
@@ -692,6 +687,11 @@ tp_chat_dispose (GObject *object)
   tp_clear_object (&self->priv->remote_contact);
   tp_clear_object (&self->priv->user);
 
+  g_hash_table_remove_all (self->priv->members_index);
+  g_queue_foreach (self->priv->members, (GFunc) g_object_unref, NULL);
+  g_queue_clear (self->priv->members);
+
+  g_hash_table_remove_all (self->priv->pending_messages_index);
   g_queue_foreach (self->priv->pending_messages_queue,
     (GFunc) g_object_unref, NULL);
   g_queue_clear (self->priv->pending_messages_queue);
@@ -710,7 +710,10 @@ tp_chat_finalize (GObject *object)
   DEBUG ("Finalize: %p", object);
 
   g_queue_free (self->priv->pending_messages_queue);
+  g_hash_table_unref (self->priv->pending_messages_index);
   g_hash_table_unref (self->priv->messages_being_sent);
+  g_queue_free (self->priv->members);
+  g_hash_table_unref (self->priv->members_index);
 
   g_free (self->priv->title);
   g_free (self->priv->subject);
@@ -736,7 +739,8 @@ check_almost_ready (EmpathyTpChat *self)
   /* We need either the members (room) or the remote contact (private chat).
    * If the chat is protected by a password we can't get these information so
    * consider the chat as ready so it can be presented to the user. */
-  if (!tp_channel_password_needed (channel) && self->priv->members == NULL &&
+  if (!tp_channel_password_needed (channel) &&
+      g_queue_is_empty (self->priv->members) &&
       self->priv->remote_contact == NULL)
     return;
 
@@ -756,45 +760,94 @@ check_almost_ready (EmpathyTpChat *self)
   check_ready (self);
 }
 
+/* Takes ownership of contact. Returns FALSE if it already was a member. */
+static gboolean
+add_member (EmpathyTpChat *self,
+    EmpathyContact *contact)
+{
+  if (g_hash_table_contains (self->priv->members_index, contact))
+    {
+      g_object_unref (contact);
+      return FALSE;
+    }
+
+  g_queue_push_head (self->priv->members, contact);
+  g_hash_table_insert (self->priv->members_index, contact,
+      self->priv->members->head);
+
+  return TRUE;
+}
+
+/* Returns FALSE if contact was not a member */
+static gboolean
+remove_member (EmpathyTpChat *self,
+    EmpathyContact *contact)
+{
+  GList *link;
+
+  link = g_hash_table_lookup (self->priv->members_index, contact);
+  if (link == NULL)
+    return FALSE;
+
+  g_hash_table_remove (self->priv->members_index, contact);
+  g_queue_delete_link (self->priv->members, link);
+  g_object_unref (contact);
+
+  return TRUE;
+}
+
 static void
-add_members_contact (EmpathyTpChat *self,
-    GPtrArray *contacts)
+emit_members_changed (EmpathyTpChat *self,
+    GPtrArray *added,
+    GPtrArray *removed,
+    EmpathyContact *actor,
+    TpChannelGroupChangeReason reason,
+    const gchar *message)
 {
   guint i;
 
-  for (i = 0; i < contacts->len; i++)
-    {
-      EmpathyContact *contact;
+  if (added->len == 0 && removed->len == 0)
+    return;
 
-      contact = empathy_contact_dup_from_tp_contact (g_ptr_array_index (
-            contacts, i));
+  g_signal_emit (self, signals[SIG_MEMBERS_CHANGED_BATCH], 0,
+      added, removed, actor, reason, message);
 
-      self->priv->members = g_list_prepend (self->priv->members, contact);
+  /* One emission per contact is only done for the users of the old
+   * signal, joining a big room can add thousands of contacts. */
+  if (!g_signal_has_handler_pending (self, signals[SIG_MEMBERS_CHANGED], 0,
+        FALSE))
+    return;
 
-      g_signal_emit (self, signals[SIG_MEMBERS_CHANGED], 0,
-                 contact, NULL, 0, NULL, TRUE);
-    }
+  for (i = 0; i < removed->len; i++)
+    g_signal_emit (self, signals[SIG_MEMBERS_CHANGED], 0,
+        g_ptr_array_index (removed, i), actor, reason, message, FALSE);
 
-  check_almost_ready (self);
+  for (i = 0; i < added->len; i++)
+    g_signal_emit (self, signals[SIG_MEMBERS_CHANGED], 0,
+        g_ptr_array_index (added, i), NULL, 0, NULL, TRUE);
 }
 
+/* Adds the TpContacts in contacts to the members, and the EmpathyContacts
+ * which were not members yet to added */
 static void
-remove_member (EmpathyTpChat *self,
-    EmpathyContact *contact)
+add_members_contact (EmpathyTpChat *self,
+    GPtrArray *contacts,
+    GPtrArray *added)
 {
-  GList *l;
+  guint i;
 
-  for (l = self->priv->members; l; l = l->next)
+  for (i = 0; i < contacts->len; i++)
     {
-      EmpathyContact *c = l->data;
+      EmpathyContact *contact;
 
-      if (contact == c)
-        {
-          self->priv->members = g_list_delete_link (self->priv->members, l);
-          g_object_unref (c);
-          break;
-        }
+      contact = empathy_contact_dup_from_tp_contact (g_ptr_array_index (
+            contacts, i));
+
+      if (contact != NULL && add_member (self, contact))
+        g_ptr_array_add (added, g_object_ref (contact));
     }
+
+  check_almost_ready (self);
 }
 
 static void
@@ -809,7 +862,8 @@ contact_renamed (EmpathyTpChat *self,
   old = empathy_contact_dup_from_tp_contact (old_contact);
   new = empathy_contact_dup_from_tp_contact (new_contact);
 
-  self->priv->members = g_list_prepend (self->priv->members, new);
+  /* The reference is given to the members but we still use it below */
+  add_member (self, g_object_ref (new));
 
   if (old != NULL)
     {
@@ -828,6 +882,8 @@ contact_renamed (EmpathyTpChat *self,
       g_object_notify (G_OBJECT (self), "self-contact");
     }
 
+  g_object_unref (new);
+
   check_almost_ready (self);
 }
 
@@ -845,6 +901,7 @@ tp_chat_group_contacts_changed_cb (TpChannel *channel,
   guint i;
   TpChannelGroupChangeReason reason;
   const gchar *message;
+  GPtrArray *added_contacts, *removed_contacts;
 
   reason = tp_asv_get_uint32 (details, "change-reason", NULL);
   message = tp_asv_get_string (details, "message");
@@ -880,6 +937,9 @@ tp_chat_group_contacts_changed_cb (TpChannel *channel,
         }
     }
 
+  added_contacts = g_ptr_array_new_with_free_func (g_object_unref);
+  removed_contacts = g_ptr_array_new_with_free_func (g_object_unref);
+
   /* Remove contacts that are not members anymore */
   for (i = 0; i < removed->len; i++)
     {
@@ -891,18 +951,21 @@ tp_chat_group_contacts_changed_cb (TpChannel *channel,
       if (contact != NULL)
         {
           remove_member (self, contact);
-
-          g_signal_emit (self, signals[SIG_MEMBERS_CHANGED], 0,
-                     contact, actor_contact, reason, message, FALSE);
-          g_object_unref (contact);
+          g_ptr_array_add (removed_contacts, contact);
         }
     }
 
   if (added->len > 0)
     {
-      add_members_contact (self, added);
+      add_members_contact (self, added, added_contacts);
     }
 
+  emit_members_changed (self, added_contacts, removed_contacts,
+      actor_contact, reason, message);
+
+  g_ptr_array_unref (added_contacts);
+  g_ptr_array_unref (removed_contacts);
+
   if (actor_contact != NULL)
     g_object_unref (actor_contact);
 }
@@ -1090,6 +1153,26 @@ empathy_tp_chat_class_init (EmpathyTpChatClass *klass)
       5, EMPATHY_TYPE_CONTACT, EMPATHY_TYPE_CONTACT,
       G_TYPE_UINT, G_TYPE_STRING, G_TYPE_BOOLEAN);
 
+  /**
+   * EmpathyTpChat::members-changed-batch:
+   * @self: the #EmpathyTpChat
+   * @added: (element-type EmpathyContact): the new members
+   * @removed: (element-type EmpathyContact): the contacts which left
+   * @actor: the #EmpathyContact who made the change, or %NULL
+   * @reason: a #TpChannelGroupChangeReason
+   * @message: the message explaining the change, or %NULL
+   *
+   * Like #EmpathyTpChat::members-changed, but emitted once for all the
+   * contacts of a change.
+   */
+  signals[SIG_MEMBERS_CHANGED_BATCH] = g_signal_new ("members-changed-batch",
+      G_OBJECT_CLASS_TYPE (klass),
+      G_SIGNAL_RUN_LAST,
+      0, NULL, NULL, NULL,
+      G_TYPE_NONE,
+      5, G_TYPE_PTR_ARRAY, G_TYPE_PTR_ARRAY, EMPATHY_TYPE_CONTACT,
+      G_TYPE_UINT, G_TYPE_STRING);
+
   g_type_class_add_private (object_class, sizeof (EmpathyTpChatPrivate));
 }
 
@@ -1100,6 +1183,9 @@ empathy_tp_chat_init (EmpathyTpChat *self)
       EmpathyTpChatPrivate);
 
   self->priv->pending_messages_queue = g_queue_new ();
+  self->priv->pending_messages_index = g_hash_table_new (NULL, NULL);
+  self->priv->members = g_queue_new ();
+  self->priv->members_index = g_hash_table_new (NULL, NULL);
   self->priv->messages_being_sent = g_hash_table_new_full (
       g_str_hash, g_str_equal, g_free, NULL);
 }
@@ -1204,6 +1290,69 @@ empathy_tp_chat_acknowledge_message (EmpathyTpChat *self,
              tp_msg, NULL, NULL);
 }
 
+static void
+ack_messages_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GError *error = NULL;
+
+  if (!tp_text_channel_ack_messages_finish (TP_TEXT_CHANNEL (source), result,
+        &error))
+    {
+      DEBUG ("Failed to ack messages: %s", error->message);
+      g_error_free (error);
+    }
+}
+
+/**
+ * empathy_tp_chat_acknowledge_messages_up_to:
+ * @self: an #EmpathyTpChat
+ * @message: (allow-none): a pending message, or %NULL
+ *
+ * Acknowledges @message and all the messages received before it, or all
+ * the pending messages if @message is %NULL, in a single D-Bus call.
+ * Unlike tp_text_channel_ack_all_pending_messages_async() this doesn't ack
+ * messages the channel has but which haven't been signalled yet.
+ */
+void
+empathy_tp_chat_acknowledge_messages_up_to (EmpathyTpChat *self,
+    EmpathyMessage *message)
+{
+  GList *last = NULL;
+  GList *l;
+  GList *tp_msgs = NULL;
+
+  g_return_if_fail (EMPATHY_IS_TP_CHAT (self));
+
+  if (message != NULL)
+    {
+      last = g_hash_table_lookup (self->priv->pending_messages_index,
+          empathy_message_get_tp_message (message));
+
+      if (last == NULL)
+        return;
+    }
+
+  for (l = self->priv->pending_messages_queue->head; l != NULL; l = l->next)
+    {
+      if (empathy_message_is_incoming (l->data))
+        tp_msgs = g_list_prepend (tp_msgs,
+            empathy_message_get_tp_message (l->data));
+
+      if (l == last)
+        break;
+    }
+
+  if (tp_msgs == NULL)
+    return;
+
+  tp_msgs = g_list_reverse (tp_msgs);
+  tp_text_channel_ack_messages_async (TP_TEXT_CHANNEL (self), tp_msgs,
+      ack_messages_cb, NULL);
+  g_list_free (tp_msgs);
+}
+
 /**
  * empathy_tp_chat_can_add_contact:
  *
@@ -1335,7 +1484,7 @@ continue_preparing (EmpathyTpChat *self)
   if (tp_proxy_has_interface_by_id (self,
             TP_IFACE_QUARK_CHANNEL_INTERFACE_GROUP))
     {
-      GPtrArray *contacts;
+      GPtrArray *contacts, *added, *removed;
       TpContact *contact;
 
       /* Get self contact from the group's self handle */
@@ -1344,8 +1493,15 @@ continue_preparing (EmpathyTpChat *self)
 
       /* Get initial member contacts */
       contacts = tp_channel_group_dup_members_contacts (channel);
-      add_members_contact (self, contacts);
+      added = g_ptr_array_new_with_free_func (g_object_unref);
+      removed = g_ptr_array_new ();
+
+      add_members_contact (self, contacts, added);
+      emit_members_changed (self, added, removed, NULL, 0, NULL);
+
       g_ptr_array_unref (contacts);
+      g_ptr_array_unref (added);
+      g_ptr_array_unref (removed);
 
       self->priv->can_upgrade_to_muc = FALSE;
 
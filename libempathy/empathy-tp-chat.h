@@ -86,6 +86,8 @@ void empathy_tp_chat_set_subject (EmpathyTpChat *self,
 const GList *  empathy_tp_chat_get_pending_messages (EmpathyTpChat *chat);
 void empathy_tp_chat_acknowledge_message (EmpathyTpChat *chat,
     EmpathyMessage *message);
+void empathy_tp_chat_acknowledge_messages_up_to (EmpathyTpChat *chat,
+    EmpathyMessage *message);
 
 gboolean empathy_tp_chat_can_add_contact (EmpathyTpChat *self);
 
@@ -44,6 +44,7 @@ static gboolean activated = FALSE;
 static gboolean use_timer = TRUE;
 
 static EmpathyChatManager *chat_mgr = NULL;
+static EmpathyThemeManager *theme_mgr = NULL;
 
 static void
 displayed_chats_changed_cb (EmpathyChatManager *mgr,
@@ -76,6 +77,10 @@ activate_cb (GApplication *application)
   g_assert (chat_mgr == NULL);
   chat_mgr = empathy_chat_manager_dup_singleton ();
 
+  /* Have a view ready for the first chat */
+  theme_mgr = empathy_theme_manager_dup_singleton ();
+  empathy_theme_manager_prepare_views (theme_mgr);
+
   empathy_chat_window_present_chat(NULL, 0);
 
   g_signal_connect (chat_mgr, "displayed-chats-changed",
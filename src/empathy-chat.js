@@ -90,3 +90,84 @@ function prependPrev(html) {
   for (var i = node.childNodes.length - 2; i > 0; i--)
     contents.insertBefore(node.childNodes[i], pre.nextSibling);
 }
+
+
+// Keep the messages on screen in place while older ones are prepended,
+// see empathy_theme_adium_begin_prepend()
+var prependOffset = -1;
+
+function beginPrepend() {
+  prependOffset = document.body.scrollHeight - document.body.scrollTop;
+}
+
+
+function endPrepend() {
+  if (prependOffset < 0)
+    return;
+
+  document.body.scrollTop = document.body.scrollHeight - prependOffset;
+  prependOffset = -1;
+
+  // The page might not have filled the view, see if more is needed
+  notifyScroll();
+}
+
+
+// Remove the unread markers of the messages matching selector
+function removeFocusMarks(selector) {
+  var nodes = chat.querySelectorAll(selector);
+
+  for (var i = 0; i < nodes.length; i++)
+    nodes[i].classList.remove("focus", "firstFocus");
+}
+
+
+// Remove the n oldest messages, see theme_adium_maybe_prune(). Each message
+// not joined to the previous one starts with a .x-empathy-message marker.
+function pruneMessages(n) {
+  // The messages the template is still buffering aren't in #Chat yet
+  if (typeof coalescedHTML != "undefined" && coalescedHTML)
+    coalescedHTML.cancel();
+
+  var markers = chat.querySelectorAll("#Chat > .x-empathy-message");
+  if (n >= markers.length)
+    return;
+
+  // Everything before the first message kept, but the page clearPage() adds
+  var first = markers[n];
+  var node = chat.firstChild;
+
+  while (node != first) {
+    var next = node.nextSibling;
+
+    if (node.id != "interleaving_page")
+      chat.removeChild(node);
+
+    node = next;
+  }
+}
+
+
+// Tell Empathy where the user scrolled to: "near-top" when less than a
+// page away from the top (sent for each scroll event, so more history
+// can be requested), "at-bottom" or "middle" when that changes.
+var scrollState = "at-bottom";
+
+function notifyScroll() {
+  var state;
+
+  if (document.body.scrollTop < window.innerHeight)
+    state = "near-top";
+  else if (nearBottom())
+    state = "at-bottom";
+  else
+    state = "middle";
+
+  if (state == scrollState && state != "near-top")
+    return;
+
+  scrollState = state;
+  window.webkit.messageHandlers.empathy.postMessage(state);
+}
+
+window.addEventListener("scroll", notifyScroll);
@@ -0,0 +1,156 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "empathy-avatar-cache.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+#define AVATAR_SIZE 32
+
+static GdkPixbuf *
+avatar_new (void)
+{
+  return gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, AVATAR_SIZE,
+      AVATAR_SIZE);
+}
+
+static gsize
+avatar_size (GdkPixbuf *pixbuf)
+{
+  return gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf);
+}
+
+static void
+check_stats (EmpathyAvatarCache *cache,
+    guint expected_hits,
+    guint expected_misses)
+{
+  guint hits, misses;
+
+  empathy_avatar_cache_get_stats (cache, &hits, &misses);
+
+  g_assert_cmpuint (hits, ==, expected_hits);
+  g_assert_cmpuint (misses, ==, expected_misses);
+}
+
+static void
+test_avatar_cache (void)
+{
+  EmpathyAvatarCache *cache;
+  GdkPixbuf *pixbuf, *cached;
+
+  cache = empathy_avatar_cache_new (1024 * 1024);
+  pixbuf = avatar_new ();
+
+  g_assert (empathy_avatar_cache_lookup (cache, "token", AVATAR_SIZE,
+        AVATAR_SIZE, TRUE) == NULL);
+  check_stats (cache, 0, 1);
+
+  empathy_avatar_cache_insert (cache, "token", AVATAR_SIZE, AVATAR_SIZE,
+      TRUE, pixbuf);
+  g_assert_cmpuint (empathy_avatar_cache_get_size (cache), ==,
+      avatar_size (pixbuf));
+
+  cached = empathy_avatar_cache_lookup (cache, "token", AVATAR_SIZE,
+      AVATAR_SIZE, TRUE);
+  g_assert (cached == pixbuf);
+  g_object_unref (cached);
+  check_stats (cache, 1, 1);
+
+  /* Another size, rounding or token is another image */
+  g_assert (empathy_avatar_cache_lookup (cache, "token", 48, 48,
+        TRUE) == NULL);
+  g_assert (empathy_avatar_cache_lookup (cache, "token", AVATAR_SIZE,
+        AVATAR_SIZE, FALSE) == NULL);
+  g_assert (empathy_avatar_cache_lookup (cache, "other", AVATAR_SIZE,
+        AVATAR_SIZE, TRUE) == NULL);
+  check_stats (cache, 1, 4);
+
+  /* Inserting the same avatar again replaces it */
+  empathy_avatar_cache_insert (cache, "token", AVATAR_SIZE, AVATAR_SIZE,
+      TRUE, pixbuf);
+  g_assert_cmpuint (empathy_avatar_cache_get_size (cache), ==,
+      avatar_size (pixbuf));
+
+  g_object_unref (pixbuf);
+  empathy_avatar_cache_free (cache);
+}
+
+static void
+test_avatar_cache_lru (void)
+{
+  EmpathyAvatarCache *cache;
+  GdkPixbuf *pixbuf, *cached;
+
+  pixbuf = avatar_new ();
+
+  /* Room for two avatars */
+  cache = empathy_avatar_cache_new (2 * avatar_size (pixbuf));
+
+  empathy_avatar_cache_insert (cache, "a", AVATAR_SIZE, AVATAR_SIZE, TRUE,
+      pixbuf);
+  empathy_avatar_cache_insert (cache, "b", AVATAR_SIZE, AVATAR_SIZE, TRUE,
+      pixbuf);
+
+  /* "a" is now more recently used than "b" */
+  cached = empathy_avatar_cache_lookup (cache, "a", AVATAR_SIZE, AVATAR_SIZE,
+      TRUE);
+  g_assert (cached != NULL);
+  g_object_unref (cached);
+
+  empathy_avatar_cache_insert (cache, "c", AVATAR_SIZE, AVATAR_SIZE, TRUE,
+      pixbuf);
+  g_assert_cmpuint (empathy_avatar_cache_get_size (cache), ==,
+      2 * avatar_size (pixbuf));
+
+  g_assert (empathy_avatar_cache_lookup (cache, "b", AVATAR_SIZE,
+        AVATAR_SIZE, TRUE) == NULL);
+
+  cached = empathy_avatar_cache_lookup (cache, "a", AVATAR_SIZE, AVATAR_SIZE,
+      TRUE);
+  g_assert (cached != NULL);
+  g_object_unref (cached);
+
+  cached = empathy_avatar_cache_lookup (cache, "c", AVATAR_SIZE, AVATAR_SIZE,
+      TRUE);
+  g_assert (cached != NULL);
+  g_object_unref (cached);
+
+  check_stats (cache, 3, 1);
+
+  empathy_avatar_cache_free (cache);
+
+  /* Too big to be cached at all */
+  cache = empathy_avatar_cache_new (avatar_size (pixbuf) - 1);
+
+  empathy_avatar_cache_insert (cache, "a", AVATAR_SIZE, AVATAR_SIZE, TRUE,
+      pixbuf);
+  g_assert_cmpuint (empathy_avatar_cache_get_size (cache), ==, 0);
+  g_assert (empathy_avatar_cache_lookup (cache, "a", AVATAR_SIZE,
+        AVATAR_SIZE, TRUE) == NULL);
+
+  empathy_avatar_cache_free (cache);
+  g_object_unref (pixbuf);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/avatar-cache", test_avatar_cache);
+  g_test_add_func ("/avatar-cache/lru", test_avatar_cache_lru);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
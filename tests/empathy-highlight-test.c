@@ -0,0 +1,101 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "empathy-highlight-matcher.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+typedef struct
+{
+  const gchar *text;
+  gboolean should_match;
+} HighlightTest;
+
+static void
+test_highlight (void)
+{
+  const gchar *words[] = { "badger", "Mushroom", "c++", "Gaëtan", NULL };
+  HighlightTest tests[] =
+    {
+      /* Whole words only, any case */
+      { "badger", TRUE },
+      { "hello badger!", TRUE },
+      { "badger: ping", TRUE },
+      { "BADGER", TRUE },
+      { "badgers", FALSE },
+      { "honeybadger", FALSE },
+      { "badger_", FALSE },
+      { "a mushroom", TRUE },
+      { "mushrooms", FALSE },
+
+      /* Words not starting or ending with a word character */
+      { "I like c++", TRUE },
+      { "I like c++11", TRUE },
+      { "I like cc++", FALSE },
+
+      /* Non-ASCII */
+      { "salut gaëtan", TRUE },
+      { "salut GAËTAN", TRUE },
+      { "Gaëtanë", FALSE },
+
+      /* A failed candidate must not hide a later match */
+      { "badgerbadger badger", TRUE },
+      { "snake", FALSE },
+      { "", FALSE },
+
+      { NULL, FALSE }
+    };
+  EmpathyHighlightMatcher *matcher;
+  guint i;
+
+  matcher = empathy_highlight_matcher_new (words);
+
+  for (i = 0; tests[i].text != NULL; i++)
+    {
+      gboolean match;
+      gboolean ok;
+
+      match = empathy_highlight_matcher_match (matcher, tests[i].text);
+      ok = (match == tests[i].should_match);
+
+      DEBUG ("'%s' %s: %s", tests[i].text,
+          tests[i].should_match ? "should match" : "should NOT match",
+          ok ? "OK" : "FAILED");
+
+      g_assert (ok);
+    }
+
+  empathy_highlight_matcher_unref (matcher);
+}
+
+static void
+test_highlight_empty (void)
+{
+  EmpathyHighlightMatcher *matcher;
+
+  matcher = empathy_highlight_matcher_new (NULL);
+  g_assert (!empathy_highlight_matcher_match (matcher, "badger"));
+  empathy_highlight_matcher_unref (matcher);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/highlight", test_highlight);
+  g_test_add_func ("/highlight/empty", test_highlight_empty);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
@@ -6,6 +6,7 @@
 #include <telepathy-glib/telepathy-glib.h>
 #include <tp-account-widgets/tpaw-string-parser.h>
 
+#include "empathy-smiley-manager.h"
 #include "empathy-string-parser.h"
 #include "test-helper.h"
 
@@ -25,77 +26,82 @@ test_replace_match (const gchar *text,
   g_string_append_c (string, ']');
 }
 
+static const gchar *tests[] =
+{
+  /* Basic link matches */
+  "http://foo.com", "[http://foo.com]",
+  "http://foo.com\nhttp://bar.com", "[http://foo.com]\n[http://bar.com]",
+  "http://foo.com/test?id=bar?", "[http://foo.com/test?id=bar]?",
+  "git://foo.com", "[git://foo.com]",
+  "git+ssh://foo.com", "[git+ssh://foo.com]",
+  "mailto:user@server.com", "[mailto:user@server.com]",
+  "www.foo.com", "[www.foo.com]",
+  "ftp.foo.com", "[ftp.foo.com]",
+  "user@server.com", "[user@server.com]",
+  "first.last@server.com", "[first.last@server.com]",
+  "http://foo.com. bar", "[http://foo.com]. bar",
+  "http://foo.com; bar", "[http://foo.com]; bar",
+  "http://foo.com: bar", "[http://foo.com]: bar",
+  "http://foo.com:bar", "[http://foo.com:bar]",
+  "http://apos'foo.com", "[http://apos'foo.com]",
+  "mailto:bar'?user@server.com", "[mailto:bar'?user@server.com]",
+
+  /* They are not links! */
+  "http://", "http[:/]/", /* Hm... */
+  "www.", "www.",
+  "w.foo.com", "w.foo.com",
+  "@server.com", "@server.com",
+  "mailto:user@", "mailto:user@",
+  "mailto:user@.com", "mailto:user@.com",
+  "user@.com", "user@.com",
+
+  /* Links inside (), {}, [], <>, "" or '' */
+  /* FIXME: How to test if the ending ] is matched or not? */
+  "Foo (www.foo.com)", "Foo ([www.foo.com])",
+  "Foo {www.foo.com}", "Foo {[www.foo.com]}",
+  "Foo [www.foo.com]", "Foo [[www.foo.com]]",
+  "Foo <www.foo.com>", "Foo &lt;[www.foo.com]&gt;",
+  "Foo \"www.foo.com\"", "Foo &quot;[www.foo.com]&quot;",
+  "Foo (www.foo.com/bar(123)baz)", "Foo ([www.foo.com/bar(123)baz])",
+  "<a href=\"http://foo.com\">bar</a>", "&lt;a href=&quot;[http://foo.com]&quot;&gt;bar&lt;/a&gt;",
+  "Foo (user@server.com)", "Foo ([user@server.com])",
+  "Foo {user@server.com}", "Foo {[user@server.com]}",
+  "Foo [user@server.com]", "Foo [[user@server.com]]",
+  "Foo <user@server.com>", "Foo &lt;[user@server.com]&gt;",
+  "Foo \"user@server.com\"", "Foo &quot;[user@server.com]&quot;",
+  "<a href='http://apos'foo.com'>bar</a>", "&lt;a href=&apos;[http://apos'foo.com]&apos;&gt;bar&lt;/a&gt;",
+  "Foo 'bar'?user@server.com'", "Foo &apos;[bar'?user@server.com]&apos;",
+
+  /* Basic smileys */
+  "a:)b", "a[:)]b",
+  ">:)", "[>:)]",
+  ">:(", "&gt;[:(]",
+  ":-)))", "[:-))])",
+  ":(|)", "[:(|)]",
+  ":-(|x", "[:-(]|x",
+  "\360\237\221\274:)", "[\360\237\221\274][:)]",
+
+  /* Smileys and links mixed */
+  ":)http://foo.com", "[:)][http://foo.com]",
+  "a :) b http://foo.com c :( d www.test.com e", "a [:)] b [http://foo.com] c [:(] d [www.test.com] e",
+
+  /* '\r' should be stripped */
+  "badger\n\rmushroom", "badger\nmushroom",
+  "badger\r\nmushroom", "badger\nmushroom",
+
+  /* FIXME: Known issue: Brackets should be counted by the parser */
+  //"Foo www.bar.com/test(123)", "Foo [www.bar.com/test(123)]",
+  //"Foo (www.bar.com/test(123))", "Foo ([www.bar.com/test(123)])",
+  //"Foo www.bar.com/test{123}", "Foo [www.bar.com/test{123}]",
+  //"Foo (:))", "Foo ([:)])",
+  //"Foo <a href=\"http://foo.com\">:)</a>", "Foo <a href=\"[http://foo.com]\">[:)]</a>",
+
+  NULL, NULL
+};
+
 static void
 test_parsers (void)
 {
-  gchar *tests[] =
-    {
-      /* Basic link matches */
-      "http://foo.com", "[http://foo.com]",
-      "http://foo.com\nhttp://bar.com", "[http://foo.com]\n[http://bar.com]",
-      "http://foo.com/test?id=bar?", "[http://foo.com/test?id=bar]?",
-      "git://foo.com", "[git://foo.com]",
-      "git+ssh://foo.com", "[git+ssh://foo.com]",
-      "mailto:user@server.com", "[mailto:user@server.com]",
-      "www.foo.com", "[www.foo.com]",
-      "ftp.foo.com", "[ftp.foo.com]",
-      "user@server.com", "[user@server.com]",
-      "first.last@server.com", "[first.last@server.com]",
-      "http://foo.com. bar", "[http://foo.com]. bar",
-      "http://foo.com; bar", "[http://foo.com]; bar",
-      "http://foo.com: bar", "[http://foo.com]: bar",
-      "http://foo.com:bar", "[http://foo.com:bar]",
-      "http://apos'foo.com", "[http://apos'foo.com]",
-      "mailto:bar'?user@server.com", "[mailto:bar'?user@server.com]",
-
-      /* They are not links! */
-      "http://", "http[:/]/", /* Hm... */
-      "www.", "www.",
-      "w.foo.com", "w.foo.com",
-      "@server.com", "@server.com",
-      "mailto:user@", "mailto:user@",
-      "mailto:user@.com", "mailto:user@.com",
-      "user@.com", "user@.com",
-
-      /* Links inside (), {}, [], <>, "" or '' */
-      /* FIXME: How to test if the ending ] is matched or not? */
-      "Foo (www.foo.com)", "Foo ([www.foo.com])",
-      "Foo {www.foo.com}", "Foo {[www.foo.com]}",
-      "Foo [www.foo.com]", "Foo [[www.foo.com]]",
-      "Foo <www.foo.com>", "Foo &lt;[www.foo.com]&gt;",
-      "Foo \"www.foo.com\"", "Foo &quot;[www.foo.com]&quot;",
-      "Foo (www.foo.com/bar(123)baz)", "Foo ([www.foo.com/bar(123)baz])",
-      "<a href=\"http://foo.com\">bar</a>", "&lt;a href=&quot;[http://foo.com]&quot;&gt;bar&lt;/a&gt;",
-      "Foo (user@server.com)", "Foo ([user@server.com])",
-      "Foo {user@server.com}", "Foo {[user@server.com]}",
-      "Foo [user@server.com]", "Foo [[user@server.com]]",
-      "Foo <user@server.com>", "Foo &lt;[user@server.com]&gt;",
-      "Foo \"user@server.com\"", "Foo &quot;[user@server.com]&quot;",
-      "<a href='http://apos'foo.com'>bar</a>", "&lt;a href=&apos;[http://apos'foo.com]&apos;&gt;bar&lt;/a&gt;",
-      "Foo 'bar'?user@server.com'", "Foo &apos;[bar'?user@server.com]&apos;",
-
-      /* Basic smileys */
-      "a:)b", "a[:)]b",
-      ">:)", "[>:)]",
-      ">:(", "&gt;[:(]",
-
-      /* Smileys and links mixed */
-      ":)http://foo.com", "[:)][http://foo.com]",
-      "a :) b http://foo.com c :( d www.test.com e", "a [:)] b [http://foo.com] c [:(] d [www.test.com] e",
-
-      /* '\r' should be stripped */
-      "badger\n\rmushroom", "badger\nmushroom",
-      "badger\r\nmushroom", "badger\nmushroom",
-
-      /* FIXME: Known issue: Brackets should be counted by the parser */
-      //"Foo www.bar.com/test(123)", "Foo [www.bar.com/test(123)]",
-      //"Foo (www.bar.com/test(123))", "Foo ([www.bar.com/test(123)])",
-      //"Foo www.bar.com/test{123}", "Foo [www.bar.com/test{123}]",
-      //"Foo (:))", "Foo ([:)])",
-      //"Foo <a href=\"http://foo.com\">:)</a>", "Foo <a href=\"[http://foo.com]\">[:)]</a>",
-
-      NULL, NULL
-    };
   TpawStringParser parsers[] =
     {
       {tpaw_string_match_link, test_replace_match},
@@ -122,6 +128,178 @@ test_parsers (void)
     }
 }
 
+static const EmpathyStringScanner test_string_scanner =
+{
+  NULL, test_replace_match, test_replace_match, NULL
+};
+
+static void
+test_scanner (void)
+{
+  guint i;
+
+  for (i = 0; tests[i] != NULL; i += 2)
+    {
+      GString *string;
+      gboolean ok;
+
+      string = g_string_new (NULL);
+      empathy_string_scan (&test_string_scanner, tests[i], -1, string);
+
+      ok = !tp_strdiff (tests[i + 1], string->str);
+      DEBUG ("'%s' => '%s': %s", tests[i], string->str, ok ? "OK" : "FAILED");
+      g_assert (ok);
+
+      g_string_free (string, TRUE);
+    }
+}
+
+/* Markup escaping and newlines, which the scanner handles itself */
+static const gchar *escape_tests[] =
+{
+  "a\nb", "a<br/>b",
+  "a\r\nb", "a<br/>b",
+  "a\n\nb\n", "a<br/><br/>b<br/>",
+  "a\tb", "a\tb",
+  "a\x01" "b", "a&#x1;b",
+  "a\x1b[0m", "a&#x1b;[0m",
+  "a\x7f" "b", "a&#x7f;b",
+  /* C1 control characters, but U+0085 NEXT LINE */
+  "a\xc2\x80" "b", "a&#x80;b",
+  "a\xc2\x9f" "b", "a&#x9f;b",
+  "a\xc2\x85" "b", "a\xc2\x85" "b",
+  "\xc2\xa0\xc3\xa9", "\xc2\xa0\xc3\xa9",
+  "<b>&amp;</b>\n'\"", "&lt;b&gt;&amp;amp;&lt;/b&gt;<br/>&apos;&quot;",
+
+  NULL, NULL
+};
+
+static const EmpathyStringScanner test_escape_scanner =
+{
+  NULL, NULL, NULL, "<br/>"
+};
+
+static void
+test_scanner_escape (void)
+{
+  GString *string;
+  guint i;
+
+  string = g_string_new (NULL);
+
+  for (i = 0; escape_tests[i] != NULL; i += 2)
+    {
+      g_string_truncate (string, 0);
+      empathy_string_scan (&test_escape_scanner, escape_tests[i], -1,
+          string);
+      g_assert_cmpstr (string->str, ==, escape_tests[i + 1]);
+    }
+
+  /* Without a newline replacement '\n' is left alone */
+  g_string_truncate (string, 0);
+  empathy_string_scan (&test_string_scanner, "a\nb\x01", -1, string);
+  g_assert_cmpstr (string->str, ==, "a\nb&#x1;");
+
+  g_string_free (string, TRUE);
+}
+
+/* A large paste: code, a few links and smileys, lots of characters to
+ * escape. Compare the parser chain with the fused scanner. */
+static void
+test_scanner_perf (void)
+{
+  TpawStringParser parsers[] =
+    {
+      {tpaw_string_match_link, test_replace_match},
+      {empathy_string_match_smiley, test_replace_match},
+      {tpaw_string_match_all, tpaw_string_replace_escaped},
+      {NULL, NULL}
+    };
+  GString *text, *string;
+  gdouble chain, fused;
+  guint i;
+
+  text = g_string_new (NULL);
+  for (i = 0; i < 2000; i++)
+    g_string_append (text,
+        "if (a < b && c > d) { printf (\"%s\", \"it's\"); } :) "
+        "see http://example.com/foo?bar=1 or user@server.com\n");
+
+  string = g_string_sized_new (2 * text->len);
+
+  g_test_timer_start ();
+  for (i = 0; i < 10; i++)
+    {
+      g_string_truncate (string, 0);
+      tpaw_string_parser_substr (text->str, text->len, parsers, string);
+    }
+  chain = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+  for (i = 0; i < 10; i++)
+    {
+      g_string_truncate (string, 0);
+      empathy_string_scan (&test_string_scanner, text->str, text->len,
+          string);
+    }
+  fused = g_test_timer_elapsed ();
+
+  g_test_message ("%" G_GSIZE_FORMAT " bytes: parser chain %fs, "
+      "scanner %fs", text->len, chain / 10, fused / 10);
+  g_test_minimized_result (fused / 10, "scanner %fs", fused / 10);
+
+  g_string_free (string, TRUE);
+  g_string_free (text, TRUE);
+}
+
+/* Smileys too long for the automaton are refused, not fatal */
+static void
+test_smiley_too_long (void)
+{
+  EmpathySmileyManager *manager;
+  EmpathySmileyHit hits[4];
+  gchar *str;
+
+  manager = empathy_smiley_manager_dup_singleton ();
+  str = g_strnfill (G_MAXUINT16, 'x');
+
+  g_test_expect_message (NULL, G_LOG_LEVEL_CRITICAL, "*");
+  empathy_smiley_manager_add (manager, "face-smile", str, NULL);
+  g_test_assert_expected_messages ();
+
+  /* Building the automaton doesn't abort. Hits depend on the icon theme. */
+  g_assert_cmpuint (empathy_smiley_manager_parse_into (manager, "x:)", -1,
+        hits, G_N_ELEMENTS (hits)), <=, 1);
+
+  g_free (str);
+  g_object_unref (manager);
+}
+
+/* A smiley whose icon can't be found doesn't hide the smileys it contains */
+static void
+test_smiley_no_icon (void)
+{
+  TpawStringParser parsers[] =
+    {
+      {empathy_string_match_smiley, test_replace_match},
+      {tpaw_string_match_all, tpaw_string_replace_escaped},
+      {NULL, NULL}
+    };
+  EmpathySmileyManager *manager;
+  GString *string;
+
+  manager = empathy_smiley_manager_dup_singleton ();
+  empathy_smiley_manager_add (manager, "empathy-test-no-such-icon", "8:-)8",
+      NULL);
+
+  string = g_string_new (NULL);
+  tpaw_string_parser_substr ("a 8:-)8 b", -1, parsers, string);
+  g_assert_cmpstr (string->str, ==, "a 8[:-)]8 b");
+
+  g_string_free (string, TRUE);
+  g_object_unref (manager);
+}
+
 int
 main (int argc,
     char **argv)
@@ -131,6 +309,12 @@ main (int argc,
   test_init (argc, argv);
 
   g_test_add_func ("/parsers", test_parsers);
+  g_test_add_func ("/parsers/scanner", test_scanner);
+  g_test_add_func ("/parsers/scanner/escape", test_scanner_escape);
+  g_test_add_func ("/parsers/smiley-too-long", test_smiley_too_long);
+  g_test_add_func ("/parsers/smiley-no-icon", test_smiley_no_icon);
+  if (g_test_perf ())
+    g_test_add_func ("/parsers/scanner/perf", test_scanner_perf);
 
   result = g_test_run ();
   test_deinit ();
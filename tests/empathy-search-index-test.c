@@ -0,0 +1,164 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <tp-account-widgets/tpaw-live-search.h>
+
+#include "empathy-search-index.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+typedef struct
+{
+  const gchar *name;
+  const gchar *ids[3];
+} SearchIndexItem;
+
+/* Items are identified by their index + 1 */
+static const SearchIndexItem items[] =
+  {
+    { "Xavier Claessens", { "xclaesse@jabber.org", NULL } },
+    { "Gaëtan", { "gaetan@example.com", "gdupont@example.com" } },
+    { "Guillaume", { "gdesmott@example.com", NULL } },
+    { "Nobody", { NULL } },
+    { NULL, { NULL } }
+  };
+
+static EmpathySearchIndex *
+search_index_new (void)
+{
+  EmpathySearchIndex *index;
+  guint i;
+
+  index = empathy_search_index_new ();
+
+  for (i = 0; items[i].name != NULL; i++)
+    empathy_search_index_set (index, GUINT_TO_POINTER (i + 1), items[i].name,
+        items[i].ids);
+
+  return index;
+}
+
+/* Check the hits of @text, searched among @among if not NULL */
+static GHashTable *
+check_find (EmpathySearchIndex *index,
+    const gchar *text,
+    GHashTable *among,
+    guint expected)
+{
+  GPtrArray *words;
+  GHashTable *hits;
+  guint i, found = 0;
+
+  words = tpaw_live_search_strip_utf8_string (text);
+  hits = empathy_search_index_find (index, text, words, among);
+
+  for (i = 0; items[i].name != NULL; i++)
+    {
+      gpointer item = GUINT_TO_POINTER (i + 1);
+      gboolean match;
+
+      /* The index doesn't change what matches */
+      match = empathy_search_index_match (index, item, text, words);
+      g_assert (match == g_hash_table_contains (hits, item));
+
+      if (match)
+        found |= 1 << i;
+    }
+
+  DEBUG ("'%s' found %x, expected %x", text, found, expected);
+  g_assert_cmpuint (found, ==, expected);
+
+  if (words != NULL)
+    g_ptr_array_unref (words);
+
+  return hits;
+}
+
+static void
+test_search_index (void)
+{
+  EmpathySearchIndex *index;
+
+  index = search_index_new ();
+
+  /* Words of the name, any case and accents */
+  g_hash_table_unref (check_find (index, "xav", NULL, 1 << 0));
+  g_hash_table_unref (check_find (index, "CLA xav", NULL, 1 << 0));
+  g_hash_table_unref (check_find (index, "gaetan", NULL, 1 << 1));
+  g_hash_table_unref (check_find (index, "g", NULL, 1 << 1 | 1 << 2));
+  g_hash_table_unref (check_find (index, "avier", NULL, 0));
+
+  /* Ids, without the server unless the full prefix is typed */
+  g_hash_table_unref (check_find (index, "gdup", NULL, 1 << 1));
+  g_hash_table_unref (check_find (index, "example", NULL, 0));
+  g_hash_table_unref (check_find (index, "gdesmott@exa", NULL, 1 << 2));
+
+  /* Words must all match the name, or the same id */
+  g_hash_table_unref (check_find (index, "xav xclaesse", NULL, 0));
+  g_hash_table_unref (check_find (index, "guillaume gdupont", NULL, 0));
+
+  /* No word matches everything */
+  g_hash_table_unref (check_find (index, "", NULL, 0xf));
+
+  empathy_search_index_free (index);
+}
+
+static void
+test_search_index_refine (void)
+{
+  EmpathySearchIndex *index;
+  GHashTable *hits, *refined;
+
+  index = search_index_new ();
+
+  hits = check_find (index, "g", NULL, 1 << 1 | 1 << 2);
+  refined = check_find (index, "gu", hits, 1 << 2);
+
+  g_hash_table_unref (hits);
+  g_hash_table_unref (refined);
+
+  empathy_search_index_free (index);
+}
+
+static void
+test_search_index_update (void)
+{
+  EmpathySearchIndex *index;
+  const gchar *ids[] = { "nobody@example.com", NULL };
+
+  index = search_index_new ();
+
+  empathy_search_index_set (index, GUINT_TO_POINTER (4), "Somebody", ids);
+  g_hash_table_unref (check_find (index, "some", NULL, 1 << 3));
+  g_hash_table_unref (check_find (index, "nob", NULL, 1 << 3));
+
+  empathy_search_index_set (index, GUINT_TO_POINTER (4), "Nobody", NULL);
+  g_hash_table_unref (check_find (index, "some", NULL, 0));
+
+  empathy_search_index_remove (index, GUINT_TO_POINTER (1));
+  g_hash_table_unref (check_find (index, "xav", NULL, 0));
+
+  empathy_search_index_free (index);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/search-index", test_search_index);
+  g_test_add_func ("/search-index/refine", test_search_index_refine);
+  g_test_add_func ("/search-index/update", test_search_index_update);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
@@ -0,0 +1,231 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "empathy-gsettings.h"
+#include "empathy-theme-adium.h"
+#include "empathy-theme-manager.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+/* Seconds to wait for the web view */
+#define TIMEOUT 10
+
+typedef struct
+{
+  gchar *text;
+  gboolean done;
+} GetTextData;
+
+static void
+get_text_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GetTextData *data = user_data;
+  WebKitJavascriptResult *js_result;
+
+  js_result = webkit_web_view_run_javascript_finish (
+      WEBKIT_WEB_VIEW (source), result, NULL);
+
+  if (js_result != NULL)
+    {
+      JSGlobalContextRef context;
+      JSValueRef value;
+
+      context = webkit_javascript_result_get_global_context (js_result);
+      value = webkit_javascript_result_get_value (js_result);
+
+      if (JSValueIsString (context, value))
+        {
+          JSStringRef js_str;
+          gsize len;
+
+          js_str = JSValueToStringCopy (context, value, NULL);
+          len = JSStringGetMaximumUTF8CStringSize (js_str);
+          data->text = g_malloc (len);
+          JSStringGetUTF8CString (js_str, data->text, len);
+          JSStringRelease (js_str);
+        }
+
+      webkit_javascript_result_unref (js_result);
+    }
+
+  data->done = TRUE;
+}
+
+/* Returns the text of the #Chat node, or NULL if there is none */
+static gchar *
+view_get_text (EmpathyThemeAdium *view)
+{
+  GetTextData data = { NULL, FALSE };
+
+  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (view),
+      "var chat = document.getElementById('Chat');"
+      "chat != null ? chat.textContent : null",
+      NULL, get_text_cb, &data);
+
+  while (!data.done)
+    g_main_context_iteration (NULL, TRUE);
+
+  return data.text;
+}
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+/* Waits until the view displays @str. Returns FALSE if it doesn't after
+ * TIMEOUT seconds. */
+static gboolean
+view_wait_for_text (EmpathyThemeAdium *view,
+    const gchar *str)
+{
+  gboolean timed_out = FALSE;
+  gboolean found = FALSE;
+  guint id;
+
+  id = g_timeout_add_seconds (TIMEOUT, timeout_cb, &timed_out);
+
+  while (!found && !timed_out)
+    {
+      gchar *text;
+
+      g_main_context_iteration (NULL, FALSE);
+
+      text = view_get_text (view);
+      found = (text != NULL && strstr (text, str) != NULL);
+      g_free (text);
+    }
+
+  if (!timed_out)
+    g_source_remove (id);
+
+  return found;
+}
+
+static EmpathyThemeAdium *
+view_new (void)
+{
+  EmpathyAdiumData *data;
+  EmpathyThemeAdium *view;
+  gchar *path;
+
+  path = empathy_theme_manager_find_theme ("Classic");
+  g_assert (path != NULL);
+
+  data = empathy_adium_data_new (path);
+  view = g_object_ref_sink (empathy_theme_adium_new (data, NULL));
+
+  empathy_adium_data_unref (data);
+  g_free (path);
+
+  return view;
+}
+
+/* Waking up while the empty page is still loading */
+static void
+test_theme_adium_wake_while_loading (void)
+{
+  EmpathyThemeAdium *view;
+
+  view = view_new ();
+
+  empathy_theme_adium_append_event (view, "before hibernating");
+  g_assert (view_wait_for_text (view, "before hibernating"));
+
+  empathy_theme_adium_hibernate (view);
+  empathy_theme_adium_wake (view);
+
+  empathy_theme_adium_append_event (view, "after waking up");
+  g_assert (view_wait_for_text (view, "after waking up"));
+  g_assert (view_wait_for_text (view, "before hibernating"));
+
+  /* Still rendering once everything is loaded */
+  empathy_theme_adium_append_event (view, "later");
+  g_assert (view_wait_for_text (view, "later"));
+
+  gtk_widget_destroy (GTK_WIDGET (view));
+  g_object_unref (view);
+}
+
+/* Pruning while the template still buffers the latest messages */
+static void
+test_theme_adium_prune_coalesced (void)
+{
+  EmpathyThemeAdium *view;
+  GSettings *gsettings;
+  gchar *text;
+  guint i;
+
+  gsettings = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
+  g_settings_set_uint (gsettings, EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT, 10);
+
+  view = view_new ();
+
+  empathy_theme_adium_append_event (view, "loaded");
+  g_assert (view_wait_for_text (view, "loaded"));
+
+  /* Appended in the same batch of scripts as the pruning */
+  for (i = 0; i < 30; i++)
+    {
+      gchar *str = g_strdup_printf ("[%u]", i);
+
+      empathy_theme_adium_append_event (view, str);
+      g_free (str);
+    }
+
+  g_assert (view_wait_for_text (view, "[29]"));
+
+  text = view_get_text (view);
+  g_assert (strstr (text, "loaded") == NULL);
+  g_assert (strstr (text, "[0]") == NULL);
+
+  /* The last messages are all kept */
+  for (i = 20; i < 30; i++)
+    {
+      gchar *str = g_strdup_printf ("[%u]", i);
+
+      g_assert (strstr (text, str) != NULL);
+      g_free (str);
+    }
+
+  g_free (text);
+
+  gtk_widget_destroy (GTK_WIDGET (view));
+  g_object_unref (view);
+
+  g_settings_reset (gsettings, EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT);
+  g_object_unref (gsettings);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  /* Don't change the user's settings */
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/theme-adium/wake-while-loading",
+      test_theme_adium_wake_while_loading);
+  g_test_add_func ("/theme-adium/prune-coalesced",
+      test_theme_adium_prune_coalesced);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}